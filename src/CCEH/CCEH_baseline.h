@@ -333,11 +333,11 @@ class CCEH : public Hash<T> {
   CCEH(int, PMEMobjpool *_pool);
   ~CCEH(void);
   int Insert(T key, Value_t value);
-  int Insert(T key, Value_t value, bool);
+  int Insert(T key, Value_t value, Session &);
   bool Delete(T);
-  bool Delete(T, bool);
+  bool Delete(T, Session &);
   Value_t Get(T);
-  Value_t Get(T, bool is_in_epoch);
+  Value_t Get(T, Session &);
   Value_t FindAnyway(T);
   double Utilization(void);
   size_t Capacity(void);
@@ -660,11 +660,8 @@ void CCEH<T>::Directory_Update(int x, Segment<T> *s0, PMEMoid *s1) {
 }
 
 template <class T>
-int CCEH<T>::Insert(T key, Value_t value, bool is_in_epoch) {
-  if (!is_in_epoch) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
-    return Insert(key, value);
-  }
+int CCEH<T>::Insert(T key, Value_t value, Session &session) {
+  session.Tick();
   return Insert(key, value);
 }
 
@@ -693,6 +690,8 @@ RETRY:
   if(ret == -3) return -1;
 
   if (ret == 1) {
+    /*a split that loses the segment lock to another one is counted too*/
+    pmstat::Scope split_scope(pmstat::kSplit);
     auto s = target->Split(pool_addr, key_hash, log);
     if (s == nullptr) {
       goto RETRY;
@@ -738,11 +737,8 @@ RETRY:
 }
 
 template <class T>
-bool CCEH<T>::Delete(T key, bool is_in_epoch) {
-  if (!is_in_epoch) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
-    return Delete(key);
-  }
+bool CCEH<T>::Delete(T key, Session &session) {
+  session.Tick();
   return Delete(key);
 }
 
@@ -800,13 +796,8 @@ RETRY:
 }
 
 template <class T>
-Value_t CCEH<T>::Get(T key, bool is_in_epoch) {
-  if (is_in_epoch) {
-#ifdef EPOCH
-    auto epoch_guard = Allocator::AquireEpochGuard();
-#endif
-    return Get(key);
-  }
+Value_t CCEH<T>::Get(T key, Session &session) {
+  session.Tick();
   return Get(key);
 }
 
@@ -9,6 +9,8 @@
 #include <libpmemobj.h>
 #endif
 
+class Session;
+
 /*
 * Parent function of all hash indexes
 * Used to define the interface of the hash indexes
@@ -20,7 +22,8 @@ class Hash {
   Hash(void) = default;
   ~Hash(void) = default;
   virtual int Insert(T, Value_t) = 0;
-  virtual int Insert(T, Value_t, bool) = 0;
+  /*operations that take a session run inside the session's epoch*/
+  virtual int Insert(T, Value_t, Session &) = 0;
  
   virtual void bootRestore(){
 
@@ -28,10 +31,13 @@ class Hash {
   virtual void reportRestore(){
 
   };
+  /*true if Insert stores its own copy of a variable-length key, so that the
+   * caller still owns the one it passed*/
+  virtual bool CopiesKeys() { return false; }
   virtual bool Delete(T) = 0;
-  virtual bool Delete(T, bool) = 0;
+  virtual bool Delete(T, Session &) = 0;
   virtual Value_t Get(T) = 0;
-  virtual Value_t Get(T key, bool is_in_epoch) = 0;
+  virtual Value_t Get(T key, Session &session) = 0;
   virtual void Recovery() = 0;
   virtual void getNumber() = 0;
 };
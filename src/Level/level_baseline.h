@@ -30,6 +30,7 @@ support for variable-length key by storing the pointer to the key object.
 #include "../../util/pair.h"
 #include "../../util/utils.h"
 #include "../Hash.h"
+#include "../allocator.h"
 #define ASSOC_NUM 7
 #define NODE_TYPE 1000
 #define LEVEL_TYPE 2000
@@ -126,13 +127,20 @@ class LevelHashing : public Hash<T> {
   }
 
   int Insert(T, Value_t);
-  int Insert(T key, Value_t value, bool is_in_epoch) {
+  int Insert(T key, Value_t value, Session &session) {
+    session.Tick();
     return Insert(key, value);
   }
   bool Delete(T);
-  bool Delete(T key, bool is_in_epoch) { return Delete(key); }
+  bool Delete(T key, Session &session) {
+    session.Tick();
+    return Delete(key);
+  }
   Value_t Get(T);
-  Value_t Get(T key, bool flag) { return Get(key); }
+  Value_t Get(T key, Session &session) {
+    session.Tick();
+    return Get(key);
+  }
   void Recovery() {
     if (resizing) {
       if (!OID_IS_NULL(_old_mutex) && !OID_EQUALS(_old_mutex, _mutex)) {
@@ -336,9 +344,9 @@ UNIQUE:
       if (buckets[i][f_idx].token[j] == 0) {
         buckets[i][f_idx].slot[j].value = value;
         buckets[i][f_idx].slot[j].key = key;
-        pmemobj_persist(pop, &buckets[i][f_idx].slot[j], sizeof(Entry<T>));
+        Allocator::Persist(&buckets[i][f_idx].slot[j], sizeof(Entry<T>));
         buckets[i][f_idx].token[j] = 1;
-        pmemobj_persist(pop, &buckets[i][f_idx].token[j], sizeof(uint8_t));
+        Allocator::Persist(&buckets[i][f_idx].token[j], sizeof(uint8_t));
 #ifdef COUNTING
         level_item_num[i]++;
 #endif
@@ -362,9 +370,9 @@ UNIQUE:
       if (buckets[i][s_idx].token[j] == 0) {
         buckets[i][s_idx].slot[j].value = value;
         buckets[i][s_idx].slot[j].key = key;
-        pmemobj_persist(pop, &buckets[i][s_idx].slot[j], sizeof(Entry<T>));
+        Allocator::Persist(&buckets[i][s_idx].slot[j], sizeof(Entry<T>));
         buckets[i][s_idx].token[j] = 1;
-        pmemobj_persist(pop, &buckets[i][s_idx].token[j], sizeof(uint8_t));
+        Allocator::Persist(&buckets[i][s_idx].token[j], sizeof(uint8_t));
 #ifdef COUNTING
         level_item_num[i]++;
 #endif
@@ -403,11 +411,11 @@ UNIQUE:
         if (empty_loc != -1) {
           buckets[1][f_idx].slot[empty_loc].value = value;
           buckets[1][f_idx].slot[empty_loc].key = key;
-          pmemobj_persist(pop, &buckets[1][f_idx].slot[empty_loc],
-                          sizeof(Entry<T>));
+          Allocator::Persist(&buckets[1][f_idx].slot[empty_loc],
+                             sizeof(Entry<T>));
           buckets[1][f_idx].token[empty_loc] = 1;
-          pmemobj_persist(pop, &buckets[1][f_idx].token[empty_loc],
-                          sizeof(uint8_t));
+          Allocator::Persist(&buckets[1][f_idx].token[empty_loc],
+                             sizeof(uint8_t));
 #ifdef COUNTING
           level_item_num[1]++;
 #endif
@@ -423,11 +431,11 @@ UNIQUE:
         if (empty_loc != -1) {
           buckets[1][s_idx].slot[empty_loc].value = value;
           buckets[1][s_idx].slot[empty_loc].key = key;
-          pmemobj_persist(pop, &buckets[1][s_idx].slot[empty_loc],
-                          sizeof(Entry<T>));
+          Allocator::Persist(&buckets[1][s_idx].slot[empty_loc],
+                             sizeof(Entry<T>));
           buckets[1][s_idx].token[empty_loc] = 1;
-          pmemobj_persist(pop, &buckets[1][s_idx].token[empty_loc],
-                          sizeof(uint8_t));
+          Allocator::Persist(&buckets[1][s_idx].token[empty_loc],
+                             sizeof(uint8_t));
 #ifdef COUNTING
           level_item_num[1]++;
 #endif
@@ -446,6 +454,7 @@ UNIQUE:
 
 template <class T>
 void LevelHashing<T>::resize(PMEMobjpool *pop) {
+  pmstat::Scope resize_scope(pmstat::kSplit); /*the resize is Level's split*/
   std::cout << "Resizing towards levels " << levels + 1 << std::endl;
   resizing = true;
   for (int i = 0; i < nlocks; ++i) {
@@ -454,7 +463,7 @@ void LevelHashing<T>::resize(PMEMobjpool *pop) {
 
   size_t new_addr_capacity = pow(2, levels + 1);
   _old_mutex = _mutex;
-  pmemobj_persist(pop, &_old_mutex, sizeof(_old_mutex));
+  Allocator::Persist(&_old_mutex, sizeof(_old_mutex));
   nlocks = (3 * 2 * addr_capacity / 2) / locksize + 1;
   auto ret = pmemobj_zalloc(pop, &_mutex, nlocks * sizeof(PMEMrwlock),
                             TOID_TYPE_NUM(char));
@@ -495,13 +504,13 @@ void LevelHashing<T>::resize(PMEMobjpool *pop) {
             interim_level_buckets[f_idx].slot[j].value = value;
             interim_level_buckets[f_idx].slot[j].key = key;
 #ifndef BATCH
-            pmemobj_persist(pop, &interim_level_buckets[f_idx].slot[j],
-                            sizeof(Entry<T>));
+            Allocator::Persist(&interim_level_buckets[f_idx].slot[j],
+                               sizeof(Entry<T>));
 #endif
             interim_level_buckets[f_idx].token[j] = 1;
 #ifndef BATCH
-            pmemobj_persist(pop, &interim_level_buckets[f_idx].token[j],
-                            sizeof(uint8_t));
+            Allocator::Persist(&interim_level_buckets[f_idx].token[j],
+                               sizeof(uint8_t));
 #endif
             insertSuccess = 1;
 #ifdef COUNTING
@@ -512,13 +521,13 @@ void LevelHashing<T>::resize(PMEMobjpool *pop) {
             interim_level_buckets[s_idx].slot[j].value = value;
             interim_level_buckets[s_idx].slot[j].key = key;
 #ifndef BATCH
-            pmemobj_persist(pop, &interim_level_buckets[s_idx].slot[j],
-                            sizeof(Entry<T>));
+            Allocator::Persist(&interim_level_buckets[s_idx].slot[j],
+                               sizeof(Entry<T>));
 #endif
             interim_level_buckets[s_idx].token[j] = 1;
 #ifndef BATCH
-            pmemobj_persist(pop, &interim_level_buckets[s_idx].token[j],
-                            sizeof(uint8_t));
+            Allocator::Persist(&interim_level_buckets[s_idx].token[j],
+                               sizeof(uint8_t));
 #endif
             insertSuccess = 1;
 #ifdef COUNTING
@@ -530,16 +539,16 @@ void LevelHashing<T>::resize(PMEMobjpool *pop) {
 
 #ifndef BATCH
         buckets[1][old_idx].token[i] = 0;
-        pmemobj_persist(pop, &buckets[1][old_idx].token[i], sizeof(uint8_t));
+        Allocator::Persist(&buckets[1][old_idx].token[i], sizeof(uint8_t));
 #endif
       }
     }
   }
 
 #ifdef BATCH
-  pmemobj_persist(pop, &buckets[1][0], sizeof(Node<T>) * pow(2, levels - 1));
-  pmemobj_persist(pop, &interim_level_buckets[0],
-                  sizeof(Node<T>) * new_addr_capacity);
+  Allocator::Persist(&buckets[1][0], sizeof(Node<T>) * pow(2, levels - 1));
+  Allocator::Persist(&interim_level_buckets[0],
+                     sizeof(Node<T>) * new_addr_capacity);
 #endif
 
   TX_BEGIN(pop) {
@@ -597,22 +606,22 @@ uint8_t LevelHashing<T>::try_movement(PMEMobjpool *pop, uint64_t idx,
         if (buckets[level_num][jdx].token[j] == 0) {
           buckets[level_num][jdx].slot[j].value = m_value;
           buckets[level_num][jdx].slot[j].key = m_key;
-          pmemobj_persist(pop, &buckets[level_num][jdx].slot[j],
-                          sizeof(Entry<T>));
+          Allocator::Persist(&buckets[level_num][jdx].slot[j],
+                             sizeof(Entry<T>));
           buckets[level_num][jdx].token[j] = 1;
-          pmemobj_persist(pop, &buckets[level_num][jdx].token[j],
-                          sizeof(uint8_t));
+          Allocator::Persist(&buckets[level_num][jdx].token[j],
+                             sizeof(uint8_t));
           buckets[level_num][idx].token[i] = 0;
-          pmemobj_persist(pop, &buckets[level_num][idx].token[i],
-                          sizeof(uint8_t));
+          Allocator::Persist(&buckets[level_num][idx].token[i],
+                             sizeof(uint8_t));
 
           buckets[level_num][idx].slot[i].value = value;
           buckets[level_num][idx].slot[i].key = key;
-          pmemobj_persist(pop, &buckets[level_num][idx].slot[i],
-                          sizeof(Entry<T>));
+          Allocator::Persist(&buckets[level_num][idx].slot[i],
+                             sizeof(Entry<T>));
           buckets[level_num][idx].token[i] = 1;
-          pmemobj_persist(pop, &buckets[level_num][idx].token[i],
-                          sizeof(uint8_t));
+          Allocator::Persist(&buckets[level_num][idx].token[i],
+                             sizeof(uint8_t));
 #ifdef COUNTING
           level_item_num[level_num]++;
 #endif
@@ -654,11 +663,11 @@ int LevelHashing<T>::b2t_movement(PMEMobjpool *pop, uint64_t idx) {
       if (buckets[0][f_idx].token[j] == 0) {
         buckets[0][f_idx].slot[j].value = value;
         buckets[0][f_idx].slot[j].key = key;
-        pmemobj_persist(pop, &buckets[0][f_idx].slot[j], sizeof(Entry<T>));
+        Allocator::Persist(&buckets[0][f_idx].slot[j], sizeof(Entry<T>));
         buckets[0][f_idx].token[j] = 1;
-        pmemobj_persist(pop, &buckets[0][f_idx].token[j], sizeof(uint8_t));
+        Allocator::Persist(&buckets[0][f_idx].token[j], sizeof(uint8_t));
         buckets[1][idx].token[i] = 0;
-        pmemobj_persist(pop, &buckets[1][idx].token[i], sizeof(uint8_t));
+        Allocator::Persist(&buckets[1][idx].token[i], sizeof(uint8_t));
 #ifdef COUNTING
         level_item_num[0]++;
         level_item_num[1]--;
@@ -675,11 +684,11 @@ int LevelHashing<T>::b2t_movement(PMEMobjpool *pop, uint64_t idx) {
       if (buckets[0][s_idx].token[j] == 0) {
         buckets[0][s_idx].slot[j].value = value;
         buckets[0][s_idx].slot[j].key = key;
-        pmemobj_persist(pop, &buckets[0][s_idx].slot[j], sizeof(Entry<T>));
+        Allocator::Persist(&buckets[0][s_idx].slot[j], sizeof(Entry<T>));
         buckets[0][s_idx].token[j] = 1;
-        pmemobj_persist(pop, &buckets[0][s_idx].token[j], sizeof(uint8_t));
+        Allocator::Persist(&buckets[0][s_idx].token[j], sizeof(uint8_t));
         buckets[1][idx].token[i] = 0;
-        pmemobj_persist(pop, &buckets[0][s_idx].token[j], sizeof(uint8_t));
+        Allocator::Persist(&buckets[0][s_idx].token[j], sizeof(uint8_t));
 #ifdef COUNTING
         level_item_num[0]++;
         level_item_num[1]--;
@@ -805,7 +814,7 @@ RETRY:
               var_compare(buckets[i][f_idx].slot[j].key->key, key->key,
                           buckets[i][f_idx].slot[j].key->length, key->length)) {
             buckets[i][f_idx].token[j] = 0;
-            pmemobj_persist(pop, &buckets[i][f_idx].token[j], sizeof(uint8_t));
+            Allocator::Persist(&buckets[i][f_idx].token[j], sizeof(uint8_t));
             pmemobj_rwlock_unlock(pop, &mutex[f_idx / locksize]);
             return true;
           }
@@ -813,7 +822,7 @@ RETRY:
           if (buckets[i][f_idx].token[j] == 1 &&
               buckets[i][f_idx].slot[j].key == key) {
             buckets[i][f_idx].token[j] = 0;
-            pmemobj_persist(pop, &buckets[i][f_idx].token[j], sizeof(uint8_t));
+            Allocator::Persist(&buckets[i][f_idx].token[j], sizeof(uint8_t));
             pmemobj_rwlock_unlock(pop, &mutex[f_idx / locksize]);
             return true;
           }
@@ -839,7 +848,7 @@ RETRY:
               var_compare(buckets[i][s_idx].slot[j].key->key, key->key,
                           buckets[i][s_idx].slot[j].key->length, key->length)) {
             buckets[i][s_idx].token[j] = 0;
-            pmemobj_persist(pop, &buckets[i][s_idx].token[j], sizeof(uint8_t));
+            Allocator::Persist(&buckets[i][s_idx].token[j], sizeof(uint8_t));
             pmemobj_rwlock_unlock(pop, &mutex[s_idx / locksize]);
             return true;
           }
@@ -847,7 +856,7 @@ RETRY:
           if (buckets[i][s_idx].token[j] == 1 &&
               buckets[i][s_idx].slot[j].key == key) {
             buckets[i][s_idx].token[j] = 0;
-            pmemobj_persist(pop, &buckets[i][s_idx].token[j], sizeof(uint8_t));
+            Allocator::Persist(&buckets[i][s_idx].token[j], sizeof(uint8_t));
             pmemobj_rwlock_unlock(pop, &mutex[s_idx / locksize]);
             return true;
           }
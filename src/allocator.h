@@ -6,13 +6,40 @@
 #include <sys/mman.h>
 
 #include "../util/utils.h"
+#include "pm_stats.h"
 #include "x86intrin.h"
+#ifdef PMEM
+#include "group_commit.h"
+#include "persist_policy.h"
+#endif
 
 static const char* layout_name = "hashtable";
 static const constexpr uint64_t pool_addr = 0x5f0000000000;
 
 typedef void (*DestroyCallback)(void* callback_context, void* object);
 
+/* The epoch protection of a thread is counted, so that a guard or a session
+ * taken while the thread is already protected does not end the protection of
+ * the outer one: only the outermost Protect()/Unprotect() reach the manager.*/
+inline thread_local uint32_t epoch_depth = 0;
+
+class ReentrantEpochGuard {
+ public:
+  explicit ReentrantEpochGuard(EpochManager* manager) : manager_(manager) {
+    if (epoch_depth++ == 0) manager_->Protect();
+  }
+
+  ~ReentrantEpochGuard() {
+    if (--epoch_depth == 0) manager_->Unprotect();
+  }
+
+  ReentrantEpochGuard(const ReentrantEpochGuard&) = delete;
+  ReentrantEpochGuard& operator=(const ReentrantEpochGuard&) = delete;
+
+ private:
+  EpochManager* manager_;
+};
+
 struct Allocator {
  public:
 #ifdef PMEM
@@ -23,6 +50,9 @@ struct Allocator {
                                         instance_->pm_pool_, 1024 * 8);
     std::cout << "pool opened at: " << std::hex << instance_->pm_pool_
               << std::dec << std::endl;
+    persist::pmdk_pool = instance_->pm_pool_;
+    std::cout << "persistence policy: " << persist::Name(persist::Current())
+              << std::endl;
   }
 
   static void Close_pool() {
@@ -91,15 +121,66 @@ struct Allocator {
   }
 
   static void Persist(void* ptr, size_t size) {
-    pmemobj_persist(instance_->pm_pool_, ptr, size);
+    if (durability::deferred_ring != nullptr) {
+      /*relaxed durability, the group commit flushes it*/
+      durability::Defer(ptr, size);
+      return;
+    }
+    pmstat::Flush(ptr, size);
+    pmstat::Fence();
+    persist::Dispatch([&](auto policy) {
+      persist::Persist<decltype(policy)>(ptr, size);
+    });
+  }
+
+  /* Write back without ordering, one Fence() then orders all the flushes
+   * since the last one. Only for persists that need no order among them.*/
+  static void Flush(void* ptr, size_t size) {
+    if (durability::deferred_ring != nullptr) {
+      durability::Defer(ptr, size);
+      return;
+    }
+    pmstat::Flush(ptr, size);
+    persist::Dispatch([&](auto policy) { decltype(policy)::Flush(ptr, size); });
+  }
+
+  static void Fence() {
+    if (durability::deferred_ring != nullptr) return;
+    pmstat::Fence();
+    persist::Dispatch([&](auto policy) { decltype(policy)::Fence(); });
+  }
+
+  /* Copy a DRAM image to PM past the caches and fence once. Under group
+   * commit the image is copied through the cache and its lines deferred.*/
+  static void StreamCopy(void* dst, const void* src, size_t size) {
+    if (durability::deferred_ring != nullptr) {
+      memcpy(dst, src, size);
+      durability::Defer(dst, size);
+      return;
+    }
+    pmstat::NTWrite(size);
+    pmstat::Fence();
+    persist::Stream_Copy(dst, src, size);
+    _mm_sfence(); /*streaming stores are weakly ordered under every policy*/
   }
 
+  /*without write-back there is no point in bypassing the cache*/
   static void NTWrite64(uint64_t* ptr, uint64_t val) {
-    _mm_stream_si64((long long*)ptr, val);
+    pmstat::NTWrite(sizeof(val));
+    if (persist::Current() == persist::kNone) {
+      *ptr = val;
+    } else {
+      _mm_stream_si64((long long*)ptr, val);
+    }
   }
 
   static void NTWrite32(uint32_t* ptr, uint32_t val) {
-    _mm_stream_si32((int*)ptr, val);
+    pmstat::NTWrite(sizeof(val));
+    if (persist::Current() == persist::kNone) {
+      *ptr = val;
+    } else {
+      _mm_stream_si32((int*)ptr, val);
+    }
   }
 
   static PMEMobjpool* GetPool() { return instance_->pm_pool_; }
@@ -158,13 +239,17 @@ struct Allocator {
                    context);
   }
 
-  static EpochGuard AquireEpochGuard() {
-    return EpochGuard{&instance_->epoch_manager_};
+  static ReentrantEpochGuard AquireEpochGuard() {
+    return ReentrantEpochGuard{&instance_->epoch_manager_};
   }
 
-  static void Protect() { instance_->epoch_manager_.Protect(); }
+  static void Protect() {
+    if (epoch_depth++ == 0) instance_->epoch_manager_.Protect();
+  }
 
-  static void Unprotect() { instance_->epoch_manager_.Unprotect(); }
+  static void Unprotect() {
+    if (--epoch_depth == 0) instance_->epoch_manager_.Unprotect();
+  }
 
   static GarbageList::Item* ReserveItem() {
     return instance_->garbage_list_.ReserveItem();
@@ -180,6 +265,45 @@ struct Allocator {
   }
 };
 
+/* A per-thread handle that keeps the thread inside the epoch across index
+ * operations. The epoch is only refreshed every refresh_interval operations
+ * (or on an explicit Refresh()), which amortizes the cost of Protect() and
+ * Unprotect() over many operations. Protection is counted per thread, so an
+ * index may take an epoch guard on a thread that holds a session; a Refresh()
+ * inside another session or guard does not let the epoch advance.*/
+class Session {
+ public:
+  static constexpr uint64_t kDefaultRefreshInterval = 1000;
+
+  explicit Session(uint64_t refresh_interval = kDefaultRefreshInterval)
+      : refresh_interval_(refresh_interval == 0 ? 1 : refresh_interval) {
+    Allocator::Protect();
+  }
+
+  ~Session() { Allocator::Unprotect(); }
+
+  Session(const Session&) = delete;
+  Session& operator=(const Session&) = delete;
+
+  /*called by the index at the start of every operation*/
+  inline void Tick() {
+    if (++op_count_ >= refresh_interval_) {
+      Refresh();
+    }
+  }
+
+  /*leave and re-enter the epoch so that the global epoch can advance*/
+  void Refresh() {
+    op_count_ = 0;
+    Allocator::Unprotect();
+    Allocator::Protect();
+  }
+
+ private:
+  uint64_t refresh_interval_;
+  uint64_t op_count_{0};
+};
+
 #ifdef PMEM
 Allocator* Allocator::instance_ = nullptr;
 #endif
@@ -0,0 +1,136 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// A DRAM mirror of the bucket metadata of the segments on PM. The first 32
+// bytes of a bucket (version lock, bitmap, fingerprints and overflow metadata)
+// are copied to DRAM by every writer right before it releases the bucket, and
+// the version is published as locked while a writer holds it. A lookup in a
+// mirrored segment reads the metadata and validates the versions in DRAM, so
+// it reads PM only for the pairs whose fingerprint matches.
+//
+// The mirror is addressed by the PM address: every 8 bytes of the pool map to
+// one byte of an anonymous DRAM mapping, so a 256-byte bucket maps to its
+// 32-byte header and the 48-byte header of a segment maps to 6 bytes, the
+// first of which flags that the segment is mirrored. The mapping is zero after
+// a restart, which leaves every segment unmirrored until it is synced again.
+
+#pragma once
+
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace mirror {
+
+constexpr size_t kHeaderSize = 32;
+constexpr uint32_t kScale = 3; /*log2 of the bytes of PM per byte of mirror*/
+
+/*same layout as the start of a bucket*/
+struct Header {
+  uint32_t version_lock;
+  uint32_t bitmap;
+  uint8_t finger_array[18];
+  uint8_t overflowBitmap;
+  uint8_t overflowIndex;
+  uint8_t overflowMember;
+  uint8_t overflowCount;
+  uint8_t unused[2];
+};
+static_assert(sizeof(Header) == kHeaderSize, "a header mirrors 32 bytes");
+
+struct Region {
+  uint64_t pm_base;
+  uint64_t pm_size;
+  char *dram_base; /*null while the mirror is disabled*/
+};
+
+inline Region &GetRegion() {
+  static Region region;
+  return region;
+}
+
+inline bool Enabled() {
+  return __atomic_load_n(&GetRegion().dram_base, __ATOMIC_RELAXED) != nullptr;
+}
+
+/*map the mirror of the pool at pm_base, pages are only backed once touched*/
+inline void Initialize(uint64_t pm_base, uint64_t pm_size) {
+  auto &region = GetRegion();
+  if (region.dram_base != nullptr) return;
+  void *ptr = mmap(nullptr, pm_size >> kScale, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (ptr == MAP_FAILED) {
+    std::cout << "failed to map the bucket mirror" << std::endl;
+    exit(1);
+  }
+  region.pm_base = pm_base;
+  region.pm_size = pm_size;
+  __atomic_store_n(&region.dram_base, reinterpret_cast<char *>(ptr),
+                   __ATOMIC_RELEASE);
+}
+
+inline char *Shadow(const void *pm_ptr) {
+  auto &region = GetRegion();
+  return region.dram_base +
+         ((reinterpret_cast<uint64_t>(pm_ptr) - region.pm_base) >> kScale);
+}
+
+inline Header *GetHeader(const void *bucket) {
+  return reinterpret_cast<Header *>(Shadow(bucket));
+}
+
+/*a writer took the bucket; its later stores to PM must not pass this one*/
+inline void Lock(const void *bucket, uint32_t version) {
+  if (!Enabled()) return;
+  __atomic_store_n(&GetHeader(bucket)->version_lock, version,
+                   __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*copy the metadata of a bucket but not its version, for the stash buckets
+ * that are written under the lock of another bucket*/
+inline void Copy(const void *bucket) {
+  if (!Enabled()) return;
+  memcpy(reinterpret_cast<char *>(GetHeader(bucket)) + sizeof(uint32_t),
+         reinterpret_cast<const char *>(bucket) + sizeof(uint32_t),
+         kHeaderSize - sizeof(uint32_t));
+}
+
+/*copy the metadata of a bucket the caller still holds and publish the
+ * version it has once released*/
+inline void Release(const void *bucket, uint32_t version) {
+  if (!Enabled()) return;
+  Copy(bucket);
+  __atomic_store_n(&GetHeader(bucket)->version_lock, version,
+                   __ATOMIC_RELEASE);
+}
+
+/*copy the whole header of a bucket that no writer can reach*/
+inline void Sync(const void *bucket) {
+  Copy(bucket);
+  __atomic_store_n(&GetHeader(bucket)->version_lock,
+                   *reinterpret_cast<const uint32_t *>(bucket),
+                   __ATOMIC_RELEASE);
+}
+
+inline bool Mirrored(const void *segment) {
+  return Enabled() &&
+         __atomic_load_n(Shadow(segment), __ATOMIC_ACQUIRE) != 0;
+}
+
+inline void Set_Mirrored(const void *segment) {
+  __atomic_store_n(Shadow(segment), 1, __ATOMIC_RELEASE);
+}
+
+inline void Report(uint64_t segments, uint64_t mirrored,
+                   uint64_t buckets_per_segment) {
+  std::cout << "bucket mirror: segments = " << segments
+            << ", mirrored = " << mirrored << ", memory = "
+            << mirrored * buckets_per_segment * kHeaderSize / 1024 << " KB"
+            << std::endl;
+}
+
+}  // namespace mirror
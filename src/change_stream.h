@@ -0,0 +1,375 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Change stream for followers that replicate the key set of an index. Every
+// successful insert and delete appends a record to a log owned by the writing
+// thread; the logs are rings in one shared file that a follower process maps
+// and tails without copying. A record carries a sequence number taken while
+// the writer holds the stripe lock of its key, so merging the logs by sequence
+// number replays the writes of every key in the order they took effect. The
+// rings are bounded: a writer waits once its ring is full until the follower
+// checkpoints past its oldest records. The file is written through the page
+// cache, it survives a crash of the writing process but not of the machine.
+
+#pragma once
+
+#include <fcntl.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "../util/hash.h"
+#include "../util/pair.h"
+
+namespace cdc {
+
+constexpr uint64_t kMagic = 0x43444353484144ull; /*"DASHCDC"*/
+constexpr uint32_t kMaxLogs = 64;           /*writer threads of one stream*/
+constexpr uint64_t kDefaultLogBytes = 16ull << 20;
+constexpr uint32_t kStripes = 4096;
+constexpr uint64_t kIdle = ~0ull; /*no append in progress*/
+
+enum Op : uint32_t { kInsert = 1, kDelete = 2, kWrap = 3 /*go back to 0*/ };
+
+struct Record {
+  uint64_t seq;
+  uint32_t op;
+  uint32_t key_length;
+  Value_t value; /*undefined for a delete*/
+  char key[0];   /*the bytes of the key, a fixed-length key is 8 of them*/
+
+  uint64_t Fixed_Key() const {
+    uint64_t k;
+    memcpy(&k, key, sizeof(k));
+    return k;
+  }
+};
+
+inline uint64_t Record_Size(uint32_t key_length) {
+  return sizeof(Record) + ((key_length + 7) & ~7ull);
+}
+
+struct alignas(64) LogHeader {
+  std::atomic<uint64_t> head;    /*bytes appended, by the owner*/
+  std::atomic<uint64_t> pending; /*at most the seq being appended, or kIdle*/
+  uint64_t stalls;               /*appends that waited for the follower*/
+  std::atomic<uint32_t> owned;   /*by a live writer thread*/
+  alignas(64) std::atomic<uint64_t> tail; /*bytes checkpointed by the follower*/
+};
+
+struct StreamHeader {
+  uint64_t magic;
+  uint64_t log_bytes;
+  uint32_t num_logs;
+  alignas(64) std::atomic<uint64_t> next_seq;
+  alignas(64) std::atomic<uint32_t> used; /*logs [0, used) were ever owned*/
+  LogHeader logs[kMaxLogs];
+};
+
+/*the bytes of a key as they are logged*/
+template <class T>
+inline void Key_Bytes(const T &key, const void **bytes, uint32_t *length) {
+  if constexpr (std::is_pointer<T>::value) {
+    *bytes = key->key;
+    *length = key->length;
+  } else {
+    *bytes = &key;
+    *length = sizeof(key);
+  }
+}
+
+/*map path with room for the header and num_logs rings of log_bytes*/
+inline StreamHeader *Map(const char *path, uint64_t log_bytes,
+                         uint32_t num_logs, bool create) {
+  int fd = create ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)
+                  : open(path, O_RDWR);
+  if (fd < 0) return nullptr;
+  if (!create) {
+    StreamHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != kMagic) {
+      close(fd);
+      return nullptr;
+    }
+    log_bytes = header.log_bytes;
+    num_logs = header.num_logs;
+  }
+  uint64_t size = sizeof(StreamHeader) + log_bytes * num_logs;
+  if (create && ftruncate(fd, size) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_NORESERVE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) return nullptr;
+  return reinterpret_cast<StreamHeader *>(ptr);
+}
+
+inline char *Log_Data(StreamHeader *header, uint32_t log) {
+  return reinterpret_cast<char *>(header) + sizeof(StreamHeader) +
+         header->log_bytes * log;
+}
+
+struct alignas(64) Stripe {
+  std::atomic<uint32_t> lock{0};
+};
+
+class ChangeStream {
+ public:
+  /*returns nullptr if path cannot be created*/
+  static ChangeStream *Create(const char *path,
+                              uint64_t log_bytes = kDefaultLogBytes,
+                              uint32_t num_logs = kMaxLogs) {
+    if (num_logs > kMaxLogs) num_logs = kMaxLogs;
+    log_bytes &= ~7ull;
+    auto header = Map(path, log_bytes, num_logs, true);
+    if (header == nullptr) return nullptr;
+    header->log_bytes = log_bytes;
+    header->num_logs = num_logs;
+    header->next_seq.store(1);
+    header->used.store(0);
+    for (uint32_t i = 0; i < kMaxLogs; ++i) {
+      header->logs[i].head.store(0);
+      header->logs[i].pending.store(kIdle);
+      header->logs[i].stalls = 0;
+      header->logs[i].owned.store(0);
+      header->logs[i].tail.store(0);
+    }
+    /*a follower may open the file once the magic is there*/
+    __atomic_store_n(&header->magic, kMagic, __ATOMIC_RELEASE);
+    return new ChangeStream(header);
+  }
+
+  /*the stripe of a key, held from its write until its record is appended*/
+  void Lock(const void *key, uint32_t length) {
+    auto &stripe = stripes_[h(key, length) & (kStripes - 1)];
+    uint32_t unlocked = 0;
+    while (!stripe.lock.compare_exchange_weak(unlocked, 1,
+                                              std::memory_order_acquire)) {
+      unlocked = 0;
+      _mm_pause();
+    }
+  }
+
+  void Unlock(const void *key, uint32_t length) {
+    stripes_[h(key, length) & (kStripes - 1)].lock.store(
+        0, std::memory_order_release);
+  }
+
+  void Append(Op op, const void *key, uint32_t length, Value_t value) {
+    uint32_t log_id = Local();
+    auto &log = header_->logs[log_id];
+    char *data = Log_Data(header_, log_id);
+    uint64_t log_bytes = header_->log_bytes;
+    uint64_t size = Record_Size(length);
+
+    uint64_t head = log.head.load(std::memory_order_relaxed);
+    uint64_t offset = head % log_bytes;
+    uint64_t skip = (log_bytes - offset < size) ? log_bytes - offset : 0;
+    /*before the seq is taken, the follower cannot pass a pending seq*/
+    Wait_For_Space(&log, head + skip + size - log_bytes);
+    /*a lower bound of the seq before taking it, see Reader::Poll*/
+    log.pending.store(header_->next_seq.load());
+    uint64_t seq = header_->next_seq.fetch_add(1);
+    if (skip >= sizeof(Record)) {
+      reinterpret_cast<Record *>(data + offset)->op = kWrap;
+    }
+    if (skip) offset = 0;
+    auto record = reinterpret_cast<Record *>(data + offset);
+    record->seq = seq;
+    record->op = op;
+    record->key_length = length;
+    record->value = value;
+    memcpy(record->key, key, length);
+    log.head.store(head + skip + size, std::memory_order_release);
+    log.pending.store(kIdle);
+  }
+
+  /* the seq the next record gets; every record below it describes an
+   * operation that completed before this call*/
+  uint64_t Next_Seq() { return header_->next_seq.load(); }
+
+  void Report() {
+    uint32_t logs = header_->used.load();
+    uint64_t bytes = 0, stalls = 0;
+    for (uint32_t i = 0; i < logs; ++i) {
+      bytes += header_->logs[i].head.load();
+      stalls += __atomic_load_n(&header_->logs[i].stalls, __ATOMIC_RELAXED);
+    }
+    std::cout << "change stream: records = " << header_->next_seq.load() - 1
+              << ", logs = " << logs << ", bytes = " << bytes
+              << ", stalls = " << stalls << std::endl;
+  }
+
+ private:
+  explicit ChangeStream(StreamHeader *header) : header_(header) {}
+
+  /*the logs a thread owns, handed back when it exits*/
+  struct Owned {
+    std::vector<std::pair<ChangeStream *, uint32_t>> logs;
+    ~Owned() {
+      for (auto &log : logs) {
+        log.first->header_->logs[log.second].owned.store(
+            0, std::memory_order_release);
+      }
+    }
+  };
+
+  /*the log of the calling thread, taken on its first append*/
+  uint32_t Local() {
+    thread_local Owned owned;
+    for (auto &log : owned.logs) {
+      if (log.first == this) return log.second;
+    }
+    for (uint32_t id = 0; id < header_->num_logs; ++id) {
+      uint32_t free = 0;
+      if (header_->logs[id].owned.compare_exchange_strong(
+              free, 1, std::memory_order_acquire)) {
+        uint32_t used = header_->used.load();
+        while (used <= id && !header_->used.compare_exchange_weak(used, id + 1))
+          ;
+        owned.logs.emplace_back(this, id);
+        return id;
+      }
+    }
+    std::cout << "change stream: more than " << header_->num_logs
+              << " writer threads" << std::endl;
+    exit(1);
+  }
+
+  /*until the follower has checkpointed up to min_tail*/
+  void Wait_For_Space(LogHeader *log, uint64_t min_tail) {
+    if ((int64_t)min_tail <= 0) return;
+    if (log->tail.load(std::memory_order_acquire) >= min_tail) return;
+    log->stalls++;
+    while (log->tail.load(std::memory_order_acquire) < min_tail) {
+      std::this_thread::yield(); /*the follower may need this core*/
+    }
+  }
+
+  StreamHeader *header_;
+  Stripe stripes_[kStripes];
+};
+
+/* Holds the stripe of key while the write to it runs and logs it if it took
+ * effect; does nothing without a stream*/
+template <class T>
+class Ordered {
+ public:
+  Ordered(ChangeStream *stream, const T &key) : stream_(stream) {
+    if (stream_ == nullptr) return;
+    Key_Bytes(key, &key_, &length_);
+    stream_->Lock(key_, length_);
+  }
+  ~Ordered() {
+    if (stream_ != nullptr) stream_->Unlock(key_, length_);
+  }
+
+  void Append(Op op, Value_t value) {
+    if (stream_ != nullptr) stream_->Append(op, key_, length_, value);
+  }
+
+ private:
+  ChangeStream *stream_;
+  const void *key_;
+  uint32_t length_;
+};
+
+/* The follower side, one per stream. Poll hands out records in sequence
+ * order as pointers into the mapping; they stay valid until the next
+ * Checkpoint, which lets the writers reuse their space.*/
+class Reader {
+ public:
+  /*returns nullptr if path is not a change stream*/
+  static Reader *Open(const char *path) {
+    auto header = Map(path, 0, 0, false);
+    if (header == nullptr) return nullptr;
+    return new Reader(header);
+  }
+
+  template <class F>
+  uint64_t Poll(F apply, uint64_t max_records = ~0ull) {
+    /* Every seq below limit is in the heads read after it: the seq was taken
+     * before next_seq was read, so its log was already in use, and the log
+     * showed neither it nor a lower bound of it as pending, so it had been
+     * published.*/
+    uint64_t limit = header_->next_seq.load();
+    uint32_t writers = header_->used.load();
+    for (uint32_t i = 0; i < writers; ++i) {
+      uint64_t pending = header_->logs[i].pending.load();
+      if (pending < limit) limit = pending;
+    }
+    uint64_t heads[kMaxLogs];
+    for (uint32_t i = 0; i < writers; ++i) {
+      heads[i] = header_->logs[i].head.load(std::memory_order_acquire);
+    }
+
+    uint64_t count = 0;
+    while (count < max_records) {
+      const Record *next = nullptr;
+      uint32_t next_log = 0;
+      for (uint32_t i = 0; i < writers; ++i) {
+        auto record = Peek(i, heads[i]);
+        if (record != nullptr && record->seq < limit &&
+            (next == nullptr || record->seq < next->seq)) {
+          next = record;
+          next_log = i;
+        }
+      }
+      if (next == nullptr) break;
+      apply(*next);
+      cursor_[next_log] += Record_Size(next->key_length);
+      applied_seq_ = next->seq;
+      count++;
+    }
+    return count;
+  }
+
+  /*the records handed out so far may be overwritten from now on*/
+  void Checkpoint() {
+    for (uint32_t i = 0; i < kMaxLogs; ++i) {
+      header_->logs[i].tail.store(cursor_[i], std::memory_order_release);
+    }
+  }
+
+  /*the seq of the last record handed out*/
+  uint64_t Applied_Seq() { return applied_seq_; }
+
+ private:
+  explicit Reader(StreamHeader *header) : header_(header), applied_seq_(0) {
+    for (uint32_t i = 0; i < kMaxLogs; ++i) {
+      cursor_[i] = header_->logs[i].tail.load();
+    }
+  }
+
+  /*the record at the cursor of a log, skipping the end of the ring*/
+  const Record *Peek(uint32_t log, uint64_t head) {
+    uint64_t log_bytes = header_->log_bytes;
+    while (cursor_[log] < head) {
+      uint64_t offset = cursor_[log] % log_bytes;
+      auto record =
+          reinterpret_cast<const Record *>(Log_Data(header_, log) + offset);
+      if (log_bytes - offset < sizeof(Record) || record->op == kWrap) {
+        cursor_[log] += log_bytes - offset;
+        continue;
+      }
+      return record;
+    }
+    return nullptr;
+  }
+
+  StreamHeader *header_;
+  uint64_t cursor_[kMaxLogs];
+  uint64_t applied_seq_;
+};
+
+}  // namespace cdc
@@ -0,0 +1,455 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Checkpoint files of a live index. The walkers of an index copy the pairs of
+// one segment at a time and keep the copy only if no bucket of the segment
+// changed meanwhile; a Sink collects the pairs of one walker into blocks and
+// writes each block with one large write at the end of the file. A block
+// stores its keys, values and optionally their hashes as separate columns:
+//   BlockHeader
+//   keys      uint64_t[count], or uint32_t lengths[count] and the key bytes
+//   values    uint64_t[count]
+//   hashes    uint64_t[count], if kHashes
+// every column padded to 8 bytes and every block to kAlign. A pair that moves
+// while the walk runs may be written twice, so loading skips duplicates.
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "../util/hash.h"
+#include "../util/pair.h"
+#include "../util/utils.h"
+#include "Hash.h"
+#include "allocator.h"
+
+namespace checkpoint {
+
+constexpr uint64_t kMagic = 0x54504b4348534144ull; /*"DASHCKPT"*/
+constexpr uint64_t kBlockMagic = 0x4b434f4c42ull;  /*"BLOCK"*/
+constexpr uint32_t kFormatVersion = 1;
+constexpr uint64_t kAlign = 4096;
+constexpr uint32_t kBlockPairs = 1 << 16;
+constexpr uint32_t kFixedKeys = 1; /*otherwise the keys are string_key*/
+constexpr uint32_t kHashes = 2;
+constexpr int kOptimisticTries = 3; /*then the walker locks the segment*/
+
+struct FileHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint64_t pairs;
+  uint64_t blocks;
+  uint64_t bytes;      /*end of the last block*/
+  uint64_t start_seq;  /*change stream seq when the walk started, 0 if none*/
+  char index[16];
+};
+static_assert(sizeof(FileHeader) <= kAlign, "the header fits its block");
+
+struct BlockHeader {
+  uint64_t magic;
+  uint32_t count;
+  uint32_t flags;
+  uint64_t key_bytes; /*of variable-length keys*/
+  uint64_t size;      /*with the header and the padding*/
+};
+
+inline uint64_t Pad(uint64_t size, uint64_t align = 8) {
+  return (size + align - 1) & ~(align - 1);
+}
+
+/*caps the write bandwidth of all the sinks of a checkpoint*/
+class Throttle {
+ public:
+  explicit Throttle(uint64_t mb_per_sec) : mb_per_sec_(mb_per_sec) {
+    next_ns_.store(Now());
+  }
+
+  void Consume(uint64_t bytes) {
+    if (mb_per_sec_ == 0) return;
+    uint64_t cost = bytes * 1000000000ull / (mb_per_sec_ << 20);
+    uint64_t now = Now();
+    uint64_t slot = next_ns_.load();
+    uint64_t start;
+    do {
+      start = std::max(slot, now);
+    } while (!next_ns_.compare_exchange_weak(slot, start + cost));
+    if (start > now) {
+      std::this_thread::sleep_for(std::chrono::nanoseconds(start - now));
+    }
+  }
+
+ private:
+  static uint64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  uint64_t mb_per_sec_;
+  std::atomic<uint64_t> next_ns_;
+};
+
+class Exporter {
+ public:
+  Exporter(const char *path, const char *index, bool fixed_keys,
+           bool with_hashes, uint64_t mb_per_sec, uint64_t start_seq)
+      : throttle_(mb_per_sec), start_(std::chrono::steady_clock::now()) {
+    fd_ = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    memset(&header_, 0, sizeof(header_));
+    header_.magic = kMagic;
+    header_.version = kFormatVersion;
+    header_.flags = (fixed_keys ? kFixedKeys : 0) | (with_hashes ? kHashes : 0);
+    header_.start_seq = start_seq;
+    strncpy(header_.index, index, sizeof(header_.index) - 1);
+    end_.store(kAlign);
+    pairs_.store(0);
+    blocks_.store(0);
+  }
+
+  bool Ok() { return fd_ >= 0 && !failed_.load(); }
+  /*a segment was copied, under its bucket locks if locked*/
+  void Count_Segment(bool locked) {
+    segments_.fetch_add(1);
+    if (locked) locked_.fetch_add(1);
+  }
+  bool With_Hashes() { return header_.flags & kHashes; }
+
+  /*append one encoded block, nothing once a write failed*/
+  void Write(const char *block, uint64_t size, uint32_t count) {
+    if (!Ok()) return;
+    throttle_.Consume(size);
+    uint64_t offset = end_.fetch_add(size);
+    uint64_t done = 0;
+    while (done < size) {
+      auto ret = pwrite(fd_, block + done, size - done, offset + done);
+      if (ret <= 0) {
+        failed_.store(true);
+        return;
+      }
+      done += ret;
+    }
+    pairs_.fetch_add(count);
+    blocks_.fetch_add(1);
+  }
+
+  /* write the header once every sink is flushed; returns the pairs written,
+   * or 0 if the file could not be written completely*/
+  uint64_t Finish() {
+    header_.pairs = pairs_.load();
+    header_.blocks = blocks_.load();
+    header_.bytes = end_.load();
+    if (fd_ >= 0) {
+      if (pwrite(fd_, &header_, sizeof(header_), 0) != sizeof(header_) ||
+          fsync(fd_) != 0) {
+        failed_.store(true);
+      }
+      close(fd_);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count();
+    std::cout << header_.index << " checkpoint: pairs = " << header_.pairs
+              << ", segments = " << segments_.load()
+              << " (locked = " << locked_.load() << ")"
+              << ", blocks = " << header_.blocks
+              << ", bytes = " << header_.bytes
+              << ", time = " << elapsed / 1000.0 << " ms, bandwidth = "
+              << (elapsed ? header_.bytes / (double)elapsed : 0) << " MB/s"
+              << (Ok() ? "" : ", FAILED") << std::endl;
+    return Ok() ? header_.pairs : 0;
+  }
+
+ private:
+  int fd_;
+  FileHeader header_;
+  Throttle throttle_;
+  std::atomic<uint64_t> end_;
+  std::atomic<uint64_t> pairs_;
+  std::atomic<uint64_t> blocks_;
+  std::atomic<uint64_t> segments_{0};
+  std::atomic<uint64_t> locked_{0};
+  std::atomic<bool> failed_{false};
+  std::chrono::steady_clock::time_point start_;
+};
+
+/* The pairs of one walker. A walker stages the pairs of a segment, then
+ * commits them once it validated that the segment did not change, or drops
+ * them to retry. Committing copies the key bytes, so the walker must still be
+ * in its epoch when it commits the pairs it staged.*/
+template <class T>
+class Sink {
+ public:
+  explicit Sink(Exporter *exporter)
+      : exporter_(exporter), hashes_on_(exporter->With_Hashes()) {}
+  ~Sink() { Flush(); }
+
+  void Stage(T key, Value_t value) { staged_.emplace_back(key, value); }
+
+  void Drop() { staged_.clear(); }
+
+  void Commit() {
+    for (auto &pair : staged_) {
+      if constexpr (std::is_pointer<T>::value) {
+        lengths_.push_back(pair.first->length);
+        key_bytes_.insert(key_bytes_.end(), pair.first->key,
+                          pair.first->key + pair.first->length);
+        if (hashes_on_) {
+          hashes_.push_back(h(pair.first->key, pair.first->length));
+        }
+      } else {
+        keys_.push_back(pair.first);
+        if (hashes_on_) hashes_.push_back(h(&pair.first, sizeof(T)));
+      }
+      values_.push_back(pair.second);
+    }
+    staged_.clear();
+    if (values_.size() >= kBlockPairs) Flush();
+  }
+
+  void Flush() {
+    if (values_.empty()) return;
+    Encode();
+    exporter_->Write(block_.data(), block_.size(), values_.size());
+    keys_.clear();
+    lengths_.clear();
+    key_bytes_.clear();
+    values_.clear();
+    hashes_.clear();
+  }
+
+ private:
+  template <class C>
+  static char *Append_Column(char *out, const std::vector<C> &column) {
+    memcpy(out, column.data(), column.size() * sizeof(C));
+    return out + Pad(column.size() * sizeof(C));
+  }
+
+  void Encode() {
+    uint32_t count = values_.size();
+    uint64_t size = sizeof(BlockHeader) + Pad(keys_.size() * sizeof(T)) +
+                    Pad(lengths_.size() * sizeof(uint32_t)) +
+                    Pad(key_bytes_.size()) + Pad(count * sizeof(Value_t)) +
+                    Pad(hashes_.size() * sizeof(uint64_t));
+    size = Pad(size, kAlign);
+    block_.assign(size, 0);
+
+    auto header = reinterpret_cast<BlockHeader *>(block_.data());
+    header->magic = kBlockMagic;
+    header->count = count;
+    header->flags = hashes_on_ ? kHashes : 0;
+    header->key_bytes = key_bytes_.size();
+    header->size = size;
+    char *out = block_.data() + sizeof(BlockHeader);
+    if constexpr (std::is_pointer<T>::value) {
+      out = Append_Column(out, lengths_);
+      out = Append_Column(out, key_bytes_);
+    } else {
+      out = Append_Column(out, keys_);
+    }
+    out = Append_Column(out, values_);
+    Append_Column(out, hashes_);
+  }
+
+  Exporter *exporter_;
+  bool hashes_on_;
+  std::vector<std::pair<T, Value_t>> staged_;
+  std::vector<T> keys_; /*fixed-length keys*/
+  std::vector<uint32_t> lengths_;
+  std::vector<char> key_bytes_;
+  std::vector<Value_t> values_;
+  std::vector<uint64_t> hashes_;
+  std::vector<char> block_;
+};
+
+/*one block of a checkpoint file as it is read back*/
+struct Block {
+  const BlockHeader *header;
+  const uint64_t *fixed_keys; /*null for variable-length keys*/
+  const uint32_t *lengths;
+  const char *key_bytes;
+  const Value_t *values;
+  const uint64_t *hashes; /*null without kHashes*/
+
+  Block(const char *data, bool fixed) {
+    header = reinterpret_cast<const BlockHeader *>(data);
+    uint32_t count = header->count;
+    const char *in = data + sizeof(BlockHeader);
+    fixed_keys = nullptr;
+    lengths = nullptr;
+    key_bytes = nullptr;
+    if (fixed) {
+      fixed_keys = reinterpret_cast<const uint64_t *>(in);
+      in += Pad(count * sizeof(uint64_t));
+    } else {
+      lengths = reinterpret_cast<const uint32_t *>(in);
+      in += Pad(count * sizeof(uint32_t));
+      key_bytes = in;
+      in += Pad(header->key_bytes);
+    }
+    values = reinterpret_cast<const Value_t *>(in);
+    in += Pad(count * sizeof(Value_t));
+    hashes = (header->flags & kHashes) ? reinterpret_cast<const uint64_t *>(in)
+                                       : nullptr;
+  }
+};
+
+/*a persistent string_key holding the length bytes at bytes*/
+inline string_key *Copy_Key(const char *bytes, uint32_t length) {
+  uint64_t size = sizeof(string_key) + length;
+  string_key *key;
+#ifdef PMEM
+  PMEMoid oid;
+  Allocator::ZAllocate(&oid, kCacheLineSize, size);
+  key = reinterpret_cast<string_key *>(pmemobj_direct(oid));
+#else
+  Allocator::ZAllocate(reinterpret_cast<void **>(&key), kCacheLineSize, size);
+#endif
+  key->length = length;
+  memcpy(key->key, bytes, length);
+  Allocator::Persist(key, size);
+  return key;
+}
+
+/*free a key from Copy_Key that the index never saw*/
+inline void Free_Key(string_key *key) {
+#ifdef PMEM
+  PMEMoid oid = pmemobj_oid(key);
+  pmemobj_free(&oid);
+#else
+  free(key);
+#endif
+}
+
+/* Insert the pairs of the checkpoint at path into index on num_threads
+ * threads and return the number of pairs inserted. A thread inserts one block
+ * at a time inside a session of its own, in hash order if the file has the
+ * hashes so that consecutive inserts land in the same segment. A
+ * variable-length key is copied to its own persistent allocation, which the
+ * index owns once it is inserted and which is freed again if the key was a
+ * duplicate; an index that copies its keys gets it in a DRAM buffer instead.*/
+template <class T>
+uint64_t Load(const char *path, Hash<T> *index, uint32_t num_threads) {
+  constexpr bool fixed = !std::is_pointer<T>::value;
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || (uint64_t)st.st_size < kAlign) {
+    std::cout << "failed to open the checkpoint " << path << std::endl;
+    if (fd >= 0) close(fd);
+    return 0;
+  }
+  auto file = reinterpret_cast<const char *>(
+      mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0));
+  close(fd);
+  if (file == MAP_FAILED) {
+    std::cout << "failed to map the checkpoint " << path << std::endl;
+    return 0;
+  }
+  auto header = reinterpret_cast<const FileHeader *>(file);
+  if (header->magic != kMagic || header->version != kFormatVersion ||
+      ((header->flags & kFixedKeys) != 0) != fixed ||
+      header->bytes > (uint64_t)st.st_size) {
+    std::cout << "not a checkpoint of this key type: " << path << std::endl;
+    munmap(const_cast<char *>(file), st.st_size);
+    return 0;
+  }
+
+  std::vector<uint64_t> offsets;
+  for (uint64_t offset = kAlign; offset < header->bytes;) {
+    auto block = reinterpret_cast<const BlockHeader *>(file + offset);
+    if (block->magic != kBlockMagic || block->size == 0) break;
+    offsets.push_back(offset);
+    offset += block->size;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::atomic<uint64_t> next_block(0);
+  std::atomic<uint64_t> inserted(0);
+  std::atomic<uint64_t> duplicates(0);
+  bool copies_keys = index->CopiesKeys();
+  auto loader = [&]() {
+    Session session;
+    std::vector<uint32_t> order;
+    std::vector<uint64_t> key_offsets; /*of the key bytes in the block*/
+    std::vector<uint64_t> key_buffer;  /*the key, if the index copies it*/
+    uint64_t local_inserted = 0;
+    uint64_t local_duplicates = 0;
+    while (true) {
+      uint64_t i = next_block.fetch_add(1);
+      if (i >= offsets.size()) break;
+      Block block(file + offsets[i], fixed);
+      uint32_t count = block.header->count;
+      order.resize(count);
+      for (uint32_t j = 0; j < count; ++j) order[j] = j;
+      if (block.hashes != nullptr) {
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+          return block.hashes[a] < block.hashes[b];
+        });
+      }
+
+      if constexpr (!fixed) {
+        key_offsets.resize(count);
+        uint64_t offset = 0;
+        for (uint32_t j = 0; j < count; ++j) {
+          key_offsets[j] = offset;
+          offset += block.lengths[j];
+        }
+      }
+
+      for (auto j : order) {
+        T key;
+        if constexpr (fixed) {
+          key = block.fixed_keys[j];
+        } else if (copies_keys) {
+          uint32_t length = block.lengths[j];
+          key_buffer.resize((sizeof(string_key) + length + 7) / 8);
+          key = reinterpret_cast<string_key *>(key_buffer.data());
+          key->length = length;
+          memcpy(key->key, block.key_bytes + key_offsets[j], length);
+        } else {
+          key = Copy_Key(block.key_bytes + key_offsets[j], block.lengths[j]);
+        }
+        if (index->Insert(key, block.values[j], session) == -1) {
+          if constexpr (!fixed) {
+            if (!copies_keys) Free_Key(key);
+          }
+          local_duplicates++;
+        } else {
+          local_inserted++;
+        }
+      }
+    }
+    inserted.fetch_add(local_inserted);
+    duplicates.fetch_add(local_duplicates);
+  };
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 1; t < num_threads; ++t) threads.emplace_back(loader);
+  loader();
+  for (auto &thread : threads) thread.join();
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  std::cout << header->index << " load: pairs = " << inserted.load()
+            << ", duplicates = " << duplicates.load()
+            << ", blocks = " << offsets.size()
+            << ", time = " << elapsed / 1000.0 << " ms" << std::endl;
+  munmap(const_cast<char *>(file), st.st_size);
+  return inserted.load();
+}
+
+}  // namespace checkpoint
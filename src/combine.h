@@ -0,0 +1,147 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Publication lists for flat combining on hot segments. A writer that finds
+// its bucket locked publishes the request in the list of the segment instead
+// of spinning. The lock holder, once done with its own operation, or else a
+// waiting publisher becomes the combiner of the list and applies all pending
+// requests, a bucket pair at a time, under one lock acquisition and with one
+// persist per touched cache line.
+
+#pragma once
+
+#include <immintrin.h>
+
+#include <cstring>
+#include <iostream>
+
+#include "../util/pair.h"
+
+namespace combine {
+
+constexpr uint32_t kPublicationLists = 1024; /*segments hash into these*/
+constexpr uint32_t kListBits = 10;
+constexpr uint32_t kSlotsPerList = 16;
+
+/*request states*/
+constexpr uint32_t kSlotFree = 0;
+constexpr uint32_t kSlotFilling = 1; /*the publisher writes the request*/
+constexpr uint32_t kSlotPending = 2;
+constexpr uint32_t kSlotClaimed = 3; /*a combiner is applying it*/
+constexpr uint32_t kSlotDone = 4;
+
+constexpr uint32_t kOpInsert = 0;
+constexpr uint32_t kOpDelete = 1;
+
+/*the combiner could not apply the request, the publisher runs it itself*/
+constexpr int kFallback = -2;
+
+template <class T>
+struct alignas(64) Request {
+  uint32_t state;
+  uint32_t op;
+  T key;
+  Value_t value;
+  uint64_t key_hash;
+  void *table; /*the segment the publisher found the key in*/
+  int result;  /*insert: 0 or -3 on duplicate; delete: 1 or 0 if not found*/
+};
+
+template <class T>
+struct alignas(64) PublicationList {
+  uint32_t combiner; /*1 while a thread combines this list*/
+  uint32_t pending;  /*published requests not yet claimed*/
+  Request<T> slots[kSlotsPerList];
+};
+
+struct CombineStats {
+  uint64_t passes;
+  uint64_t inserts;   /*requests taken by a combiner*/
+  uint64_t deletes;
+  uint64_t fallbacks; /*handed back to the publisher*/
+  uint64_t full;      /*no free slot in the list*/
+};
+
+inline uint32_t List_Index(void *table) {
+  return (reinterpret_cast<uint64_t>(table) * 0x9E3779B97F4A7C15ull) >>
+         (64 - kListBits);
+}
+
+/*returns nullptr if every slot of the list is taken*/
+template <class T>
+Request<T> *Publish(PublicationList<T> *list, uint32_t op, T key,
+                    Value_t value, uint64_t key_hash, void *table) {
+  for (uint32_t i = 0; i < kSlotsPerList; ++i) {
+    auto req = list->slots + i;
+    uint32_t free = kSlotFree;
+    if (__atomic_load_n(&req->state, __ATOMIC_RELAXED) != kSlotFree ||
+        !__atomic_compare_exchange_n(&req->state, &free, kSlotFilling, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      continue;
+    }
+    req->op = op;
+    req->key = key;
+    req->value = value;
+    req->key_hash = key_hash;
+    req->table = table;
+    __atomic_store_n(&req->state, kSlotPending, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&list->pending, 1, __ATOMIC_RELEASE);
+    return req;
+  }
+  return nullptr;
+}
+
+/*take every pending request of the list, called by the combiner only*/
+template <class T>
+uint32_t Claim(PublicationList<T> *list, Request<T> **batch) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < kSlotsPerList; ++i) {
+    auto req = list->slots + i;
+    if (__atomic_load_n(&req->state, __ATOMIC_ACQUIRE) == kSlotPending) {
+      __atomic_store_n(&req->state, kSlotClaimed, __ATOMIC_RELAXED);
+      batch[n++] = req;
+    }
+  }
+  if (n) __atomic_fetch_sub(&list->pending, n, __ATOMIC_RELAXED);
+  return n;
+}
+
+template <class T>
+inline void Complete(Request<T> *req, int result) {
+  req->result = result;
+  __atomic_store_n(&req->state, kSlotDone, __ATOMIC_RELEASE);
+}
+
+/*called by the publisher once the request is done, frees the slot*/
+template <class T>
+inline int Finish(Request<T> *req) {
+  int result = req->result;
+  __atomic_store_n(&req->state, kSlotFree, __ATOMIC_RELEASE);
+  return result;
+}
+
+template <class T>
+PublicationList<T> *NewLists() {
+  void *ptr = nullptr;
+  size_t size = sizeof(PublicationList<T>) * kPublicationLists;
+  if (posix_memalign(&ptr, 64, size) != 0) {
+    std::cout << "failed to allocate the publication lists" << std::endl;
+    exit(1);
+  }
+  memset(ptr, 0, size);
+  return reinterpret_cast<PublicationList<T> *>(ptr);
+}
+
+inline void Report(const CombineStats &stats) {
+  std::cout << "combining: passes = " << stats.passes
+            << ", inserts = " << stats.inserts
+            << ", deletes = " << stats.deletes
+            << ", avg batch = "
+            << (stats.passes
+                    ? (double)(stats.inserts + stats.deletes) / stats.passes
+                    : 0)
+            << ", fallbacks = " << stats.fallbacks
+            << ", list full = " << stats.full << std::endl;
+}
+
+}  // namespace combine
@@ -0,0 +1,133 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Exponential backoff for the spin loops on bucket locks, and per-thread
+// counters of the contention they see. The counters only move on contended
+// paths, so a run without contention pays nothing for them.
+
+#pragma once
+
+#include <immintrin.h>
+
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace contention {
+
+constexpr uint32_t kMinPause = 4;    /*_mm_pause per backoff step at start*/
+constexpr uint32_t kMaxPause = 1024; /*the cap of the exponential growth*/
+
+struct ContentionStats {
+  uint64_t lock_spins;       /*waits on a held bucket lock*/
+  uint64_t reader_retries;   /*optimistic reads that started over*/
+  uint64_t trylock_failures; /*writers that backed off a held neighbor*/
+
+  void Add(const ContentionStats &other) {
+    lock_spins += other.lock_spins;
+    reader_retries += other.reader_retries;
+    trylock_failures += other.trylock_failures;
+  }
+};
+
+/*counters of live threads, plus the sum of the exited ones*/
+struct Registry {
+  std::mutex mutex;
+  std::vector<ContentionStats *> threads;
+  ContentionStats retired;
+};
+
+inline Registry &GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+struct alignas(64) ThreadSlot {
+  ContentionStats stats;
+
+  ThreadSlot() {
+    memset(&stats, 0, sizeof(stats));
+    auto &registry = GetRegistry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.threads.push_back(&stats);
+  }
+
+  ~ThreadSlot() {
+    auto &registry = GetRegistry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.retired.Add(stats);
+    for (auto it = registry.threads.begin(); it != registry.threads.end();
+         ++it) {
+      if (*it == &stats) {
+        registry.threads.erase(it);
+        break;
+      }
+    }
+  }
+};
+
+inline ContentionStats &Local() {
+  static thread_local ThreadSlot slot;
+  return slot.stats;
+}
+
+/*the counters of live threads are read without synchronization*/
+inline ContentionStats Snapshot() {
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> guard(registry.mutex);
+  ContentionStats total = registry.retired;
+  for (auto stats : registry.threads) {
+    total.Add(*stats);
+  }
+  return total;
+}
+
+/*only meaningful while no index operation is running*/
+inline void Reset() {
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> guard(registry.mutex);
+  memset(&registry.retired, 0, sizeof(registry.retired));
+  for (auto stats : registry.threads) {
+    memset(stats, 0, sizeof(*stats));
+  }
+}
+
+inline void Report() {
+  auto stats = Snapshot();
+  std::cout << "contention: lock_spins = " << stats.lock_spins
+            << ", reader_retries = " << stats.reader_retries
+            << ", trylock_failures = " << stats.trylock_failures << std::endl;
+}
+
+class Backoff {
+ public:
+  /*pause twice as long as the last time, up to kMaxPause*/
+  inline void Pause() {
+    for (uint32_t i = 0; i < pause_; ++i) {
+      _mm_pause();
+    }
+    if (pause_ < kMaxPause) pause_ <<= 1;
+  }
+
+  /*count one wait in counter and pause*/
+  inline void Spin(uint64_t ContentionStats::*counter) {
+    Local().*counter += 1;
+    Pause();
+  }
+
+  /*for the head of a retry loop: the first pass is not a retry*/
+  inline void Retry(uint64_t ContentionStats::*counter) {
+    if (first_) {
+      first_ = false;
+      return;
+    }
+    Spin(counter);
+  }
+
+ private:
+  uint32_t pause_{kMinPause};
+  bool first_{true};
+};
+
+}  // namespace contention
@@ -0,0 +1,76 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Eager recovery driver. After a crash both indexes recover a segment lazily on
+// its first access, so the first requests after a restart pay for it. The
+// driver fans worker threads out over the slots of an index (directory entries
+// or segment indexes), each slot recovered through the same routine as the
+// lazy path, while the calling thread reports the progress.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace recovery {
+
+constexpr uint64_t kChunkSlots = 256;     /*slots claimed by a worker at once*/
+constexpr uint32_t kProgressMillis = 500; /*period of the progress report*/
+constexpr uint32_t kPollMillis = 5;
+
+/* Run recover(slot) for every slot in [0, num_slots) on num_threads workers;
+ * recover returns the number of segments it recovered. Returns that total.*/
+template <class F>
+uint64_t Run(const char *name, uint64_t num_slots, uint32_t num_threads,
+             F recover) {
+  auto start = std::chrono::steady_clock::now();
+  if (num_threads == 0) num_threads = 1;
+  std::atomic<uint64_t> next_slot(0);
+  std::atomic<uint64_t> done_slots(0);
+  std::atomic<uint64_t> recovered(0);
+  std::vector<std::thread> workers;
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    workers.emplace_back([&]() {
+      while (true) {
+        uint64_t begin = next_slot.fetch_add(kChunkSlots);
+        if (begin >= num_slots) break;
+        uint64_t end = std::min(begin + kChunkSlots, num_slots);
+        uint64_t count = 0;
+        for (uint64_t i = begin; i < end; ++i) {
+          count += recover(i);
+        }
+        recovered.fetch_add(count);
+        done_slots.fetch_add(end - begin);
+      }
+    });
+  }
+
+  auto last_report = start;
+  while (done_slots.load() < num_slots) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(kPollMillis));
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_report < std::chrono::milliseconds(kProgressMillis)) {
+      continue;
+    }
+    last_report = now;
+    uint64_t done = done_slots.load();
+    std::cout << name << " eager recovery: " << done << " / " << num_slots
+              << " slots (" << (num_slots ? done * 100 / num_slots : 100)
+              << "%), segments = " << recovered.load() << std::endl;
+  }
+  for (auto &worker : workers) worker.join();
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  std::cout << name << " eager recovery: slots = " << num_slots
+            << ", segments = " << recovered.load()
+            << ", threads = " << num_threads
+            << ", time = " << elapsed / 1000.0 << " ms" << std::endl;
+  return recovered.load();
+}
+
+}  // namespace recovery
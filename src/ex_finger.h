@@ -15,6 +15,7 @@
 
 #include <bitset>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <iostream>
@@ -30,6 +31,19 @@
 #include "../util/pair.h"
 #include "Hash.h"
 #include "allocator.h"
+#include "bucket_mirror.h"
+#include "combine.h"
+#include "contention.h"
+#include "eager_recovery.h"
+#include "change_stream.h"
+#include "checkpoint.h"
+#include "frozen.h"
+#include "group_commit.h"
+#include "hot_cache.h"
+#include "key_arena.h"
+#include "segment_filter.h"
+#include "split_service.h"
+#include "warm_up.h"
 
 #ifdef PMEM
 #include <libpmemobj.h>
@@ -40,6 +54,7 @@ uint64_t merge_time;
 namespace extendible {
 //#define COUNTING 1
 //#define PREALLOC 1
+#define PARALLEL_RESIZE 1 /*threads waiting on a resize help copy the directory*/
 
 template <class T>
 struct _Pair {
@@ -80,6 +95,15 @@ inline bool var_compare(char *str1, char *str2, int len1, int len2) {
   return !memcmp(str1, str2, len1);
 }
 
+template <class T>
+inline bool key_equal(T key1, T key2) {
+  if constexpr (std::is_pointer<T>::value) {
+    return var_compare(key1->key, key2->key, key1->length, key2->length);
+  } else {
+    return key1 == key2;
+  }
+}
+
 template <typename T, bool is_pointer>
 struct KeyHash;
 
@@ -258,12 +282,18 @@ struct Bucket<T, true> {
   }
 
   Value_t check_and_get(uint8_t meta_hash, T key, bool probe) {
+    return check_and_get(finger_array, bitmap, meta_hash, key, probe);
+  }
+
+  /*fingers and bits are the metadata of this bucket or of its DRAM mirror*/
+  Value_t check_and_get(const uint8_t *fingers, uint32_t bits,
+                        uint8_t meta_hash, T key, bool probe) {
     int mask = 0;
-    SSE_CMP8(finger_array, meta_hash);
+    SSE_CMP8(fingers, meta_hash);
     if (!probe) {
-      mask = mask & GET_BITMAP(bitmap) & (~GET_MEMBER(bitmap));
+      mask = mask & GET_BITMAP(bits) & (~GET_MEMBER(bits));
     } else {
-      mask = mask & GET_BITMAP(bitmap) & GET_MEMBER(bitmap);
+      mask = mask & GET_BITMAP(bits) & GET_MEMBER(bits);
     }
 
     if (mask == 0) {
@@ -316,6 +346,7 @@ struct Bucket<T, true> {
   inline void get_lock() {
     uint32_t new_value = 0;
     uint32_t old_value = 0;
+    contention::Backoff backoff;
     do {
       while (true) {
         old_value = __atomic_load_n(&version_lock, __ATOMIC_ACQUIRE);
@@ -323,9 +354,11 @@ struct Bucket<T, true> {
           old_value &= lockMask;
           break;
         }
+        backoff.Spin(&contention::ContentionStats::lock_spins);
       }
       new_value = old_value | lockSet;
     } while (!CAS(&version_lock, &old_value, new_value));
+    mirror::Lock(this, new_value);
   }
 
   inline bool try_get_lock() {
@@ -335,11 +368,16 @@ struct Bucket<T, true> {
     }
     auto old_value = v & lockMask;
     auto new_value = v | lockSet;
-    return CAS(&version_lock, &old_value, new_value);
+    if (!CAS(&version_lock, &old_value, new_value)) {
+      return false;
+    }
+    mirror::Lock(this, new_value);
+    return true;
   }
 
   inline void release_lock() {
     uint32_t v = version_lock;
+    mirror::Release(this, v + 1 - lockSet);
     __atomic_store_n(&version_lock, v + 1 - lockSet, __ATOMIC_RELEASE);
   }
 
@@ -370,8 +408,9 @@ struct Bucket<T, true> {
     return 0;
   }
 
-  /*if delete success, then return 0, else return -1*/
-  int Delete(T key, uint8_t meta_hash, bool probe) {
+  /*if delete success, then return 0, else return -1; the stored key pointer
+   * is reported through stored_key*/
+  int Delete(T key, uint8_t meta_hash, bool probe, T *stored_key = nullptr) {
     /*do the simd and check the key, then do the delete operation*/
     int mask = 0;
     SSE_CMP8(finger_array, meta_hash);
@@ -390,6 +429,7 @@ struct Bucket<T, true> {
                          _key->key,
                          (reinterpret_cast<string_key *>(_[i].key))->length,
                          _key->length))) {
+          if (stored_key) *stored_key = _[i].key;
           unset_hash(i, false);
           return 0;
         }
@@ -399,6 +439,7 @@ struct Bucket<T, true> {
                 reinterpret_cast<string_key *>(_[i + 1].key)->key, _key->key,
                 (reinterpret_cast<string_key *>(_[i + 1].key))->length,
                 _key->length))) {
+          if (stored_key) *stored_key = _[i + 1].key;
           unset_hash(i + 1, false);
           return 0;
         }
@@ -408,6 +449,7 @@ struct Bucket<T, true> {
                 reinterpret_cast<string_key *>(_[i + 2].key)->key, _key->key,
                 (reinterpret_cast<string_key *>(_[i + 2].key))->length,
                 _key->length))) {
+          if (stored_key) *stored_key = _[i + 2].key;
           unset_hash(i + 2, false);
           return 0;
         }
@@ -417,6 +459,7 @@ struct Bucket<T, true> {
                 reinterpret_cast<string_key *>(_[i + 3].key)->key, _key->key,
                 (reinterpret_cast<string_key *>(_[i + 3].key))->length,
                 _key->length))) {
+          if (stored_key) *stored_key = _[i + 3].key;
           unset_hash(i + 3, false);
           return 0;
         }
@@ -427,6 +470,7 @@ struct Bucket<T, true> {
                        _key->key,
                        (reinterpret_cast<string_key *>(_[12].key))->length,
                        _key->length))) {
+        if (stored_key) *stored_key = _[12].key;
         unset_hash(12, false);
         return 0;
       }
@@ -436,6 +480,7 @@ struct Bucket<T, true> {
                        _key->key,
                        (reinterpret_cast<string_key *>(_[13].key))->length,
                        _key->length))) {
+        if (stored_key) *stored_key = _[13].key;
         unset_hash(13, false);
         return 0;
       }
@@ -443,6 +488,28 @@ struct Bucket<T, true> {
     return -1;
   }
 
+  /*swing the slot holding old_key (compared by address) to new_key*/
+  int Replace(T old_key, T new_key, uint8_t meta_hash, bool probe) {
+    int mask = 0;
+    SSE_CMP8(finger_array, meta_hash);
+    if (!probe) {
+      mask = mask & GET_BITMAP(bitmap) & (~GET_MEMBER(bitmap));
+    } else {
+      mask = mask & GET_BITMAP(bitmap) & GET_MEMBER(bitmap);
+    }
+
+    for (int i = 0; i < kNumPairPerBucket; ++i) {
+      if (CHECK_BIT(mask, i) && (_[i].key == old_key)) {
+        _[i].key = new_key;
+#ifdef PMEM
+        Allocator::Persist(&_[i].key, sizeof(_[i].key));
+#endif
+        return 0;
+      }
+    }
+    return -1;
+  }
+
   int Insert_with_noflush(T key, Value_t value, uint8_t meta_hash, bool probe) {
     auto slot = find_empty_slot();
     /* this branch can be removed*/
@@ -670,12 +737,18 @@ struct Bucket<T, false> {
   }
 
   Value_t check_and_get(uint8_t meta_hash, T key, bool probe) {
+    return check_and_get(finger_array, bitmap, meta_hash, key, probe);
+  }
+
+  /*fingers and bits are the metadata of this bucket or of its DRAM mirror*/
+  Value_t check_and_get(const uint8_t *fingers, uint32_t bits,
+                        uint8_t meta_hash, T key, bool probe) {
     int mask = 0;
-    SSE_CMP8(finger_array, meta_hash);
+    SSE_CMP8(fingers, meta_hash);
     if (!probe) {
-      mask = mask & GET_BITMAP(bitmap) & (~GET_MEMBER(bitmap));
+      mask = mask & GET_BITMAP(bits) & (~GET_MEMBER(bits));
     } else {
-      mask = mask & GET_BITMAP(bitmap) & GET_MEMBER(bitmap);
+      mask = mask & GET_BITMAP(bits) & GET_MEMBER(bits);
     }
 
     if (mask == 0) {
@@ -741,9 +814,23 @@ struct Bucket<T, false> {
 #endif
   }
 
+  /* Frees the slot of a deleted pair. Under group commit an insert that
+   * refills the slot may lose its pair but not its bitmap bit in a crash,
+   * which would bring the deleted key back, so the key is first overwritten
+   * durably with INVALID, which the recovery drops*/
+  inline void release_slot(int index) {
+    if (durability::ScrubDeletes()) {
+      durability::Eager eager;
+      _[index].key = static_cast<T>(INVALID);
+      Allocator::Persist(&_[index].key, sizeof(_[index].key));
+    }
+    unset_hash(index, false);
+  }
+
   inline void get_lock() {
     uint32_t new_value = 0;
     uint32_t old_value = 0;
+    contention::Backoff backoff;
     do {
       while (true) {
         old_value = __atomic_load_n(&version_lock, __ATOMIC_ACQUIRE);
@@ -751,9 +838,11 @@ struct Bucket<T, false> {
           old_value &= lockMask;
           break;
         }
+        backoff.Spin(&contention::ContentionStats::lock_spins);
       }
       new_value = old_value | lockSet;
     } while (!CAS(&version_lock, &old_value, new_value));
+    mirror::Lock(this, new_value);
   }
 
   inline bool try_get_lock() {
@@ -763,11 +852,16 @@ struct Bucket<T, false> {
     }
     auto old_value = v & lockMask;
     auto new_value = v | lockSet;
-    return CAS(&version_lock, &old_value, new_value);
+    if (!CAS(&version_lock, &old_value, new_value)) {
+      return false;
+    }
+    mirror::Lock(this, new_value);
+    return true;
   }
 
   inline void release_lock() {
     uint32_t v = version_lock;
+    mirror::Release(this, v + 1 - lockSet);
     __atomic_store_n(&version_lock, v + 1 - lockSet, __ATOMIC_RELEASE);
   }
 
@@ -798,8 +892,9 @@ struct Bucket<T, false> {
     return 0;
   }
 
-  /*if delete success, then return 0, else return -1*/
-  int Delete(T key, uint8_t meta_hash, bool probe) {
+  /*if delete success, then return 0, else return -1; a fixed-length key is
+   * not stored apart from the bucket, so none is handed back*/
+  int Delete(T key, uint8_t meta_hash, bool probe, T * = nullptr) {
     /*do the simd and check the key, then do the delete operation*/
     int mask = 0;
     SSE_CMP8(finger_array, meta_hash);
@@ -812,33 +907,33 @@ struct Bucket<T, false> {
     if (mask != 0) {
       for (int i = 0; i < 12; i += 4) {
         if (CHECK_BIT(mask, i) && (_[i].key == key)) {
-          unset_hash(i, false);
+          release_slot(i);
           return 0;
         }
 
         if (CHECK_BIT(mask, i + 1) && (_[i + 1].key == key)) {
-          unset_hash(i + 1, false);
+          release_slot(i + 1);
           return 0;
         }
 
         if (CHECK_BIT(mask, i + 2) && (_[i + 2].key == key)) {
-          unset_hash(i + 2, false);
+          release_slot(i + 2);
           return 0;
         }
 
         if (CHECK_BIT(mask, i + 3) && (_[i + 3].key == key)) {
-          unset_hash(i + 3, false);
+          release_slot(i + 3);
           return 0;
         }
       }
 
       if (CHECK_BIT(mask, 12) && (_[12].key == key)) {
-        unset_hash(12, false);
+        release_slot(12);
         return 0;
       }
 
       if (CHECK_BIT(mask, 13) && (_[13].key == key)) {
-        unset_hash(13, false);
+        release_slot(13);
         return 0;
       }
     }
@@ -928,12 +1023,27 @@ struct Directory {
   uint32_t global_depth;
   uint32_t version;
   uint32_t depth_count;
+  Directory *prev; /*the directory being migrated from by a doubling*/
   table_p _[0];
 
   Directory(size_t capacity, size_t _version) {
     version = _version;
     global_depth = static_cast<size_t>(log2(capacity));
     depth_count = 0;
+    prev = nullptr;
+  }
+
+  /* Entry x of the directory. After an incremental doubling, an entry that is
+   * neither migrated nor updated yet is null and is served by the previous
+   * directory. Once prev is cleared, every entry has been filled.*/
+  inline table_p Entry(uint64_t x) {
+    table_p entry = __atomic_load_n(&_[x], __ATOMIC_ACQUIRE);
+    if (entry == nullptr) {
+      auto old = __atomic_load_n(&prev, __ATOMIC_ACQUIRE);
+      if (old != nullptr) return old->_[x >> 1];
+      return __atomic_load_n(&_[x], __ATOMIC_ACQUIRE);
+    }
+    return entry;
   }
 
   static void New(PMEMoid *dir, size_t capacity, size_t version) {
@@ -944,7 +1054,10 @@ struct Directory {
       dir_ptr->version = std::get<1>(*value_ptr);
       dir_ptr->global_depth =
           static_cast<size_t>(log2(std::get<0>(*value_ptr)));
+      dir_ptr->depth_count = 0;
+      dir_ptr->prev = nullptr;
       size_t cap = std::get<0>(*value_ptr);
+      memset(dir_ptr->_, 0, sizeof(table_p) * cap);
       pmemobj_persist(pool, dir_ptr,
                       sizeof(Directory<T>) + sizeof(uint64_t) * cap);
       return 0;
@@ -958,8 +1071,70 @@ struct Directory {
     new (*dir) Directory(capacity, version, tables);
 #endif
   }
+
+  /*a directory that lives in DRAM only, see Finger_EH::EnableDramDirectory*/
+  static Directory *NewVolatile(size_t capacity, size_t version) {
+    void *ptr = nullptr;
+    size_t size = sizeof(Directory<T>) + sizeof(table_p) * capacity;
+    if (posix_memalign(&ptr, kCacheLineSize, size) != 0) {
+      std::cout << "failed to allocate a DRAM directory" << std::endl;
+      exit(1);
+    }
+    auto dir_ptr = new (ptr) Directory(capacity, version);
+    memset(dir_ptr->_, 0, sizeof(table_p) * capacity);
+    return dir_ptr;
+  }
+};
+
+/* DRAM directories replaced by a doubling or halving; a thread may still read
+ * one until it leaves its epoch*/
+template <class T>
+void Retire_Volatile_Directory(Directory<T> *old_dir) {
+  static std::mutex mutex;
+  static std::vector<std::pair<Directory<T> *, Epoch>> retired;
+  auto epoch_manager = &Allocator::Get()->epoch_manager_;
+  std::lock_guard<std::mutex> guard(mutex);
+  retired.emplace_back(old_dir, epoch_manager->GetCurrentEpoch());
+  epoch_manager->BumpCurrentEpoch();
+  size_t kept = 0;
+  for (auto &item : retired) {
+    if (epoch_manager->IsSafeToReclaim(item.second)) {
+      free(item.first);
+    } else {
+      retired[kept++] = item;
+    }
+  }
+  retired.resize(kept);
+}
+
+/* A directory copy split into chunks of entries, either the copy of a halving
+ * or the lazy migration of a doubling. A halving publishes its job while it
+ * holds the directory lock and threads that spin on the lock help copy with
+ * streaming stores. A doubling publishes the new directory right away and its
+ * migration job is drained by inserters and the migrator thread. Threads claim
+ * chunks through the cursor; the generation in the cursor prevents a thread
+ * that read the fields of a finished job from claiming a chunk of the next
+ * one.*/
+template <class T>
+struct DirectoryCopyJob {
+  Directory<T> *src;
+  Directory<T> *dst;
+  uint64_t num_chunks;
+  uint64_t chunk_size; /*entries of dst per chunk*/
+  bool halving;        /*otherwise migrating the entries of a doubling*/
+  uint64_t cursor; /*generation in the high 32 bits, next chunk in the low 32*/
+  uint64_t done;   /*generation in the high 32 bits, chunks copied in the low*/
 };
 
+constexpr uint64_t kDirCopyChunk = 16384; /*entries of the new directory*/
+constexpr uint64_t kMigrateChunk = 512; /*small, since inserters migrate too*/
+constexpr uint64_t kParallelCopyThreshold = 1 << 16;
+constexpr uint32_t kDeferredMerges = 64; /*merges held back by a checkpoint*/
+constexpr uint64_t kMigratorInterval = 1; /*ms between migrator rounds*/
+/*used stash slots after which a segment is handed to the split service*/
+constexpr uint32_t kSplitHighWater = kNumPairPerBucket;
+constexpr uint64_t kCursorChunkMask = (1UL << 32) - 1;
+
 /*thread local table allcoation pool*/
 template <class T>
 struct TlsTablePool {
@@ -1022,6 +1197,8 @@ struct Table {
 #ifdef PREALLOC
     thread_local TlsTablePool<T> tls_pool;
     auto ptr = tls_pool.Get();
+    ptr->split_pending = 0;
+    ptr->seg_filter = nullptr;
     ptr->local_depth = depth;
     ptr->next = pp;
     *tbl = pmemobj_oid(ptr);
@@ -1032,6 +1209,8 @@ struct Table {
       table_ptr->local_depth = value_ptr->first;
       table_ptr->next = value_ptr->second;
       table_ptr->state = -3; /*NEW*/
+      table_ptr->split_pending = 0;
+      table_ptr->seg_filter = nullptr;
       memset(&table_ptr->lock_bit, 0, sizeof(PMEMmutex) * 2);
 
       int sumBucket = kNumBucket + stashBucket;
@@ -1079,9 +1258,11 @@ struct Table {
     }
   }
 
+  /*with try_lock, -4 reports a held bucket lock instead of waiting on it*/
   int Insert(T key, Value_t value, size_t key_hash, uint8_t meta_hash,
-             Directory<T> **);
-  void Insert4split(T key, Value_t value, size_t key_hash, uint8_t meta_hash);
+             Directory<T> **, bool try_lock = false);
+  /*false if neither the buckets nor the stash had room for the pair*/
+  bool Insert4split(T key, Value_t value, size_t key_hash, uint8_t meta_hash);
   void Insert4splitWithCheck(T key, Value_t value, size_t key_hash,
                              uint8_t meta_hash); /*with uniqueness check*/
   void Insert4merge(T key, Value_t value, size_t key_hash, uint8_t meta_hash,
@@ -1147,16 +1328,54 @@ struct Table {
     return -1;
   }
 
+  /*rebuild the filter from the pairs of the segment, all writers of the
+   * segment must be excluded*/
+  void Build_Filter() {
+    filter::SegmentFilter rebuilt;
+    memset(&rebuilt, 0, sizeof(rebuilt));
+    for (int i = 0; i < kNumBucket + stashBucket; ++i) {
+      auto curr_bucket = bucket + i;
+      auto mask = GET_BITMAP(curr_bucket->bitmap);
+      for (int j = 0; j < kNumPairPerBucket; ++j) {
+        if (CHECK_BIT(mask, j)) {
+          rebuilt.Add(KeyHashProxy<T>(curr_bucket->_[j].key));
+        }
+      }
+    }
+    if (seg_filter == nullptr) {
+      auto fresh = filter::New();
+      fresh->Assign(rebuilt);
+      __atomic_store_n(&seg_filter, fresh, __ATOMIC_RELEASE);
+    } else {
+      seg_filter->Assign(rebuilt);
+    }
+  }
+
+  /*the number of pairs in the stash buckets*/
+  inline uint32_t Stash_Count() {
+    uint32_t count = 0;
+    for (int i = 0; i < stashBucket; ++i) {
+      count += GET_COUNT((bucket + kNumBucket + i)->bitmap);
+    }
+    return count;
+  }
+
+  /*a split persists and mirrors the whole new segment itself (persist off),
+   * which may still be a DRAM image*/
   int Stash_insert(Bucket<T> *target, Bucket<T> *neighbor, T key, Value_t value,
-                   uint8_t meta_hash, int stash_pos) {
+                   uint8_t meta_hash, int stash_pos, bool persist = true) {
     for (int i = 0; i < stashBucket; ++i) {
       Bucket<T> *curr_bucket =
           bucket + kNumBucket + ((stash_pos + i) & stashMask);
       if (GET_COUNT(curr_bucket->bitmap) < kNumPairPerBucket) {
         curr_bucket->Insert(key, value, meta_hash, false);
+        if (persist) {
 #ifdef PMEM
-        Allocator::Persist(&curr_bucket->bitmap, sizeof(curr_bucket->bitmap));
+          Allocator::Persist(&curr_bucket->bitmap,
+                             sizeof(curr_bucket->bitmap));
 #endif
+          mirror::Copy(curr_bucket);
+        }
         target->set_indicator(meta_hash, neighbor, (stash_pos + i) & stashMask);
 #ifdef COUNTING
         __sync_fetch_and_add(&number, 1);
@@ -1167,6 +1386,36 @@ struct Table {
     return -1;
   }
 
+  /* Drop the pairs whose key does not hash to the fingerprint and the bucket
+   * of their slot. Under relaxed durability a bitmap bit can reach PM before
+   * its pair, which leaves the old content of the slot behind it. The key of
+   * a deleted pair was scrubbed to INVALID, so it is never revived by the
+   * fingerprint matching by chance.*/
+  void Validate_Pairs() {
+    if constexpr (!std::is_pointer<T>::value) {
+      for (int i = 0; i < kNumBucket + stashBucket; ++i) {
+        Bucket<T> *curr_bucket = bucket + i;
+        auto mask = GET_BITMAP(curr_bucket->bitmap);
+        for (int j = 0; j < kNumPairPerBucket; ++j) {
+          if (!CHECK_BIT(mask, j)) continue;
+          auto key_hash = KeyHashProxy<T>(curr_bucket->_[j].key);
+          bool valid =
+              curr_bucket->_[j].key != static_cast<T>(INVALID) &&
+              ((uint8_t)(key_hash & kMask)) == curr_bucket->finger_array[j];
+          if (valid && i < kNumBucket) {
+            auto y = BUCKET_INDEX(key_hash);
+            if (CHECK_BIT(GET_MEMBER(curr_bucket->bitmap), j)) {
+              y = (y + 1) & bucketMask;
+            }
+            valid = (y == i);
+          }
+          if (!valid) curr_bucket->unset_hash(j);
+        }
+      }
+      Allocator::Persist(bucket, sizeof(Bucket<T>) * (kNumBucket + stashBucket));
+    }
+  }
+
   void recoverMetadata() {
     Bucket<T> *curr_bucket, *neighbor_bucket;
     /*reset the lock and overflow meta-data*/
@@ -1223,9 +1472,129 @@ struct Table {
 #endif
     /* No need to flush these meta-data because persistent or not does not
      * influence the correctness*/
+    if (mirror::Enabled()) Sync_Mirror();
+  }
+
+  /*copy every bucket header to the DRAM mirror and mark the segment as
+   * mirrored; a bucket may only be held by a writer if it is locked*/
+  void Sync_Mirror() {
+    for (int i = 0; i < kNumBucket + stashBucket; ++i) {
+      mirror::Sync(bucket + i);
+    }
+    mirror::Set_Mirrored(this);
+  }
+
+  /* Copy every bucket to image, the new segment of a split, and drop there
+   * the pairs that stay, i.e. those not in moved. Each pair keeps its slot,
+   * so unlike Insert4split this cannot run out of room*/
+  void Copy_Moved_Pairs(Table *image, uint32_t *moved) {
+    uint32_t locks[kNumBucket + stashBucket];
+    for (int i = 0; i < kNumBucket + stashBucket; ++i) {
+      locks[i] = image->bucket[i].version_lock;
+    }
+    memcpy(image->bucket, bucket, sizeof(bucket));
+#ifdef COUNTING
+    image->number = 0;
+#endif
+    for (int i = 0; i < kNumBucket + stashBucket; ++i) {
+      auto curr_bucket = image->bucket + i;
+      curr_bucket->version_lock = locks[i];
+      auto stay = GET_BITMAP(curr_bucket->bitmap) & ~moved[i];
+#ifdef COUNTING
+      image->number += __builtin_popcount(moved[i]);
+#endif
+      for (int j = 0; j < kNumPairPerBucket; ++j) {
+        if (!CHECK_BIT(stay, j)) continue;
+        if (i >= kNumBucket) {
+          auto key_hash = KeyHashProxy(curr_bucket->_[j].key);
+          auto bucket_ix = BUCKET_INDEX(key_hash);
+          image->bucket[bucket_ix].unset_indicator(
+              curr_bucket->finger_array[j],
+              image->bucket + ((bucket_ix + 1) & bucketMask),
+              curr_bucket->_[j].key, i - kNumBucket);
+        }
+        curr_bucket->unset_hash(j);
+      }
+    }
+  }
+
+  /* The moved stash pairs no longer overflow from the buckets of this
+   * segment. Runs after the moves, since Copy_Moved_Pairs copies the
+   * overflow metadata of these buckets to the new segment*/
+  void Unset_Moved_Stash_Indicators(uint32_t *moved) {
+    for (int i = 0; i < stashBucket; ++i) {
+      auto *curr_bucket = bucket + kNumBucket + i;
+      for (int j = 0; j < kNumPairPerBucket; ++j) {
+        if (!CHECK_BIT(moved[kNumBucket + i], j)) continue;
+        auto key_hash = KeyHashProxy(curr_bucket->_[j].key);
+        auto bucket_ix = BUCKET_INDEX(key_hash);
+        bucket[bucket_ix].unset_indicator(
+            curr_bucket->finger_array[j],
+            bucket + ((bucket_ix + 1) & bucketMask), curr_bucket->_[j].key, i);
+      }
+    }
+  }
+
+  /*the DRAM image a streaming split builds the new segment in*/
+  static Table *Split_Image() {
+    alignas(64) static thread_local char image[sizeof(Table)];
+    return reinterpret_cast<Table *>(image);
+  }
+
+  template <class S>
+  void Stage_Pairs(S *sink) {
+    for (int i = 0; i < kNumBucket + stashBucket; ++i) {
+      auto curr_bucket = bucket + i;
+      auto mask = GET_BITMAP(curr_bucket->bitmap);
+      for (int j = 0; j < kNumPairPerBucket; ++j) {
+        if (CHECK_BIT(mask, j)) {
+          sink->Stage(curr_bucket->_[j].key, curr_bucket->_[j].value);
+        }
+      }
+    }
+  }
+
+  /* Copy the pairs of the segment to sink. Every writer of the segment holds
+   * a lock of a normal bucket, so the copy is consistent if none of their
+   * versions moved; after kOptimisticTries the segment is locked like a split
+   * does. The caller is in an epoch*/
+  void Export(checkpoint::Sink<T> *sink, checkpoint::Exporter *exporter) {
+    uint32_t versions[kNumBucket];
+    for (int tries = 0; tries < checkpoint::kOptimisticTries; ++tries) {
+      bool locked = false;
+      for (int i = 0; i < kNumBucket && !locked; ++i) {
+        locked = bucket[i].test_lock_set(versions[i]);
+      }
+      if (locked) {
+        _mm_pause();
+        continue;
+      }
+      Stage_Pairs(sink);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      bool changed = false;
+      for (int i = 0; i < kNumBucket && !changed; ++i) {
+        changed = bucket[i].test_lock_version_change(versions[i]);
+      }
+      if (!changed) {
+        sink->Commit();
+        exporter->Count_Segment(false);
+        return;
+      }
+      sink->Drop();
+    }
+    while (!bucket->try_get_lock()) {
+      _mm_pause();
+    }
+    Acquire_remaining_locks();
+    Stage_Pairs(sink);
+    sink->Commit();
+    Release_all_locks();
+    exporter->Count_Segment(true);
   }
 
-  char dummy[48];
+  /*DRAM filter of the segment, reset when the pool is reopened*/
+  filter::SegmentFilter *seg_filter;
+  char dummy[40];
   Bucket<T> bucket[kNumBucket + stashBucket];
   size_t local_depth;
   size_t pattern;
@@ -1234,6 +1603,7 @@ struct Table {
   int state; /*-1 means this bucket is merging, -2 means this bucket is
                 splitting (SPLITTING), 0 meanning normal bucket, -3 means new
                 bucket (NEW)*/
+  uint32_t split_pending; /*queued to the split service, cleared by a split*/
   PMEMmutex
       lock_bit; /* for the synchronization of the lazy recovery in one segment*/
 };
@@ -1241,21 +1611,26 @@ struct Table {
 /* it needs to verify whether this bucket has been deleted...*/
 template <class T>
 int Table<T>::Insert(T key, Value_t value, size_t key_hash, uint8_t meta_hash,
-                     Directory<T> **_dir) {
+                     Directory<T> **_dir, bool try_lock) {
 RETRY:
   /*we need to first do the locking and then do the verify*/
   auto y = BUCKET_INDEX(key_hash);
   Bucket<T> *target = bucket + y;
   Bucket<T> *neighbor = bucket + ((y + 1) & bucketMask);
-  target->get_lock();
+  if (try_lock) {
+    if (!target->try_get_lock()) return -4;
+  } else {
+    target->get_lock();
+  }
   if (!neighbor->try_get_lock()) {
+    contention::Local().trylock_failures++;
     target->release_lock();
-    return -2;
+    return try_lock ? -4 : -2;
   }
 
   auto old_sa = *_dir;
   auto x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
-  if (reinterpret_cast<Table<T> *>(reinterpret_cast<uint64_t>(old_sa->_[x]) &
+  if (reinterpret_cast<Table<T> *>(reinterpret_cast<uint64_t>(old_sa->Entry(x)) &
                                    tailMask) != this) {
     neighbor->release_lock();
     target->release_lock();
@@ -1270,12 +1645,17 @@ RETRY:
     target->release_lock();
     return -3; /* duplicate insert*/
   }
+  /*the key is in the filter before the pair can be seen*/
+  if (seg_filter != nullptr) seg_filter->Add(key_hash);
 
   if (((GET_COUNT(target->bitmap)) == kNumPairPerBucket) &&
       ((GET_COUNT(neighbor->bitmap)) == kNumPairPerBucket)) {
+    /*the displacements move durable pairs, they are never deferred*/
+    durability::Eager eager;
     Bucket<T> *next_neighbor = bucket + ((y + 2) & bucketMask);
     // Next displacement
     if (!next_neighbor->try_get_lock()) {
+      contention::Local().trylock_failures++;
       neighbor->release_lock();
       target->release_lock();
       return -2;
@@ -1297,6 +1677,7 @@ RETRY:
       prev_index = y - 1;
     }
     if (!prev_neighbor->try_get_lock()) {
+      contention::Local().trylock_failures++;
       target->release_lock();
       neighbor->release_lock();
       return -2;
@@ -1309,6 +1690,7 @@ RETRY:
 
     Bucket<T> *stash = bucket + kNumBucket;
     if (!stash->try_get_lock()) {
+      contention::Local().trylock_failures++;
       neighbor->release_lock();
       target->release_lock();
       prev_neighbor->release_lock();
@@ -1320,7 +1702,8 @@ RETRY:
     neighbor->release_lock();
     target->release_lock();
     prev_neighbor->release_lock();
-    return ret;
+    /*1 tells the caller that the pair went to the stash*/
+    return (ret == 0) ? 1 : ret;
   }
 
   /* the fp+bitmap are persisted after releasing the lock of one bucket but
@@ -1424,7 +1807,7 @@ void Table<T>::Insert4splitWithCheck(T key, Value_t value, size_t key_hash,
 
 /*the insert needs to be perfectly balanced, not destory the power of balance*/
 template <class T>
-void Table<T>::Insert4split(T key, Value_t value, size_t key_hash,
+bool Table<T>::Insert4split(T key, Value_t value, size_t key_hash,
                             uint8_t meta_hash) {
   auto y = BUCKET_INDEX(key_hash);
   Bucket<T> *target = bucket + y;
@@ -1446,6 +1829,7 @@ void Table<T>::Insert4split(T key, Value_t value, size_t key_hash,
 #ifdef COUNTING
     ++number;
 #endif
+    return true;
   } else {
     /*do the displacement or insertion in the stash*/
     Bucket<T> *next_neighbor = bucket + ((y + 2) & bucketMask);
@@ -1462,7 +1846,7 @@ void Table<T>::Insert4split(T key, Value_t value, size_t key_hash,
 #ifdef COUNTING
       ++number;
 #endif
-      return;
+      return true;
     }
     Bucket<T> *prev_neighbor;
     int prev_index;
@@ -1486,10 +1870,11 @@ void Table<T>::Insert4split(T key, Value_t value, size_t key_hash,
 #ifdef COUNTING
       ++number;
 #endif
-      return;
+      return true;
     }
 
-    Stash_insert(target, neighbor, key, value, meta_hash, y & stashMask);
+    return Stash_insert(target, neighbor, key, value, meta_hash,
+                        y & stashMask, false) == 0;
   }
 }
 
@@ -1638,11 +2023,12 @@ void Table<T>::HelpSplit(Table<T> *next_table) {
     invalid_array[kNumBucket + i] = invalid_mask;
   }
   next_table->pattern = new_pattern;
-  Allocator::Persist(&next_table->pattern, sizeof(next_table->pattern));
+  Allocator::Flush(&next_table->pattern, sizeof(next_table->pattern));
   pattern = old_pattern;
-  Allocator::Persist(&pattern, sizeof(pattern));
+  Allocator::Flush(&pattern, sizeof(pattern));
 
 #ifdef PMEM
+  /*one fence for the patterns and the new segment*/
   Allocator::Persist(next_table, sizeof(Table));
   size_t sumBucket = kNumBucket + stashBucket;
   for (int i = 0; i < sumBucket; ++i) {
@@ -1655,6 +2041,10 @@ void Table<T>::HelpSplit(Table<T> *next_table) {
 
   Allocator::Persist(this, sizeof(Table));
 #endif
+  if (mirror::Enabled()) {
+    Sync_Mirror();
+    next_table->Sync_Mirror();
+  }
 }
 
 template <class T>
@@ -1672,11 +2062,31 @@ Table<T> *Table<T>::Split(size_t _key_hash) {
 
   next_table->state = -2;
   Allocator::Persist(&next_table->state, sizeof(next_table->state));
+  split_pending = 0;
+  /*the new segment gets its filter before it is published in the directory,
+   * the filter of this segment drops the pairs that move*/
+  filter::SegmentFilter kept;
+  if (seg_filter != nullptr) {
+    next_table->seg_filter = filter::New();
+    memset(&kept, 0, sizeof(kept));
+  }
   next_table->bucket
       ->get_lock(); /* get the first lock of the new bucket to avoid it
                  is operated(split or merge) by other threads*/
+  /*a streaming split moves the pairs into a DRAM image of the new segment
+   * and copies it to PM in one go; nobody else writes the new segment before
+   * it is published, so the image starts as a copy of it*/
+  bool streaming = persist::Streaming();
+  Table<T> *image = next_table;
+  if (streaming) {
+    image = Split_Image();
+    /*only the empty user-provided destructor keeps Table from being
+     * trivially copyable, its members are all plain data*/
+    memcpy(static_cast<void *>(image), next_table, sizeof(Table));
+  }
   size_t key_hash;
   uint32_t invalid_array[kNumBucket + stashBucket];
+  bool placed = true; /*every moved pair found room in the new segment*/
   for (int i = 0; i < kNumBucket; ++i) {
     auto *curr_bucket = bucket + i;
     auto mask = GET_BITMAP(curr_bucket->bitmap);
@@ -1694,14 +2104,18 @@ Table<T> *Table<T>::Split(size_t _key_hash) {
 
         if ((key_hash >> (64 - local_depth - 1)) == new_pattern) {
           invalid_mask = invalid_mask | (1 << j);
-          next_table->Insert4split(
-              curr_bucket->_[j].key, curr_bucket->_[j].value, key_hash,
-              curr_bucket->finger_array[j]); /*this shceme may destory the
-                                                balanced segment*/
+          placed = placed &&
+                   image->Insert4split(
+                       curr_bucket->_[j].key, curr_bucket->_[j].value,
+                       key_hash, curr_bucket->finger_array[j]); /*this shceme
+                                   may destory the balanced segment*/
                                              // curr_bucket->unset_hash(j);
+          if (seg_filter != nullptr) next_table->seg_filter->Add(key_hash);
 #ifdef COUNTING
           number--;
 #endif
+        } else if (seg_filter != nullptr) {
+          kept.Add(key_hash);
         }
       }
     }
@@ -1724,32 +2138,41 @@ Table<T> *Table<T>::Split(size_t _key_hash) {
 //        }
         if ((key_hash >> (64 - local_depth - 1)) == new_pattern) {
           invalid_mask = invalid_mask | (1 << j);
-          next_table->Insert4split(
-              curr_bucket->_[j].key, curr_bucket->_[j].value, key_hash,
-              curr_bucket->finger_array[j]); /*this shceme may destory the
-                                                balanced segment*/
-          auto bucket_ix = BUCKET_INDEX(key_hash);
-          auto org_bucket = bucket + bucket_ix;
-          auto neighbor_bucket = bucket + ((bucket_ix + 1) & bucketMask);
-          org_bucket->unset_indicator(curr_bucket->finger_array[j],
-                                      neighbor_bucket, curr_bucket->_[j].key,
-                                      i);
+          placed = placed &&
+                   image->Insert4split(
+                       curr_bucket->_[j].key, curr_bucket->_[j].value,
+                       key_hash, curr_bucket->finger_array[j]); /*this shceme
+                                   may destory the balanced segment*/
+          if (seg_filter != nullptr) next_table->seg_filter->Add(key_hash);
 #ifdef COUNTING
           number--;
 #endif
+        } else if (seg_filter != nullptr) {
+          kept.Add(key_hash);
         }
       }
     }
     invalid_array[kNumBucket + i] = invalid_mask;
   }
-  next_table->pattern = new_pattern;
-  Allocator::Persist(&next_table->pattern, sizeof(next_table->pattern));
+  /*the pairs are moved one by one into the buckets they hash to, which runs
+   * out of room when nearly all pairs of a full segment move; then the new
+   * segment gets every bucket as is instead*/
+  if (!placed) Copy_Moved_Pairs(image, invalid_array);
+  Unset_Moved_Stash_Indicators(invalid_array);
+  if (seg_filter != nullptr) seg_filter->Assign(kept);
+  image->pattern = new_pattern;
   pattern = old_pattern;
-  Allocator::Persist(&pattern, sizeof(pattern));
+  Allocator::Flush(&pattern, sizeof(pattern));
 
 #ifdef PMEM
-  Allocator::Persist(next_table, sizeof(Table));
+  /*one fence for the patterns and the new segment*/
   size_t sumBucket = kNumBucket + stashBucket;
+  if (streaming) {
+    Allocator::StreamCopy(next_table, image, sizeof(Table));
+  } else {
+    Allocator::Flush(&next_table->pattern, sizeof(next_table->pattern));
+    Allocator::Persist(next_table, sizeof(Table));
+  }
   for (int i = 0; i < sumBucket; ++i) {
     auto curr_bucket = bucket + i;
     curr_bucket->bitmap = curr_bucket->bitmap & (~(invalid_array[i] << 18)) &
@@ -1758,8 +2181,19 @@ Table<T> *Table<T>::Split(size_t _key_hash) {
     curr_bucket->bitmap = curr_bucket->bitmap - count;
   }
 
-  Allocator::Persist(this, sizeof(Table));
+  if (streaming) {
+    /*only the bucket headers changed: the bitmaps and, for the pairs that
+     * left the stash, the overflow fingerprints*/
+    for (int i = 0; i < sumBucket; ++i) {
+      Allocator::Flush(bucket + i, offsetof(Bucket<T>, _));
+    }
+    Allocator::Fence();
+  } else {
+    Allocator::Persist(this, sizeof(Table));
+  }
 #endif
+  /*the pairs were moved without the bucket locks of the new segment*/
+  if (mirror::Enabled()) next_table->Sync_Mirror();
   return next_table;
 }
 
@@ -1809,7 +2243,8 @@ void Table<T>::Merge(Table<T> *neighbor, bool unique_check_flag) {
         }
       }
     }
-
+    /*a recovery redo, which runs without the bucket locks*/
+    if (mirror::Enabled()) Sync_Mirror();
   } else {
     size_t key_hash;
     for (int i = 0; i < kNumBucket; ++i) {
@@ -1863,43 +2298,175 @@ class Finger_EH : public Hash<T> {
   Finger_EH(size_t, PMEMobjpool *_pool);
   ~Finger_EH(void);
   inline int Insert(T key, Value_t value);
-  int Insert(T key, Value_t value, bool);
+  int Insert(T key, Value_t value, Session &);
   inline bool Delete(T);
-  bool Delete(T, bool);
+  bool Delete(T, Session &);
   inline Value_t Get(T);
-  Value_t Get(T key, bool is_in_epoch);
+  Value_t Get(T key, Session &session);
+  /*the table operations behind the hot-key cache*/
+  inline int Insert_Pair(T key, Value_t value);
+  inline bool Delete_Pair(T);
+  inline Value_t Get_Pair(T);
   void TryMerge(uint64_t);
+  void Defer_Merge(uint64_t);
+  void Run_Deferred_Merges();
+  void Merge_Segments(uint64_t);
   void Directory_Doubling(int x, Table<T> *new_b, Table<T> *old_b);
   void Directory_Merge_Update(Directory<T> *_sa, uint64_t key_hash,
                               Table<T> *left_seg);
   void Directory_Update(Directory<T> *_sa, int x, Table<T> *new_b,
                         Table<T> *old_b);
   void Halve_Directory();
+  void Copy_Directory(Directory<T> *src, Directory<T> *dst);
+  void Copy_Directory_Chunk(Directory<T> *src, Directory<T> *dst,
+                            uint64_t chunk, uint64_t chunk_size, bool halving);
+  uint64_t Publish_Copy_Job(Directory<T> *src, Directory<T> *dst,
+                            uint64_t chunk_size, bool halving);
+  bool Help_Directory_Copy();
+  void Finish_Migration();
+  void Complete_Migration(Directory<T> *src, Directory<T> *dst);
+  void Recover_Migration();
+  void Prepare_Spare_Directory();
+  void Migrator_Loop();
+  void Start_Migrator();
+  void Stop_Migrator();
   int FindAnyway(T key);
+  /*let the index own variable-length keys in a PM key arena*/
+  void EnableKeyArena(size_t block_size = arena::kDefaultBlockSize);
+  bool ReplaceKey(T old_key, T new_key);
+  /*split segments above the high-water mark in background threads*/
+  void EnableSplitService(uint32_t num_threads,
+                          uint32_t high_water = kSplitHighWater);
+  bool Split_Table(Table<T> *target, uint64_t key_hash);
+  /*cache hot fixed-length keys and negative lookups in size_mb of DRAM*/
+  void EnableHotCache(size_t size_mb);
+  /*writers that find their bucket locked hand the operation to its holder*/
+  void EnableCombining();
+  /*answer most negative lookups from a DRAM filter per segment*/
+  void EnableSegmentFilters();
+  void Reset_Segment_Filters();
+  void Report_Segment_Filters();
+  /*keep the directory in DRAM only, Recovery() rebuilds it from the segments*/
+  void EnableDramDirectory();
+  void Rebuild_Directory();
+  /*mirror the bucket metadata of every segment of a pool of pool_size bytes
+   * in DRAM and answer lookups from it*/
+  void EnableBucketMirror(size_t pool_size);
+  void Report_Bucket_Mirror();
+  /* defer the flushes of inserts to per-thread rings drained every
+   * interval_us, the writes of the last interval may be lost in a crash*/
+  void EnableGroupCommit(uint32_t interval_us);
+  /* log every successful insert and delete to a change stream at path that
+   * followers tail, log_mb of ring per writer thread*/
+  bool EnableChangeStream(const char *path, size_t log_mb = 16);
+  /* write the pairs to a checkpoint file at path on num_threads threads while
+   * writers go on, at most mb_per_sec MB/s if it is not 0; a pair present
+   * during the whole walk is in the file, merges wait until it ends. Returns
+   * the number of pairs written, 0 if writing the file failed*/
+  uint64_t Checkpoint(const char *path, uint32_t num_threads = 4,
+                      uint64_t mb_per_sec = 0, bool with_hashes = false);
+  /* convert the index to a frozen snapshot at path on num_threads threads,
+   * served read-only by frozen::Snapshot. The index must be quiescent: merges
+   * wait until it ends, but an insert or a delete meanwhile makes it fail.
+   * Returns the number of pairs written, 0 if it failed*/
+  uint64_t Freeze(const char *path, uint32_t num_threads = 4);
+  uint64_t Freeze_Segments(const char *path, uint32_t num_threads);
+  /*fault in the directory and the segments on num_threads threads after the
+   * pool is opened*/
+  void WarmUp(uint32_t num_threads);
+  /*make every insert so far durable*/
+  void Sync() {
+    if (group_commit != nullptr) group_commit->Sync();
+  }
+  bool Get_Mirrored(Table<T> *target, Table<T> *old_entry, T key,
+                    uint64_t key_hash, Value_t *value);
+  void Recover_Segment_State(Table<T> *seg, uint64_t first_hash);
+  int Combine(Table<T> *table, uint32_t op, T key, Value_t value,
+              uint64_t key_hash);
+  void Combine_Pass(combine::PublicationList<T> *list);
+  /*called by a writer after releasing its bucket locks*/
+  inline void Help_Combine(Table<T> *table) {
+    auto list = publication + combine::List_Index(table);
+    uint32_t idle = 0;
+    if (__atomic_load_n(&list->pending, __ATOMIC_RELAXED) != 0 &&
+        CAS(&list->combiner, &idle, 1)) {
+      Combine_Pass(list);
+      __atomic_store_n(&list->combiner, 0, __ATOMIC_RELEASE);
+    }
+  }
+  void Apply_Batch(Table<T> *table, combine::Request<T> **batch, uint32_t n);
+  bool Background_Split(uint64_t key_hash);
+  static bool SplitByService(void *context, uint64_t key_hash) {
+    return reinterpret_cast<Finger_EH<T> *>(context)->Background_Split(
+        key_hash);
+  }
+  split::SplitStats SplitServiceStats() {
+    split::SplitStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (split_service != nullptr) stats = split_service->Stats();
+    return stats;
+  }
+  static bool RelocateKey(void *context, string_key *old_key,
+                          string_key *new_key) {
+    return reinterpret_cast<Finger_EH<T> *>(context)->ReplaceKey(
+        reinterpret_cast<T>(old_key), reinterpret_cast<T>(new_key));
+  }
+
+  bool CopiesKeys() { return key_arena != nullptr; }
+
+  inline T StoreKey(T key) {
+    if constexpr (std::is_pointer<T>::value) {
+      if (key_arena != nullptr) return key_arena->Store(key);
+    }
+    return key;
+  }
+
+  inline void RetireKey(T key) {
+    if constexpr (std::is_pointer<T>::value) {
+      if (key_arena != nullptr) key_arena->Retire(key);
+    }
+  }
+
+  inline void ReleaseKey(T key) {
+    if constexpr (std::is_pointer<T>::value) {
+      if (key_arena != nullptr) key_arena->Release(key);
+    }
+  }
+
   void ShutDown() {
+    Stop_Migrator();
+    if (split_service != nullptr) split_service->Stop();
+    if (key_arena != nullptr) {
+      /*the compactor relocates keys and writes the buckets it points from*/
+      key_arena->StopCompactor();
+    }
+    /*stops the flusher after draining every ring*/
+    delete group_commit;
+    group_commit = nullptr;
     clean = true;
     Allocator::Persist(&clean, sizeof(clean));
+    delete key_arena;
+    key_arena = nullptr;
   }
   void getNumber() {
     std::cout << "The size of the bucket is " << sizeof(struct Bucket<T>) << std::endl;
     size_t _count = 0;
     size_t seg_count = 0;
     Directory<T> *seg = dir;
-    Table<T> **dir_entry = seg->_;
     Table<T> *ss;
     auto global_depth = seg->global_depth;
     size_t depth_diff;
     int capacity = pow(2, global_depth);
     for (int i = 0; i < capacity;) {
       ss = reinterpret_cast<Table<T> *>(
-          reinterpret_cast<uint64_t>(dir_entry[i]) & tailMask);
+          reinterpret_cast<uint64_t>(seg->Entry(i)) & tailMask);
       depth_diff = global_depth - ss->local_depth;
       _count += ss->number;
       seg_count++;
       i += pow(2, depth_diff);
     }
 
-    ss = reinterpret_cast<Table<T> *>(reinterpret_cast<uint64_t>(dir_entry[0]) &
+    ss = reinterpret_cast<Table<T> *>(reinterpret_cast<uint64_t>(seg->Entry(0)) &
                                       tailMask);
     uint64_t verify_seg_count = 1;
     while (!OID_IS_NULL(ss->next)) {
@@ -1915,60 +2482,152 @@ class Finger_EH : public Hash<T> {
     std::cout << "Raw_Space: ",
            (double)(_count * 16) / (seg_count * sizeof(Table<T>)) << std::endl;
 #endif
+    if (key_arena != nullptr) {
+      key_arena->Report();
+    }
+    if (split_service != nullptr) {
+      split_service->Report();
+    }
+    if (hot_cache != nullptr) {
+      hot_cache->Report();
+    }
+    if (publication != nullptr) {
+      combine::Report(combine_stats);
+    }
+    if (segment_filters) {
+      Report_Segment_Filters();
+    }
+    if (mirror::Enabled()) {
+      Report_Bucket_Mirror();
+    }
+    if (group_commit != nullptr) {
+      group_commit->Report();
+    }
+    if (change_stream != nullptr) {
+      change_stream->Report();
+    }
+    std::cout << "directory resizes = " << resize_count
+              << ", total pause = " << resize_pause_ns / 1000000.0 << " ms"
+              << ", max pause = " << resize_max_pause_ns / 1000000.0 << " ms"
+              << std::endl;
   }
 
-  void recoverTable(Table<T> **target_table, size_t, size_t, Directory<T> *);
-  void Recovery();
-
-  inline int Test_Directory_Lock_Set(void) {
-    uint32_t v = __atomic_load_n(&lock, __ATOMIC_ACQUIRE);
-    return v & lockSet;
+  inline void Reset_Resize_State() {
+    memset(&copy_job, 0, sizeof(copy_job));
+    spare_lock = 0;
+    stop_migrator = false;
+    migrator = nullptr;
+    resize_count = 0;
+    resize_pause_ns = 0;
+    resize_max_pause_ns = 0;
   }
 
-  inline bool try_get_directory_read_lock(){
-    uint32_t v = __atomic_load_n(&lock, __ATOMIC_ACQUIRE);
-    uint32_t old_value = v & lockMask;
-    auto new_value = ((v & lockMask) + 1) & lockMask;
-    return CAS(&lock, &old_value, new_value);
+  inline void Record_Resize_Pause(
+      std::chrono::steady_clock::time_point start) {
+    uint64_t pause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    resize_count++;
+    resize_pause_ns += pause;
+    if (pause > resize_max_pause_ns) resize_max_pause_ns = pause;
   }
 
-  inline void release_directory_read_lock(){
-    SUB(&lock, 1);
+  bool recoverTable(Table<T> **target_table, size_t, size_t, Directory<T> *);
+  inline void Recover_Metadata(Table<T> *table) {
+    if (relaxed_durability) table->Validate_Pairs();
+    table->recoverMetadata();
+  }
+  void Recovery();
+  /*recover every segment now on num_threads threads instead of on its first
+   * access, called right after Recovery()*/
+  void EagerRecovery(uint32_t num_threads);
+  /*EagerRecovery unless it already ran since the pool was reopened*/
+  inline void Recover_Once(uint32_t num_threads) {
+    if (LOAD(&recovered_version) != crash_version) EagerRecovery(num_threads);
   }
 
-  void Lock_Directory(){
+  inline int Test_Directory_Lock_Set(void) {
     uint32_t v = __atomic_load_n(&lock, __ATOMIC_ACQUIRE);
-    uint32_t old_value = v & lockMask;
-    uint32_t new_value = old_value | lockSet;
+    return v & lockSet;
+  }
 
-    while (!CAS(&lock, &old_value, new_value)) {
-      old_value = old_value & lockMask;
-      new_value = old_value | lockSet;
+  /* Directory entry updaters do not register themselves anywhere: they write
+   * the entries of the directory they observed, then recheck the lock and the
+   * version and redo the update on the new directory if a doubling/halving
+   * raced with them. An update always writes every entry of its range, so it
+   * never depends on whether those entries were migrated yet. The replaced directory is handed to the epoch manager, so
+   * it stays valid until every thread that might still write to it has left
+   * its epoch. The lock thus only serializes the directory resizers.*/
+  void Lock_Directory(){
+    uint32_t old_value = 0;
+    while (!CAS(&lock, &old_value, lockSet)) {
+      old_value = 0;
+      if (!Help_Directory_Copy()) {
+        asm("nop");
+      }
     }
+  }
 
-    //wait until the readers all exit the critical section
-    v = __atomic_load_n(&lock, __ATOMIC_ACQUIRE);
-    while(v & lockMask){
-      v = __atomic_load_n(&lock, __ATOMIC_ACQUIRE);
+  /*wait until no doubling/halving is in progress*/
+  inline void Wait_Directory_Unlock() {
+    while (Test_Directory_Lock_Set()) {
+      if (!Help_Directory_Copy()) {
+        asm("nop");
+      }
     }
   }
 
+  /*after updating entries of _sa, check whether _sa may have been copied or
+   * replaced concurrently; the full fence orders the entry stores before the
+   * load of the lock*/
+  inline bool Directory_Changed(Directory<T> *_sa) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return Test_Directory_Lock_Set() || (_sa != dir);
+  }
+
   // just set the lock as 0
   void Unlock_Directory(){
     __atomic_store_n(&lock, 0, __ATOMIC_RELEASE);    
   }
 
   Directory<T> *dir;
-  uint32_t lock; // the MSB is the lock bit; remaining bits are used as the counter
+  uint32_t lock; // the MSB is set while the directory is doubled or halved
   uint64_t
       crash_version; /*when the crash version equals to 0Xff => set the crash
                         version as 0, set the version of all entries as 1*/
+  uint64_t recovered_version; /*crash_version of the last eager recovery*/
   bool clean;
   PMEMobjpool *pool_addr;
   /* directory allocation will write to here first,
    * in oder to perform safe directory allocation
    * */
   PMEMoid back_dir;
+  PMEMoid key_arena_root; /*persistent state of the key arena, if enabled*/
+  arena::KeyArena *key_arena; /*DRAM handle, reset when the pool is reopened*/
+  split::SplitService *split_service; /*DRAM, reset when the pool is reopened*/
+  hotcache::HotCache *hot_cache;      /*DRAM, reset when the pool is reopened*/
+  combine::PublicationList<T> *publication; /*DRAM, as above*/
+  combine::CombineStats combine_stats;
+  bool segment_filters;
+  bool filters_used; /*set for good once a run gave the segments filters*/
+  bool dram_directory; /*dir points to DRAM and is not valid after a restart*/
+  bool relaxed_durability; /*set for good once inserts deferred their flushes*/
+  durability::GroupCommit *group_commit; /*DRAM, reset when the pool is reopened*/
+  cdc::ChangeStream *change_stream;      /*DRAM, as above*/
+  uint32_t checkpoints; /*running checkpoints, merges are deferred meanwhile*/
+  uint32_t merges;      /*merges in flight*/
+  /*key_hash | 1 of a merge deferred by a checkpoint, 0 for a free slot*/
+  uint64_t deferred_merges[kDeferredMerges];
+  Table<T> *first_table; /*head of the segment list, it is never merged away*/
+  uint32_t split_high_water;
+  /*volatile resize state, reset when the pool is reopened*/
+  DirectoryCopyJob<T> copy_job;
+  uint32_t spare_lock; /*guards back_dir between the migrator and resizers*/
+  bool stop_migrator;
+  std::thread *migrator;
+  uint64_t resize_count;
+  uint64_t resize_pause_ns;
+  uint64_t resize_max_pause_ns;
 };
 
 template <class T>
@@ -1979,7 +2638,24 @@ Finger_EH<T>::Finger_EH(size_t initCap, PMEMobjpool *_pool) {
   back_dir = OID_NULL;
   lock = 0;
   crash_version = 0;
+  recovered_version = 0;
   clean = false;
+  key_arena_root = OID_NULL;
+  key_arena = nullptr;
+  split_service = nullptr;
+  hot_cache = nullptr;
+  publication = nullptr;
+  memset(&combine_stats, 0, sizeof(combine_stats));
+  segment_filters = false;
+  filters_used = false;
+  dram_directory = false;
+  relaxed_durability = false;
+  group_commit = nullptr;
+  change_stream = nullptr;
+  checkpoints = 0;
+  merges = 0;
+  memset(deferred_merges, 0, sizeof(deferred_merges));
+  Reset_Resize_State();
   PMEMoid ptr;
 
   /*FIXME: make the process of initialization crash consistent*/
@@ -1995,128 +2671,922 @@ Finger_EH<T>::Finger_EH(size_t initCap, PMEMobjpool *_pool) {
     dir->_[i]->state = 0;
   }
   dir->depth_count = initCap;
+  first_table = dir->_[0];
 }
 
 template <class T>
 Finger_EH<T>::Finger_EH() {
   std::cout << "Reinitialize up" << std::endl;
+  if (dram_directory) dir = nullptr;
+  if (filters_used) Reset_Segment_Filters();
+  key_arena = nullptr;
+  split_service = nullptr;
+  hot_cache = nullptr;
+  publication = nullptr;
+  memset(&combine_stats, 0, sizeof(combine_stats));
+  segment_filters = false;
+  group_commit = nullptr;
+  change_stream = nullptr;
+  checkpoints = 0;
+  merges = 0;
+  memset(deferred_merges, 0, sizeof(deferred_merges));
+  Reset_Resize_State();
 }
 
 template <class T>
-Finger_EH<T>::~Finger_EH(void) {
-  // TO-DO
+void Finger_EH<T>::EnableKeyArena(size_t block_size) {
+  if constexpr (std::is_pointer<T>::value) {
+    if (key_arena != nullptr) return;
+    if (OID_IS_NULL(key_arena_root)) {
+      arena::KeyArena::New(&key_arena_root, block_size);
+    }
+    key_arena = new arena::KeyArena(
+        reinterpret_cast<arena::KeyArenaRoot *>(pmemobj_direct(key_arena_root)),
+        &Finger_EH<T>::RelocateKey, this);
+    key_arena->StartCompactor();
+  } else {
+    LOG("the key arena only applies to variable-length keys");
+  }
 }
 
 template <class T>
-void Finger_EH<T>::Halve_Directory() {
-  std::cout << "Begin::Directory_Halving towards " <<  dir->global_depth << std::endl;
-  auto d = dir->_;
-
-  Directory<T> *new_dir;
-#ifdef PMEM
-  Directory<T>::New(&back_dir, pow(2, dir->global_depth - 1), dir->version + 1);
-  new_dir = reinterpret_cast<Directory<T> *>(pmemobj_direct(back_dir));
-#else
-  Directory<T>::New(&new_dir, pow(2, dir->global_depth - 1), dir->version + 1);
-#endif
+void Finger_EH<T>::EnableSplitService(uint32_t num_threads,
+                                      uint32_t high_water) {
+  if (split_service != nullptr || num_threads == 0) return;
+  split_high_water = high_water;
+  split_service = new split::SplitService(&Finger_EH<T>::SplitByService, this);
+  split_service->Start(num_threads);
+}
 
-  auto _dir = new_dir->_;
-  new_dir->depth_count = 0;
-  auto capacity = pow(2, new_dir->global_depth);
-  bool skip = false;
-  for (int i = 0; i < capacity; ++i) {
-    _dir[i] = d[2 * i];
-    assert(d[2 * i] == d[2 * i + 1]);
-    if (!skip) {
-      if ((_dir[i]->local_depth == (dir->global_depth - 1)) &&
-          (_dir[i]->state != -2)) {
-        if (_dir[i]->state != -1) {
-          new_dir->depth_count += 1;
-        } else {
-          skip = true;
-        }
-      }
-    } else {
-      skip = false;
-    }
+template <class T>
+void Finger_EH<T>::EnableHotCache(size_t size_mb) {
+  if constexpr (!std::is_pointer<T>::value) {
+    if (hot_cache != nullptr || size_mb == 0) return;
+    hot_cache = new hotcache::HotCache(size_mb);
+  } else {
+    LOG("the hot-key cache only applies to fixed-length keys");
   }
+}
 
-#ifdef PMEM
-  Allocator::Persist(new_dir,
-                     sizeof(Directory<T>) + sizeof(uint64_t) * capacity);
-  auto reserve_item = Allocator::ReserveItem();
-  TX_BEGIN(pool_addr) {
-    pmemobj_tx_add_range_direct(reserve_item, sizeof(*reserve_item));
-    pmemobj_tx_add_range_direct(&dir, sizeof(dir));
-    pmemobj_tx_add_range_direct(&back_dir, sizeof(back_dir));
-    Allocator::Free(reserve_item, dir);
-    dir = new_dir;
-    back_dir = OID_NULL;
-  }
-  TX_ONABORT {
-    std::cout << "TXN fails during halvling directory" << std::endl;
+template <class T>
+void Finger_EH<T>::EnableGroupCommit(uint32_t interval_us) {
+  if constexpr (!std::is_pointer<T>::value) {
+    if (group_commit != nullptr || interval_us == 0) return;
+    /*the recovery validates the pairs of every segment from now on*/
+    relaxed_durability = true;
+    Allocator::Persist(&relaxed_durability, sizeof(relaxed_durability));
+    group_commit = new durability::GroupCommit(Allocator::GetPool(), interval_us);
+  } else {
+    LOG("the group commit only applies to fixed-length keys");
   }
-  TX_END
-#else
-  dir = new_dir;
-#endif
-  std::cout << "End::Directory_Halving towards " << dir->global_depth << std::endl;
 }
 
 template <class T>
-void Finger_EH<T>::Directory_Doubling(int x, Table<T> *new_b, Table<T> *old_b) {
-  Table<T> **d = dir->_;
-  auto global_depth = dir->global_depth;
-  std::cout << "Directory_Doubling towards " << global_depth + 1 << std::endl;
-
-  auto capacity = pow(2, global_depth);
-  Directory<T>::New(&back_dir, 2 * capacity, dir->version + 1);
-  Directory<T> *new_sa =
-      reinterpret_cast<Directory<T> *>(pmemobj_direct(back_dir));
-  auto dd = new_sa->_;
+bool Finger_EH<T>::EnableChangeStream(const char *path, size_t log_mb) {
+  if (change_stream != nullptr) return true;
+  change_stream = cdc::ChangeStream::Create(path, log_mb << 20);
+  if (change_stream == nullptr) {
+    std::cout << "failed to create the change stream " << path << std::endl;
+    return false;
+  }
+  return true;
+}
 
-  for (unsigned i = 0; i < capacity; ++i) {
-    dd[2 * i] = d[i];
-    dd[2 * i + 1] = d[i];
-  }
-  dd[2 * x + 1] = reinterpret_cast<Table<T> *>(
-      reinterpret_cast<uint64_t>(new_b) | crash_version);
-  new_sa->depth_count = 2;
+/* The walkers split the segment list by the segments it has when the walk
+ * starts. A split links the new segment right after its left half, so it is
+ * walked by the walker of that half, after it; a pair moved by the split is
+ * then copied from the left half, the new segment or both.*/
+template <class T>
+uint64_t Finger_EH<T>::Checkpoint(const char *path, uint32_t num_threads,
+                                  uint64_t mb_per_sec, bool with_hashes) {
+  if (num_threads == 0) num_threads = 1;
+  /*a segment left to the lazy recovery may still hold the locks of the crash*/
+  Recover_Once(num_threads);
+  ADD(&checkpoints, 1);
+  while (LOAD(&merges) != 0) {
+    _mm_pause();
+  }
+  checkpoint::Exporter exporter(
+      path, "Dash-EH", !std::is_pointer<T>::value, with_hashes, mb_per_sec,
+      change_stream != nullptr ? change_stream->Next_Seq() : 0);
+
+  std::vector<Table<T> *> segments;
+  for (auto curr = first_table;;) {
+    segments.push_back(curr);
+    if (OID_IS_NULL(curr->next)) break;
+    curr = reinterpret_cast<Table<T> *>(pmemobj_direct(curr->next));
+  }
+  uint64_t stride = (segments.size() + num_threads - 1) / num_threads;
+  std::vector<Table<T> *> starts;
+  for (uint64_t i = 0; i < segments.size(); i += stride) {
+    starts.push_back(segments[i]);
+  }
+  starts.push_back(nullptr);
+
+  auto walker = [&](uint32_t range) {
+    checkpoint::Sink<T> sink(&exporter);
+    for (auto curr = starts[range]; curr != starts[range + 1];) {
+      {
+        auto epoch_guard = Allocator::AquireEpochGuard();
+        curr->Export(&sink, &exporter);
+      }
+      if (OID_IS_NULL(curr->next)) break;
+      curr = reinterpret_cast<Table<T> *>(pmemobj_direct(curr->next));
+    }
+  };
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i + 1 < starts.size(); ++i) {
+    threads.emplace_back(walker, i);
+  }
+  walker(0);
+  for (auto &thread : threads) thread.join();
+  if (SUB(&checkpoints, 1) == 0) Run_Deferred_Merges();
+  return exporter.Finish();
+}
+
+/* The snapshot keeps the directory and the segments of the index. The
+ * segments are walked twice, once to size the file and once to fill it, and
+ * the file is rejected if a segment changed size in between.*/
+template <class T>
+uint64_t Finger_EH<T>::Freeze(const char *path, uint32_t num_threads) {
+  if (num_threads == 0) num_threads = 1;
+  Recover_Once(num_threads);
+  ADD(&checkpoints, 1);
+  while (LOAD(&merges) != 0) {
+    _mm_pause();
+  }
+  auto ret = Freeze_Segments(path, num_threads);
+  if (SUB(&checkpoints, 1) == 0) Run_Deferred_Merges();
+  return ret;
+}
+
+template <class T>
+uint64_t Finger_EH<T>::Freeze_Segments(const char *path, uint32_t num_threads) {
+  auto epoch_guard = Allocator::AquireEpochGuard();
+  auto sa = dir;
+  uint32_t global_depth = sa->global_depth;
+  uint64_t capacity = 1UL << global_depth;
+  std::vector<uint32_t> directory(capacity);
+  std::vector<Table<T> *> segments;
+  for (uint64_t x = 0; x < capacity;) {
+    auto seg = reinterpret_cast<Table<T> *>(
+        reinterpret_cast<uint64_t>(sa->Entry(x)) & tailMask);
+    uint64_t stride = 1UL << (global_depth - seg->local_depth);
+    for (uint64_t i = 0; i < stride; ++i) directory[x + i] = segments.size();
+    segments.push_back(seg);
+    x += stride;
+  }
+
+  auto for_each_segment = [&](auto fn) {
+    auto worker = [&](uint32_t t) {
+      auto epoch_guard = Allocator::AquireEpochGuard();
+      frozen::Staged<T> staged;
+      for (uint64_t s = t; s < segments.size(); s += num_threads) {
+        staged.pairs.clear();
+        segments[s]->Stage_Pairs(&staged);
+        fn(s, staged);
+      }
+    };
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < num_threads; ++t) threads.emplace_back(worker, t);
+    worker(0);
+    for (auto &thread : threads) thread.join();
+  };
+
+  std::vector<uint64_t> pairs(segments.size());
+  std::vector<uint64_t> key_bytes(segments.size());
+  for_each_segment([&](uint64_t s, frozen::Staged<T> &staged) {
+    pairs[s] = staged.pairs.size();
+    key_bytes[s] = staged.Key_Bytes();
+  });
+  frozen::Builder<T> builder(path, global_depth, directory, pairs, key_bytes);
+  if (!builder.Ok()) return 0;
+  for_each_segment([&](uint64_t s, frozen::Staged<T> &staged) {
+    builder.Fill(s, staged.pairs);
+  });
+  return builder.Finish("Dash-EH");
+}
+
+/* A segment is warmed through the first of its directory entries. The
+ * variable-length keys are read as well, lookups compare them.*/
+template <class T>
+void Finger_EH<T>::WarmUp(uint32_t num_threads) {
+  auto sa = dir;
+  auto global_depth = sa->global_depth;
+  uint64_t capacity = 1UL << global_depth;
+  warmup::Touch(sa, sizeof(Directory<T>) + capacity * sizeof(Table<T> *));
+  warmup::Run("Dash-EH", capacity, num_threads, [&](uint64_t x) -> uint64_t {
+    auto seg = reinterpret_cast<Table<T> *>(
+        reinterpret_cast<uint64_t>(sa->Entry(x)) & tailMask);
+    if (x & ((1UL << (global_depth - seg->local_depth)) - 1)) return 0;
+    uint64_t pages = warmup::Touch(seg, sizeof(Table<T>));
+    if constexpr (std::is_pointer<T>::value) {
+      warmup::Sink<T> sink;
+      seg->Stage_Pairs(&sink);
+    }
+    return pages;
+  });
+}
+
+/* The filters live in DRAM, so the pointers left in the segments by a
+ * previous run are dropped when the pool is reopened. Only a pool that ever
+ * had filters has any, so the others skip the walk over every segment*/
+template <class T>
+void Finger_EH<T>::Reset_Segment_Filters() {
+  auto curr = first_table;
+  while (true) {
+    curr->seg_filter = nullptr;
+    if (OID_IS_NULL(curr->next)) break;
+    curr = reinterpret_cast<Table<T> *>(pmemobj_direct(curr->next));
+  }
+}
+
+/*build the filters of all segments, called before any operation starts*/
+template <class T>
+void Finger_EH<T>::EnableSegmentFilters() {
+  if (segment_filters) return;
+  filters_used = true;
+  Allocator::Persist(&filters_used, sizeof(filters_used));
+  auto curr = first_table;
+  while (true) {
+    curr->Build_Filter();
+    if (OID_IS_NULL(curr->next)) break;
+    curr = reinterpret_cast<Table<T> *>(pmemobj_direct(curr->next));
+  }
+  segment_filters = true;
+}
+
+template <class T>
+void Finger_EH<T>::Report_Segment_Filters() {
+  uint64_t segments = 0;
+  uint64_t bits = 0;
+  auto curr = first_table;
+  while (true) {
+    if (curr->seg_filter != nullptr) {
+      segments++;
+      bits += curr->seg_filter->Bits_Set();
+    }
+    if (OID_IS_NULL(curr->next)) break;
+    curr = reinterpret_cast<Table<T> *>(pmemobj_direct(curr->next));
+  }
+  filter::Report(segments, bits);
+}
+
+/* Move the directory to DRAM. Operations no longer read their entry from PM
+ * and directory updates only persist the local depth of the split segment;
+ * the entries are derived from the segment list by Rebuild_Directory.*/
+template <class T>
+void Finger_EH<T>::EnableDramDirectory() {
+  if (dram_directory) return;
+  Finish_Migration();
+  auto old_dir = dir;
+  uint64_t capacity = 1UL << old_dir->global_depth;
+  auto volatile_dir = Directory<T>::NewVolatile(capacity, old_dir->version);
+  memcpy(volatile_dir->_, old_dir->_, sizeof(Table<T> *) * capacity);
+  volatile_dir->depth_count = old_dir->depth_count;
+  TX_BEGIN(pool_addr) {
+    pmemobj_tx_add_range_direct(&dir, sizeof(dir));
+    pmemobj_tx_add_range_direct(&dram_directory, sizeof(dram_directory));
+    pmemobj_tx_add_range_direct(&back_dir, sizeof(back_dir));
+    pmemobj_tx_free(pmemobj_oid(old_dir));
+    if (!OID_IS_NULL(back_dir)) pmemobj_tx_free(back_dir);
+    dir = volatile_dir;
+    dram_directory = true;
+    back_dir = OID_NULL;
+  }
+  TX_ONABORT { std::cout << "TXN fails during directory move" << std::endl; }
+  TX_END
+}
+
+template <class T>
+void Finger_EH<T>::EnableCombining() {
+  if (publication != nullptr) return;
+  publication = combine::NewLists<T>();
+}
+
+/* Publish the operation in the list of the segment and wait until a combiner,
+ * possibly this thread, has applied it. Returns combine::kFallback if the
+ * caller has to run the operation itself.*/
+template <class T>
+int Finger_EH<T>::Combine(Table<T> *table, uint32_t op, T key, Value_t value,
+                          uint64_t key_hash) {
+  auto list = publication + combine::List_Index(table);
+  auto req = combine::Publish(list, op, key, value, key_hash,
+                              reinterpret_cast<void *>(table));
+  if (req == nullptr) {
+    __atomic_fetch_add(&combine_stats.full, 1, __ATOMIC_RELAXED);
+    return combine::kFallback;
+  }
+
+  while (__atomic_load_n(&req->state, __ATOMIC_ACQUIRE) != combine::kSlotDone) {
+    uint32_t idle = 0;
+    if (__atomic_load_n(&list->combiner, __ATOMIC_RELAXED) == 0 &&
+        CAS(&list->combiner, &idle, 1)) {
+      Combine_Pass(list);
+      __atomic_store_n(&list->combiner, 0, __ATOMIC_RELEASE);
+    } else {
+      _mm_pause();
+    }
+  }
+  return combine::Finish(req);
+}
+
+template <class T>
+void Finger_EH<T>::Combine_Pass(combine::PublicationList<T> *list) {
+  combine::Request<T> *batch[combine::kSlotsPerList];
+  auto n = combine::Claim(list, batch);
+  if (n == 0) return;
+
+  /*group the requests by segment and bucket, the batch is small*/
+  auto less = [](combine::Request<T> *a, combine::Request<T> *b) {
+    if (a->table != b->table) return a->table < b->table;
+    return BUCKET_INDEX(a->key_hash) < BUCKET_INDEX(b->key_hash);
+  };
+  for (uint32_t i = 1; i < n; ++i) {
+    auto req = batch[i];
+    int j = i - 1;
+    for (; j >= 0 && less(req, batch[j]); --j) {
+      batch[j + 1] = batch[j];
+    }
+    batch[j + 1] = req;
+  }
+
+  uint64_t deletes = 0;
+  for (uint32_t i = 0; i < n;) {
+    uint32_t j = i + 1;
+    while (j < n && !less(batch[i], batch[j])) ++j;
+    for (uint32_t k = i; k < j; ++k) {
+      if (batch[k]->op == combine::kOpDelete) deletes++;
+    }
+    Apply_Batch(reinterpret_cast<Table<T> *>(batch[i]->table), batch + i,
+                j - i);
+    i = j;
+  }
+  __atomic_fetch_add(&combine_stats.passes, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&combine_stats.inserts, n - deletes, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&combine_stats.deletes, deletes, __ATOMIC_RELAXED);
+}
+
+/* Apply the requests of one bucket pair under a single lock acquisition. The
+ * deletes go first; the inserts then write their pairs into slots that were
+ * free before the batch, all pairs are persisted with one flush per cache
+ * line, and only then the fingerprints and bitmaps are set. Inserts that
+ * would need a displacement or the stash and deletes that need the stash
+ * fall back to their publisher.*/
+template <class T>
+void Finger_EH<T>::Apply_Batch(Table<T> *table, combine::Request<T> **batch,
+                               uint32_t n) {
+  struct Placement {
+    Bucket<T> *bucket;
+    int slot;
+    uint8_t meta_hash;
+    bool probe;
+  };
+  Placement placed[combine::kSlotsPerList];
+  uint32_t placed_num = 0;
+  int result[combine::kSlotsPerList];
+  bool live[combine::kSlotsPerList];
+
+  auto y = BUCKET_INDEX(batch[0]->key_hash);
+  Bucket<T> *target = table->bucket + y;
+  Bucket<T> *neighbor = table->bucket + ((y + 1) & bucketMask);
+  contention::Backoff backoff;
+  while (true) {
+    target->get_lock();
+    if (neighbor->try_get_lock()) break;
+    target->release_lock();
+    backoff.Spin(&contention::ContentionStats::trylock_failures);
+  }
+
+  /*requests whose segment was split or merged go back to the publisher*/
+  auto old_sa = dir;
+  for (uint32_t i = 0; i < n; ++i) {
+    auto x = (batch[i]->key_hash >>
+              (8 * sizeof(batch[i]->key_hash) - old_sa->global_depth));
+    live[i] = reinterpret_cast<Table<T> *>(
+                  reinterpret_cast<uint64_t>(old_sa->Entry(x)) & tailMask) ==
+              table;
+    result[i] = combine::kFallback;
+  }
+
+  uint32_t all_slots = (1u << kNumPairPerBucket) - 1;
+  uint32_t free_target = ~GET_BITMAP(target->bitmap) & all_slots;
+  uint32_t free_neighbor = ~GET_BITMAP(neighbor->bitmap) & all_slots;
+  bool dirty_target = false;
+  bool dirty_neighbor = false;
+  int deleted = 0;
+
+  for (uint32_t i = 0; i < n; ++i) {
+    auto req = batch[i];
+    if (!live[i] || req->op != combine::kOpDelete) continue;
+    auto meta_hash = ((uint8_t)(req->key_hash & kMask));
+    T stored_key;
+    if (target->Delete(req->key, meta_hash, false, &stored_key) == 0) {
+      dirty_target = true;
+    } else if (neighbor->Delete(req->key, meta_hash, true, &stored_key) == 0) {
+      dirty_neighbor = true;
+    } else {
+      result[i] = target->test_stash_check() ? combine::kFallback : 0;
+      continue;
+    }
+    RetireKey(stored_key);
+    deleted++;
+    result[i] = 1;
+  }
+
+  int target_count = GET_COUNT(target->bitmap);
+  int neighbor_count = GET_COUNT(neighbor->bitmap);
+  for (uint32_t i = 0; i < n; ++i) {
+    auto req = batch[i];
+    if (!live[i] || req->op != combine::kOpInsert) continue;
+    auto meta_hash = ((uint8_t)(req->key_hash & kMask));
+    bool duplicate = target->unique_check(meta_hash, req->key, neighbor,
+                                          table->bucket + kNumBucket) == -1;
+    for (uint32_t j = 0; j < placed_num && !duplicate; ++j) {
+      duplicate =
+          key_equal(placed[j].bucket->_[placed[j].slot].key, req->key);
+    }
+    if (duplicate) {
+      result[i] = -3;
+      continue;
+    }
+
+    Placement p;
+    uint32_t *free;
+    if (free_target && (target_count <= neighbor_count || !free_neighbor)) {
+      p.bucket = target;
+      p.probe = false;
+      free = &free_target;
+      target_count++;
+    } else if (free_neighbor) {
+      p.bucket = neighbor;
+      p.probe = true;
+      free = &free_neighbor;
+      neighbor_count++;
+    } else {
+      continue;
+    }
+    p.slot = __builtin_ctz(*free);
+    p.meta_hash = meta_hash;
+    *free &= ~(1u << p.slot);
+    p.bucket->_[p.slot].value = req->value;
+    p.bucket->_[p.slot].key = req->key;
+    if (table->seg_filter != nullptr) table->seg_filter->Add(req->key_hash);
+    placed[placed_num++] = p;
+    result[i] = 0;
+  }
 
 #ifdef PMEM
-  Allocator::Persist(new_sa,
-                     sizeof(Directory<T>) + sizeof(uint64_t) * 2 * capacity);
+  for (auto curr : {target, neighbor}) {
+    int low = kNumPairPerBucket, high = -1;
+    for (uint32_t j = 0; j < placed_num; ++j) {
+      if (placed[j].bucket != curr) continue;
+      if (placed[j].slot < low) low = placed[j].slot;
+      if (placed[j].slot > high) high = placed[j].slot;
+    }
+    if (high >= 0) {
+      Allocator::Persist(&curr->_[low], (high - low + 1) * sizeof(_Pair<T>));
+    }
+  }
+#endif
+  for (uint32_t j = 0; j < placed_num; ++j) {
+    placed[j].bucket->set_hash(placed[j].slot, placed[j].meta_hash,
+                               placed[j].probe);
+    if (placed[j].bucket == target) {
+      dirty_target = true;
+    } else {
+      dirty_neighbor = true;
+    }
+  }
+#ifdef COUNTING
+  auto num = __sync_add_and_fetch(&table->number, (int)placed_num - deleted);
+#endif
+
+  /*readers need both locks released, so the bitmaps are persisted before the
+   * second release*/
+  target->release_lock();
+#ifdef PMEM
+  if (dirty_target) {
+    Allocator::Flush(&target->bitmap, sizeof(target->bitmap));
+  }
+  if (dirty_neighbor) {
+    Allocator::Flush(&neighbor->bitmap, sizeof(neighbor->bitmap));
+  }
+  Allocator::Fence();
+#endif
+  neighbor->release_lock();
+
+  for (uint32_t i = 0; i < n; ++i) {
+    if (result[i] == combine::kFallback) {
+      __atomic_fetch_add(&combine_stats.fallbacks, 1, __ATOMIC_RELAXED);
+    }
+    combine::Complete(batch[i], result[i]);
+  }
+#ifdef COUNTING
+  if (deleted && num == 0) {
+    TryMerge(batch[0]->key_hash);
+  }
+#endif
+}
+
+template <class T>
+Finger_EH<T>::~Finger_EH(void) {
+  // TO-DO
+}
+
+template <class T>
+void Finger_EH<T>::Halve_Directory() {
+  std::cout << "Begin::Directory_Halving towards " <<  dir->global_depth << std::endl;
+  auto start = std::chrono::steady_clock::now();
+  Finish_Migration();
+
+  Directory<T> *new_dir;
+#ifdef PMEM
+  uint32_t unlocked = 0;
+  if (dram_directory) {
+    new_dir = Directory<T>::NewVolatile(pow(2, dir->global_depth - 1),
+                                        dir->version + 1);
+  } else {
+    while (!CAS(&spare_lock, &unlocked, 1)) {
+      unlocked = 0;
+    }
+    /*the spare directory is sized for a doubling*/
+    if (!OID_IS_NULL(back_dir)) {
+      pmemobj_free(&back_dir);
+    }
+    Directory<T>::New(&back_dir, pow(2, dir->global_depth - 1),
+                      dir->version + 1);
+    new_dir = reinterpret_cast<Directory<T> *>(pmemobj_direct(back_dir));
+  }
+#else
+  Directory<T>::New(&new_dir, pow(2, dir->global_depth - 1), dir->version + 1);
+#endif
+
+  new_dir->depth_count = 0;
+  auto capacity = pow(2, new_dir->global_depth);
+  Copy_Directory(dir, new_dir);
+
+#ifdef PMEM
+  if (dram_directory) {
+    auto old_dir = dir;
+    __atomic_store_n(&dir, new_dir, __ATOMIC_RELEASE);
+    Retire_Volatile_Directory(old_dir);
+    Record_Resize_Pause(start);
+    std::cout << "End::Directory_Halving towards " << dir->global_depth
+              << std::endl;
+    return;
+  }
+  Allocator::Persist(new_dir,
+                     sizeof(Directory<T>) + sizeof(uint64_t) * capacity);
   auto reserve_item = Allocator::ReserveItem();
-  ++merge_time;
-  auto old_dir = dir;
   TX_BEGIN(pool_addr) {
     pmemobj_tx_add_range_direct(reserve_item, sizeof(*reserve_item));
     pmemobj_tx_add_range_direct(&dir, sizeof(dir));
     pmemobj_tx_add_range_direct(&back_dir, sizeof(back_dir));
-    pmemobj_tx_add_range_direct(&old_b->local_depth,
-                                sizeof(old_b->local_depth));
-    old_b->local_depth += 1;
     Allocator::Free(reserve_item, dir);
-    /*Swap the memory addr between new directory and old directory*/
-    dir = new_sa;
+    dir = new_dir;
     back_dir = OID_NULL;
   }
   TX_ONABORT {
-    std::cout << "TXN fails during doubling directory" << std::endl;
+    std::cout << "TXN fails during halvling directory" << std::endl;
   }
   TX_END
+  __atomic_store_n(&spare_lock, 0, __ATOMIC_RELEASE);
+#else
+  dir = new_dir;
+#endif
+  Record_Resize_Pause(start);
+  std::cout << "End::Directory_Halving towards " << dir->global_depth << std::endl;
+}
 
+/* Doubling only publishes the new directory, with the entry of the new segment
+ * filled and the other entries null; the entries are migrated lazily. The
+ * spare directory prepared by the migrator in back_dir is used if it fits, so
+ * the directory lock is normally held for O(1) work.*/
+template <class T>
+void Finger_EH<T>::Directory_Doubling(int x, Table<T> *new_b, Table<T> *old_b) {
+  std::cout << "Directory_Doubling towards " << dir->global_depth + 1
+            << std::endl;
+  auto start = std::chrono::steady_clock::now();
+  /*the previous doubling must be fully migrated*/
+  Finish_Migration();
+  auto old_dir = dir;
+  auto global_depth = old_dir->global_depth;
+
+  auto capacity = pow(2, global_depth);
+  uint32_t unlocked = 0;
+  while (!CAS(&spare_lock, &unlocked, 1)) {
+    unlocked = 0;
+  }
+  Directory<T> *new_sa = nullptr;
+  if (dram_directory) {
+    new_sa = Directory<T>::NewVolatile(2 * capacity, old_dir->version + 1);
+  } else if (!OID_IS_NULL(back_dir)) {
+    new_sa = reinterpret_cast<Directory<T> *>(pmemobj_direct(back_dir));
+    if (new_sa->global_depth != global_depth + 1) {
+      pmemobj_free(&back_dir);
+      new_sa = nullptr;
+    }
+  }
+  if (new_sa == nullptr) {
+    Directory<T>::New(&back_dir, 2 * capacity, old_dir->version + 1);
+    new_sa = reinterpret_cast<Directory<T> *>(pmemobj_direct(back_dir));
+  }
+
+  new_sa->version = old_dir->version + 1;
+  new_sa->depth_count = 2;
+  new_sa->prev = old_dir;
+  new_sa->_[2 * x + 1] = reinterpret_cast<Table<T> *>(
+      reinterpret_cast<uint64_t>(new_b) | crash_version);
+
+#ifdef PMEM
+  if (dram_directory) {
+    old_b->local_depth = new_b->local_depth;
+    Allocator::Persist(&old_b->local_depth, sizeof(old_b->local_depth));
+    __atomic_store_n(&dir, new_sa, __ATOMIC_RELEASE);
+  } else {
+    Allocator::Flush(new_sa, sizeof(Directory<T>));
+    Allocator::Persist(&new_sa->_[2 * x + 1], sizeof(uint64_t));
+    ++merge_time;
+    TX_BEGIN(pool_addr) {
+      pmemobj_tx_add_range_direct(&dir, sizeof(dir));
+      pmemobj_tx_add_range_direct(&back_dir, sizeof(back_dir));
+      pmemobj_tx_add_range_direct(&old_b->local_depth,
+                                  sizeof(old_b->local_depth));
+      old_b->local_depth = new_b->local_depth;
+      dir = new_sa;
+      back_dir = OID_NULL;
+    }
+    TX_ONABORT {
+      std::cout << "TXN fails during doubling directory" << std::endl;
+    }
+    TX_END
+  }
 #else
   dir = new_sa;
 #endif
+  __atomic_store_n(&spare_lock, 0, __ATOMIC_RELEASE);
+  Publish_Copy_Job(old_dir, new_sa, kMigrateChunk, false);
+  Start_Migrator();
+  Record_Resize_Pause(start);
+}
+
+/*copy one chunk of entries from src to dst, the chunk is indexed by the
+ * entries of dst*/
+template <class T>
+void Finger_EH<T>::Copy_Directory_Chunk(Directory<T> *src, Directory<T> *dst,
+                                        uint64_t chunk, uint64_t chunk_size,
+                                        bool halving) {
+  auto d = src->_;
+  auto dd = dst->_;
+  uint64_t capacity = 1UL << dst->global_depth;
+  uint64_t begin = chunk * chunk_size;
+  uint64_t end = std::min(begin + chunk_size, capacity);
+
+  if (!halving) {
+    /*only fill entries that no directory update has written meanwhile*/
+    for (uint64_t i = begin; i < end; ++i) {
+      if (__atomic_load_n(&dd[i], __ATOMIC_ACQUIRE) == nullptr) {
+        Table<T> *expected = nullptr;
+        CAS(&dd[i], &expected, d[i / 2]);
+      }
+    }
+    if (!dram_directory) {
+      Allocator::Persist(&dd[begin], sizeof(uint64_t) * (end - begin));
+    }
+    return;
+  } else {
+    /*the skip flag is not carried across chunks; that can only overcount
+     * depth_count, which at worst postpones the next halving*/
+    uint32_t depth_count = 0;
+    bool skip = false;
+    for (uint64_t i = begin; i < end; ++i) {
+      auto entry = d[2 * i];
+      assert(d[2 * i] == d[2 * i + 1]);
+      Allocator::NTWrite64(reinterpret_cast<uint64_t *>(&dd[i]),
+                           reinterpret_cast<uint64_t>(entry));
+      auto seg = reinterpret_cast<Table<T> *>(
+          reinterpret_cast<uint64_t>(entry) & tailMask);
+      if (!skip) {
+        if ((seg->local_depth == (src->global_depth - 1)) &&
+            (seg->state != -2)) {
+          if (seg->state != -1) {
+            depth_count += 1;
+          } else {
+            skip = true;
+          }
+        }
+      } else {
+        skip = false;
+      }
+    }
+    if (depth_count) ADD(&dst->depth_count, depth_count);
+  }
+  _mm_sfence();
+}
+
+/* The job fields are read like a seqlock: the cursor is loaded before and
+ * compared again by the claiming CAS after them. Publish_Copy_Job closes the
+ * cursor before it rewrites the fields, and a cursor value never comes back,
+ * so a claim only succeeds on fields that all belong to its generation*/
+template <class T>
+bool Finger_EH<T>::Help_Directory_Copy() {
+  uint64_t cursor = __atomic_load_n(&copy_job.cursor, __ATOMIC_ACQUIRE);
+  uint64_t chunk = cursor & kCursorChunkMask;
+  if (chunk == kCursorChunkMask) return false; /*a job is being published*/
+  auto src = __atomic_load_n(&copy_job.src, __ATOMIC_RELAXED);
+  auto dst = __atomic_load_n(&copy_job.dst, __ATOMIC_RELAXED);
+  auto num_chunks = __atomic_load_n(&copy_job.num_chunks, __ATOMIC_RELAXED);
+  auto chunk_size = __atomic_load_n(&copy_job.chunk_size, __ATOMIC_RELAXED);
+  auto halving = __atomic_load_n(&copy_job.halving, __ATOMIC_RELAXED);
+  if (chunk >= num_chunks) return false;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (!CAS(&copy_job.cursor, &cursor, cursor + 1)) return true;
+  Copy_Directory_Chunk(src, dst, chunk, chunk_size, halving);
+
+  /*count the chunk only towards the job of its own generation*/
+  uint64_t generation = cursor >> 32;
+  uint64_t done = __atomic_load_n(&copy_job.done, __ATOMIC_ACQUIRE);
+  do {
+    if ((done >> 32) != generation) return true;
+  } while (!CAS(&copy_job.done, &done, done + 1));
+  if (((done + 1) & kCursorChunkMask) == num_chunks && !halving) {
+    /*the last chunk of a migration retires the previous directory*/
+    Complete_Migration(src, dst);
+  }
+  return true;
+}
+
+/*returns the value copy_job.done reaches once every chunk was copied*/
+template <class T>
+uint64_t Finger_EH<T>::Publish_Copy_Job(Directory<T> *src, Directory<T> *dst,
+                                        uint64_t chunk_size, bool halving) {
+  uint64_t capacity = 1UL << dst->global_depth;
+  uint64_t num_chunks = (capacity + chunk_size - 1) / chunk_size;
+  uint64_t generation = (copy_job.cursor >> 32) + 1;
+  __atomic_store_n(&copy_job.cursor, (generation << 32) | kCursorChunkMask,
+                   __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&copy_job.src, src, __ATOMIC_RELAXED);
+  __atomic_store_n(&copy_job.dst, dst, __ATOMIC_RELAXED);
+  __atomic_store_n(&copy_job.num_chunks, num_chunks, __ATOMIC_RELAXED);
+  __atomic_store_n(&copy_job.chunk_size, chunk_size, __ATOMIC_RELAXED);
+  __atomic_store_n(&copy_job.halving, halving, __ATOMIC_RELAXED);
+  __atomic_store_n(&copy_job.done, generation << 32, __ATOMIC_RELAXED);
+  __atomic_store_n(&copy_job.cursor, generation << 32, __ATOMIC_RELEASE);
+  return (generation << 32) | num_chunks;
+}
+
+/*copy the whole directory for a halving, must hold the directory lock*/
+template <class T>
+void Finger_EH<T>::Copy_Directory(Directory<T> *src, Directory<T> *dst) {
+  uint64_t capacity = 1UL << dst->global_depth;
+  uint64_t num_chunks = (capacity + kDirCopyChunk - 1) / kDirCopyChunk;
+#ifdef PARALLEL_RESIZE
+  if (capacity >= kParallelCopyThreshold) {
+    uint64_t finished = Publish_Copy_Job(src, dst, kDirCopyChunk, true);
+    while (Help_Directory_Copy()) {
+    }
+    while (LOAD(&copy_job.done) != finished) {
+      asm("nop");
+    }
+    return;
+  }
+#endif
+  for (uint64_t i = 0; i < num_chunks; ++i) {
+    Copy_Directory_Chunk(src, dst, i, kDirCopyChunk, true);
+  }
+}
+
+/*help the ongoing migration until the previous directory is retired*/
+template <class T>
+void Finger_EH<T>::Finish_Migration() {
+  while (__atomic_load_n(&dir->prev, __ATOMIC_ACQUIRE) != nullptr) {
+    if (!Help_Directory_Copy()) {
+      asm("nop");
+    }
+  }
+}
+
+/*runs once per migration, for the chunk that brings done to its target*/
+template <class T>
+void Finger_EH<T>::Complete_Migration(Directory<T> *src, Directory<T> *dst) {
+#ifndef NDEBUG
+  for (uint64_t i = 0; i < (1UL << dst->global_depth); ++i) {
+    assert(__atomic_load_n(&dst->_[i], __ATOMIC_ACQUIRE) != nullptr);
+  }
+#endif
+  if (dram_directory) {
+    __atomic_store_n(&dst->prev, nullptr, __ATOMIC_RELEASE);
+    Retire_Volatile_Directory(src);
+    return;
+  }
+  auto reserve_item = Allocator::ReserveItem();
+  TX_BEGIN(pool_addr) {
+    pmemobj_tx_add_range_direct(reserve_item, sizeof(*reserve_item));
+    pmemobj_tx_add_range_direct(&dst->prev, sizeof(dst->prev));
+    Allocator::Free(reserve_item, src);
+    __atomic_store_n(&dst->prev, nullptr, __ATOMIC_RELEASE);
+  }
+  TX_ONABORT { std::cout << "TXN fails during migration" << std::endl; }
+  TX_END
+}
+
+/*finish a migration interrupted by a crash or a shutdown, single-threaded*/
+template <class T>
+void Finger_EH<T>::Recover_Migration() {
+  auto old_dir = dir->prev;
+  if (old_dir == nullptr) return;
+  uint64_t capacity = 1UL << dir->global_depth;
+  for (uint64_t i = 0; i < capacity; ++i) {
+    if (dir->_[i] == nullptr) {
+      dir->_[i] = old_dir->_[i / 2];
+    }
+  }
+  Allocator::Persist(dir->_, sizeof(uint64_t) * capacity);
+  TX_BEGIN(pool_addr) {
+    pmemobj_tx_add_range_direct(&dir->prev, sizeof(dir->prev));
+    pmemobj_tx_free(pmemobj_oid(old_dir));
+    dir->prev = nullptr;
+  }
+  TX_ONABORT { std::cout << "TXN fails during migration recovery" << std::endl; }
+  TX_END
+}
+
+/*allocate the directory of the next doubling off the critical path*/
+template <class T>
+void Finger_EH<T>::Prepare_Spare_Directory() {
+  if (dram_directory || !OID_IS_NULL(back_dir) ||
+      (__atomic_load_n(&dir->prev, __ATOMIC_ACQUIRE) != nullptr)) {
+    return;
+  }
+  uint32_t unlocked = 0;
+  if (!CAS(&spare_lock, &unlocked, 1)) return;
+  if (OID_IS_NULL(back_dir)) {
+    Directory<T>::New(&back_dir, 2 * pow(2, dir->global_depth), 0);
+  }
+  __atomic_store_n(&spare_lock, 0, __ATOMIC_RELEASE);
+}
+
+template <class T>
+void Finger_EH<T>::Migrator_Loop() {
+  while (!LOAD(&stop_migrator)) {
+    while (true) {
+      auto epoch_guard = Allocator::AquireEpochGuard();
+      if (!Help_Directory_Copy()) break;
+    }
+    Prepare_Spare_Directory();
+    msleep(kMigratorInterval);
+  }
+}
+
+/*the migrator is started by the first doubling, under the directory lock*/
+template <class T>
+void Finger_EH<T>::Start_Migrator() {
+  if (migrator == nullptr) {
+    stop_migrator = false;
+    migrator = new std::thread(&Finger_EH<T>::Migrator_Loop, this);
+  }
+}
+
+template <class T>
+void Finger_EH<T>::Stop_Migrator() {
+  if (migrator != nullptr) {
+    STORE(&stop_migrator, true);
+    migrator->join();
+    delete migrator;
+    migrator = nullptr;
+  }
 }
 
 template <class T>
 void Finger_EH<T>::Directory_Update(Directory<T> *_sa, int x, Table<T> *new_b,
                                     Table<T> *old_b) {
+  /*the local depth of old_b is set rather than incremented, so this update can
+   * be redone on a newer directory without side effects*/
   Table<T> **dir_entry = _sa->_;
   auto global_depth = _sa->global_depth;
   unsigned depth_diff = global_depth - new_b->local_depth;
+  if (dram_directory) {
+    /*only the local depth is persistent, it orders the split for recovery*/
+    int begin = (x % 2 == 0) ? x + 1 : x;
+    int count = 1;
+    if (depth_diff != 0) {
+      int chunk_size = pow(2, global_depth - (new_b->local_depth - 1));
+      count = chunk_size / 2;
+      begin = x - (x % chunk_size) + count;
+    }
+    for (int i = count - 1; i >= 0; --i) {
+      dir_entry[begin + i] = reinterpret_cast<Table<T> *>(
+          reinterpret_cast<uint64_t>(new_b) | crash_version);
+    }
+    old_b->local_depth = new_b->local_depth;
+    Allocator::Persist(&old_b->local_depth, sizeof(old_b->local_depth));
+#ifdef COUNTING
+    if (depth_diff == 0) __sync_fetch_and_add(&_sa->depth_count, 2);
+#endif
+    return;
+  }
   if (depth_diff == 0) {
     if (x % 2 == 0) {
       TX_BEGIN(pool_addr) {
@@ -2125,7 +3595,7 @@ void Finger_EH<T>::Directory_Update(Directory<T> *_sa, int x, Table<T> *new_b,
                                     sizeof(old_b->local_depth));
         dir_entry[x + 1] = reinterpret_cast<Table<T> *>(
             reinterpret_cast<uint64_t>(new_b) | crash_version);
-        old_b->local_depth += 1;
+        old_b->local_depth = new_b->local_depth;
       }
       TX_ONABORT { std::cout << "Error for update txn" << std::endl; }
       TX_END
@@ -2136,7 +3606,7 @@ void Finger_EH<T>::Directory_Update(Directory<T> *_sa, int x, Table<T> *new_b,
                                     sizeof(old_b->local_depth));
         dir_entry[x] = reinterpret_cast<Table<T> *>(
             reinterpret_cast<uint64_t>(new_b) | crash_version);
-        old_b->local_depth += 1;
+        old_b->local_depth = new_b->local_depth;
       }
       TX_ONABORT { std::cout << "Error for update txn" << std::endl; }
       TX_END
@@ -2157,7 +3627,7 @@ void Finger_EH<T>::Directory_Update(Directory<T> *_sa, int x, Table<T> *new_b,
         dir_entry[x + base + i] = reinterpret_cast<Table<T> *>(
             reinterpret_cast<uint64_t>(new_b) | crash_version);
       }
-      old_b->local_depth += 1;
+      old_b->local_depth = new_b->local_depth;
     }
     TX_ONABORT { std::cout << "Error for update txn" << std::endl; }
     TX_END
@@ -2177,7 +3647,7 @@ void Finger_EH<T>::Directory_Merge_Update(Directory<T> *_sa, uint64_t key_hash,
 
   for (int i = right; i < right + chunk_size / 2; ++i) {
     dir_entry[i] = left_seg;
-    Allocator::Persist(&dir_entry[i], sizeof(uint64_t));
+    if (!dram_directory) Allocator::Persist(&dir_entry[i], sizeof(uint64_t));
   }
 
   if ((left_seg->local_depth + 1) == global_depth) {
@@ -2186,17 +3656,18 @@ void Finger_EH<T>::Directory_Merge_Update(Directory<T> *_sa, uint64_t key_hash,
 }
 
 template <class T>
-void Finger_EH<T>::recoverTable(Table<T> **target_table, size_t key_hash,
+bool Finger_EH<T>::recoverTable(Table<T> **target_table, size_t key_hash,
                                 size_t x, Directory<T> *old_sa) {
   /*Set the lockBit to ahieve the mutal exclusion of the recover process*/
   auto dir_entry = old_sa->_;
-  uint64_t snapshot = (uint64_t)*target_table;
+  uint64_t snapshot = (uint64_t)old_sa->Entry(x);
   Table<T> *target = (Table<T> *)(snapshot & tailMask);
   if (pmemobj_mutex_trylock(pool_addr, &target->lock_bit) != 0) {
-    return;
+    return false;
   }
 
-  target->recoverMetadata();
+  Recover_Metadata(target);
+  target->split_pending = 0;
   if (target->state != 0) {
     target->pattern = key_hash >> (8 * sizeof(key_hash) - target->local_depth);
     Allocator::Persist(&target->pattern, sizeof(target->pattern));
@@ -2204,11 +3675,11 @@ void Finger_EH<T>::recoverTable(Table<T> **target_table, size_t key_hash,
     if (target->state == -2) {
       if (next_table->state == -3) {
         /*Help finish the split operation*/
-        next_table->recoverMetadata();
+        Recover_Metadata(next_table);
         target->HelpSplit(next_table);
         Lock_Directory();
         auto x = (key_hash >> (8 * sizeof(key_hash) - dir->global_depth));
-        if (target->local_depth < dir->global_depth) {
+        if (next_table->local_depth <= dir->global_depth) {
           Directory_Update(dir, x, next_table, target);
         } else {
           Directory_Doubling(x, next_table, target);
@@ -2217,34 +3688,46 @@ void Finger_EH<T>::recoverTable(Table<T> **target_table, size_t key_hash,
         /*release the lock for the target bucket and the new bucket*/
         next_table->state = 0;
         Allocator::Persist(&next_table->state, sizeof(int));
+        if (segment_filters) next_table->Build_Filter();
       }
     } else if (target->state == -1) {
       if (next_table->pattern == ((target->pattern << 1) + 1)) {
         target->Merge(next_table, true);
         Allocator::Persist(target, sizeof(Table<T>));
         target->next = next_table->next;
+        filter::Retire(next_table->seg_filter);
         Allocator::Free(next_table);
       }
     }
     target->state = 0;
     Allocator::Persist(&target->state, sizeof(int));
   }
+  /*recoverMetadata may have dropped pairs, a redo may have moved pairs*/
+  if (segment_filters) target->Build_Filter();
 
   /*Compute for all entries and clear the dirty bit*/
   int chunk_size = pow(2, old_sa->global_depth - target->local_depth);
   x = x - (x % chunk_size);
   for (int i = x; i < (x + chunk_size); ++i) {
     dir_entry[i] = reinterpret_cast<Table<T> *>(
-        (reinterpret_cast<uint64_t>(dir_entry[i]) & tailMask) | crash_version);
+        (reinterpret_cast<uint64_t>(old_sa->Entry(i)) & tailMask) |
+        crash_version);
   }
   *target_table = reinterpret_cast<Table<T> *>(
       reinterpret_cast<uint64_t>(target) | crash_version);
+  return true;
 }
 
 template <class T>
 void Finger_EH<T>::Recovery() {
   /*scan the directory, set the clear bit, and also set the dirty bit in the
    * segment to indicate that this segment is clean*/
+  Reset_Resize_State();
+  if (dram_directory) {
+    Rebuild_Directory();
+    return;
+  }
+  Recover_Migration();
   if (clean) {
     clean = false;
     return;
@@ -2259,6 +3742,7 @@ void Finger_EH<T>::Recovery() {
   auto dir_entry = dir->_;
   int length = pow(2, dir->global_depth);
   crash_version = ((crash_version >> 56) + 1) << 56;
+  recovered_version = ~0UL; /*no crash version has these low bits*/
   if (crash_version == 0) {
     uint64_t set_one = 1UL << 56;
     for (int i = 0; i < length; ++i) {
@@ -2270,19 +3754,195 @@ void Finger_EH<T>::Recovery() {
   }
 }
 
+/* Walk the directory entries and recover the segments that still carry an
+ * old crash version, the same way the first access would. A segment whose
+ * split is finished here may double the directory, in which case the new
+ * directory is walked again.*/
 template <class T>
-int Finger_EH<T>::Insert(T key, Value_t value, bool is_in_epoch) {
-  if (!is_in_epoch) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
-    return Insert(key, value);
+void Finger_EH<T>::EagerRecovery(uint32_t num_threads) {
+  Directory<T> *sa;
+  do {
+    sa = dir;
+    auto global_depth = sa->global_depth;
+    recovery::Run("Dash-EH", 1UL << global_depth, num_threads,
+                  [&](uint64_t x) -> uint64_t {
+                    /*a doubling may retire sa meanwhile*/
+                    auto epoch_guard = Allocator::AquireEpochGuard();
+                    auto entry = reinterpret_cast<uint64_t>(sa->Entry(x));
+                    if ((entry & headerMask) == crash_version) return 0;
+                    uint64_t key_hash =
+                        global_depth == 0
+                            ? 0
+                            : x << (8 * sizeof(uint64_t) - global_depth);
+                    return recoverTable(&sa->_[x], key_hash, x, sa) ? 1 : 0;
+                  });
+  } while (dir != sa);
+  STORE(&recovered_version, crash_version);
+}
+
+/*the pattern of the segment of local depth depth that starts at first_hash*/
+inline uint64_t Prefix_Pattern(uint64_t first_hash, size_t depth) {
+  return depth == 0 ? 0 : first_hash >> (8 * sizeof(first_hash) - depth);
+}
+
+/* Finish the split or merge that seg was part of at the crash; first_hash is
+ * the smallest hash value that seg covers. The segment list stays sorted by
+ * hash through both: a split links the new segment right after seg and raises
+ * the local depth of seg once the split is done, a merge lowers the local
+ * depth of the left segment before its right neighbor is unlinked.*/
+template <class T>
+void Finger_EH<T>::Recover_Segment_State(Table<T> *seg, uint64_t first_hash) {
+  Table<T> *next_table = nullptr;
+  if (!OID_IS_NULL(seg->next)) {
+    next_table = reinterpret_cast<Table<T> *>(pmemobj_direct(seg->next));
+  }
+  auto pattern = Prefix_Pattern(first_hash, seg->local_depth);
+  if ((next_table != nullptr) &&
+      (next_table->local_depth == seg->local_depth + 1)) {
+    if (seg->state == -2 &&
+        (next_table->state == -2 || next_table->state == -3) &&
+        next_table->pattern != (pattern << 1) + 2 &&
+        next_table->pattern != (pattern << 2) + 4) {
+      /*next_table is the new segment of an unfinished split rather than a
+       * right neighbor that is splitting itself, whose pattern is valid*/
+      seg->pattern = pattern;
+      Recover_Metadata(seg);
+      Recover_Metadata(next_table);
+      seg->HelpSplit(next_table);
+      seg->local_depth = next_table->local_depth;
+      Allocator::Persist(&seg->local_depth, sizeof(seg->local_depth));
+      if (segment_filters) next_table->Build_Filter();
+    } else if (seg->state != -2 &&
+               next_table->pattern == (pattern << 1) + 1) {
+      /*next_table is the right half of a merge into seg*/
+      seg->pattern = pattern;
+      Recover_Metadata(seg);
+      seg->Merge(next_table, true);
+      Allocator::Persist(seg, sizeof(Table<T>));
+      seg->next = next_table->next;
+      Allocator::Persist(&seg->next, sizeof(seg->next));
+      if (segment_filters) seg->Build_Filter();
+      filter::Retire(next_table->seg_filter);
+      Allocator::Free(next_table);
+    }
+  }
+  pattern = Prefix_Pattern(first_hash, seg->local_depth);
+  if (seg->pattern != pattern) {
+    seg->pattern = pattern;
+    Allocator::Persist(&seg->pattern, sizeof(seg->pattern));
+  }
+  if (seg->state != 0) {
+    seg->state = 0;
+    Allocator::Persist(&seg->state, sizeof(seg->state));
+  }
+}
+
+/* Rebuild the DRAM directory from the segment list. The list is walked once
+ * to finish the splits and merges interrupted by a crash and to collect the
+ * segments, whose first hash values are the prefix sums of their sizes; the
+ * entries are then filled by several threads. After a crash the entries keep
+ * the previous crash version, so the lazy recovery of every segment still
+ * runs on its first access.*/
+template <class T>
+void Finger_EH<T>::Rebuild_Directory() {
+  auto start = std::chrono::steady_clock::now();
+  uint64_t entry_version = crash_version;
+  if (!clean) {
+    Allocator::EpochRecovery();
+    crash_version = ((crash_version >> 56) + 1) << 56;
+    recovered_version = ~0UL;
+  }
+  clean = false;
+  lock = 0;
+
+  std::vector<Table<T> *> segments;
+  std::vector<uint64_t> first_hashes;
+  uint64_t first_hash = 0;
+  size_t global_depth = 0;
+  auto curr = first_table;
+  while (curr != nullptr) {
+    Recover_Segment_State(curr, first_hash);
+    segments.push_back(curr);
+    first_hashes.push_back(first_hash);
+    if (curr->local_depth > global_depth) global_depth = curr->local_depth;
+    if (curr->local_depth != 0) {
+      first_hash += 1UL << (8 * sizeof(first_hash) - curr->local_depth);
+    }
+    curr = OID_IS_NULL(curr->next)
+               ? nullptr
+               : reinterpret_cast<Table<T> *>(pmemobj_direct(curr->next));
+  }
+  if (first_hash != 0) {
+    LOG_FATAL("Rebuild_Directory: the segments do not cover the hash space");
+  }
+
+  uint64_t capacity = 1UL << global_depth;
+  auto new_dir = Directory<T>::NewVolatile(capacity, 0);
+  uint32_t num_threads = std::thread::hardware_concurrency();
+  if (num_threads == 0) num_threads = 1;
+  uint64_t per_thread = (segments.size() + num_threads - 1) / num_threads;
+  std::vector<std::thread> fillers;
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    uint64_t begin = t * per_thread;
+    uint64_t end = std::min<uint64_t>(begin + per_thread, segments.size());
+    if (begin >= end) break;
+    fillers.emplace_back([&, begin, end]() {
+      uint32_t depth_count = 0;
+      for (uint64_t i = begin; i < end; ++i) {
+        auto seg = segments[i];
+        auto entry = reinterpret_cast<Table<T> *>(
+            reinterpret_cast<uint64_t>(seg) | entry_version);
+        uint64_t x = Prefix_Pattern(first_hashes[i], global_depth);
+        uint64_t chunk_size = 1UL << (global_depth - seg->local_depth);
+        for (uint64_t j = x; j < x + chunk_size; ++j) {
+          new_dir->_[j] = entry;
+        }
+        if (seg->local_depth == global_depth) depth_count++;
+      }
+      ADD(&new_dir->depth_count, depth_count);
+    });
+  }
+  for (auto &filler : fillers) filler.join();
+  dir = new_dir;
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  std::cout << "directory rebuild: segments = " << segments.size()
+            << ", global depth = " << global_depth
+            << ", threads = " << fillers.size()
+            << ", time = " << elapsed / 1000.0 << " ms" << std::endl;
+}
+
+template <class T>
+int Finger_EH<T>::Insert(T key, Value_t value, Session &session) {
+  session.Tick();
+  return Insert(key, value);
+}
+
+template <class T>
+int Finger_EH<T>::Insert(T key, Value_t value) {
+  cdc::Ordered<T> ordered(change_stream, key);
+  int ret;
+  if constexpr (!std::is_pointer<T>::value) {
+    if (hot_cache != nullptr) {
+      uint64_t key_hash = KeyHashProxy(key);
+      hot_cache->BeginWrite(key_hash);
+      ret = Insert_Pair(key, value);
+      hot_cache->EndWrite(key_hash);
+      if (ret == 0) ordered.Append(cdc::kInsert, value);
+      return ret;
+    }
   }
-
-  return Insert(key, value);
+  ret = Insert_Pair(key, value);
+  if (ret == 0) ordered.Append(cdc::kInsert, value);
+  return ret;
 }
 
 template <class T>
-int Finger_EH<T>::Insert(T key, Value_t value) {
-   uint64_t key_hash = KeyHashProxy<T>(key);
+int Finger_EH<T>::Insert_Pair(T key, Value_t value) {
+  key = StoreKey(key);
+  uint64_t key_hash = KeyHashProxy<T>(key);
 //  uint64_t key_hash;
 //  if constexpr (std::is_pointer<T>::value) {
 //    key_hash = h(key->key, key->length);
@@ -2291,111 +3951,191 @@ int Finger_EH<T>::Insert(T key, Value_t value) {
 //  }
 
   auto meta_hash = ((uint8_t)(key_hash & kMask));  // the last 8 bits
+  if (__atomic_load_n(&dir->prev, __ATOMIC_ACQUIRE) != nullptr) {
+    /*migrate one chunk of the ongoing doubling*/
+    Help_Directory_Copy();
+  }
+  bool combining = (publication != nullptr);
+  contention::Backoff backoff;
 RETRY:
   auto old_sa = dir;
   auto x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
   auto dir_entry = old_sa->_;
   Table<T> *target = reinterpret_cast<Table<T> *>(
-      reinterpret_cast<uint64_t>(dir_entry[x]) & tailMask);
+      reinterpret_cast<uint64_t>(old_sa->Entry(x)) & tailMask);
 
-  if ((reinterpret_cast<uint64_t>(dir_entry[x]) & headerMask) !=
+  if ((reinterpret_cast<uint64_t>(old_sa->Entry(x)) & headerMask) !=
       crash_version) {
     recoverTable(&dir_entry[x], key_hash, x, old_sa);
     goto RETRY;
   }
 
-  auto ret = target->Insert(key, value, key_hash, meta_hash, &dir);
+  int ret;
+  {
+    /*the split and the combining below still persist eagerly*/
+    durability::Deferred deferred(group_commit);
+    ret = target->Insert(key, value, key_hash, meta_hash, &dir, combining);
+  }
+  if (ret == -4) {
+    /*the bucket is hot, let the lock holder apply the insert*/
+    ret = Combine(target, combine::kOpInsert, key, value, key_hash);
+    if (ret == combine::kFallback) {
+      combining = false;
+      goto RETRY;
+    }
+  }
 
   if(ret == -3){ /*duplicate insert, insertion failure*/
+    ReleaseKey(key);
     return -1;
   }
 
   if (ret == -1) {
-    if (!target->bucket->try_get_lock()) {
-      goto RETRY;
-    }
+    Split_Table(target, key_hash);
+    goto RETRY;
+  } else if (ret == -2) {
+    backoff.Pause();
+    goto RETRY;
+  }
 
-    /*verify procedure*/
-    auto old_sa = dir;
-    auto x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
-    if (reinterpret_cast<Table<T> *>(reinterpret_cast<uint64_t>(old_sa->_[x]) &
-                                     tailMask) != target) /* verify process*/
-    {
-      target->bucket->release_lock();
-      goto RETRY;
+  if (combining) Help_Combine(target);
+  if ((ret == 1) && (split_service != nullptr) &&
+      (target->Stash_Count() >= split_high_water)) {
+    /*hand the segment to the split service, once*/
+    uint32_t idle = 0;
+    if (CAS(&target->split_pending, &idle, 1) &&
+        !split_service->Enqueue(key_hash)) {
+      STORE(&target->split_pending, 0);
     }
+  }
+  return 0;
+}
 
-    auto new_b =
-        target->Split(key_hash); /* also needs the verify..., and we use try
-                                    lock for this rather than the spin lock*/
-    /* update directory*/
-  REINSERT:
-    old_sa = dir;
-    dir_entry = old_sa->_;
-    x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
-    if (target->local_depth < old_sa->global_depth) {
-      if(!try_get_directory_read_lock()){
-        goto REINSERT;
-      }
-
-      if (old_sa->version != dir->version) {
-        // The directory has changed, thus need retry this update
-        release_directory_read_lock();
-        goto REINSERT;
-      }
+/*split target and publish the new segment in the directory; returns false if
+ * target is locked by another split or is no longer the owner of key_hash*/
+template <class T>
+bool Finger_EH<T>::Split_Table(Table<T> *target, uint64_t key_hash) {
+  if (!target->bucket->try_get_lock()) {
+    return false;
+  }
 
-      Directory_Update(old_sa, x, new_b, target);
-      release_directory_read_lock();
-    } else {
-      Lock_Directory();
-      if (old_sa->version != dir->version) {
-        Unlock_Directory();
-        goto REINSERT;
-      }
-      Directory_Doubling(x, new_b, target);
+  /*verify procedure*/
+  auto old_sa = dir;
+  auto x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
+  if (reinterpret_cast<Table<T> *>(reinterpret_cast<uint64_t>(old_sa->Entry(x)) &
+                                   tailMask) != target) /* verify process*/
+  {
+    target->bucket->release_lock();
+    return false;
+  }
+
+  pmstat::Scope split_scope(pmstat::kSplit);
+  auto new_b =
+      target->Split(key_hash); /* also needs the verify..., and we use try
+                                  lock for this rather than the spin lock*/
+  /* update directory*/
+REINSERT:
+  Wait_Directory_Unlock();
+  old_sa = dir;
+  x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
+  /*compare with the depth of new_b, the depth of target has already been
+   * raised if this is a redo*/
+  if (new_b->local_depth <= old_sa->global_depth) {
+    Directory_Update(old_sa, x, new_b, target);
+    if (Directory_Changed(old_sa)) {
+      // The directory may have been copied before the update landed
+      goto REINSERT;
+    }
+  } else {
+    Lock_Directory();
+    if (old_sa != dir) {
       Unlock_Directory();
+      goto REINSERT;
     }
+    Directory_Doubling(x, new_b, target);
+    Unlock_Directory();
+  }
 
-    /*release the lock for the target bucket and the new bucket*/
-    new_b->state = 0;
-    Allocator::Persist(&new_b->state, sizeof(int));
-    target->state = 0;
-    Allocator::Persist(&target->state, sizeof(int));
+  /*release the lock for the target bucket and the new bucket*/
+  new_b->state = 0;
+  Allocator::Flush(&new_b->state, sizeof(int));
+  target->state = 0;
+  Allocator::Persist(&target->state, sizeof(int));
 
-    Bucket<T> *curr_bucket;
-    for (int i = 0; i < kNumBucket; ++i) {
-      curr_bucket = target->bucket + i;
-      curr_bucket->release_lock();
-    }
-    curr_bucket = new_b->bucket;
+  Bucket<T> *curr_bucket;
+  for (int i = 0; i < kNumBucket; ++i) {
+    curr_bucket = target->bucket + i;
     curr_bucket->release_lock();
-    goto RETRY;
-  } else if (ret == -2) {
-    goto RETRY;
   }
+  curr_bucket = new_b->bucket;
+  curr_bucket->release_lock();
+  return true;
+}
 
-  return 0;
+/*run by the split service for a segment that crossed the high-water mark*/
+template <class T>
+bool Finger_EH<T>::Background_Split(uint64_t key_hash) {
+  auto epoch_guard = Allocator::AquireEpochGuard();
+  auto old_sa = dir;
+  auto x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
+  auto entry = reinterpret_cast<uint64_t>(old_sa->Entry(x));
+  if ((entry & headerMask) != crash_version) {
+    /*leave the lazy recovery of this segment to the foreground*/
+    return false;
+  }
+  auto target = reinterpret_cast<Table<T> *>(entry & tailMask);
+  if (target->Stash_Count() < split_high_water) {
+    /*already split, or drained by deletes*/
+    STORE(&target->split_pending, 0);
+    return false;
+  }
+  if (!Split_Table(target, key_hash)) {
+    /*busy, let a later insert queue it again*/
+    STORE(&target->split_pending, 0);
+    return false;
+  }
+  return true;
+}
+
+template <class T>
+Value_t Finger_EH<T>::Get(T key, Session &session) {
+  session.Tick();
+  return Get(key);
 }
 
 template <class T>
-Value_t Finger_EH<T>::Get(T key, bool is_in_epoch) {
-  if (!is_in_epoch) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
-    return Get(key);
+Value_t Finger_EH<T>::Get(T key) {
+  if constexpr (!std::is_pointer<T>::value) {
+    if (hot_cache != nullptr) {
+      uint64_t key_hash = KeyHashProxy(key);
+      Value_t value;
+      uint64_t tag;
+      if (hot_cache->Lookup(key, key_hash, &value, &tag)) return value;
+      value = Get_Pair(key);
+      hot_cache->Fill(key, key_hash, value, tag);
+      return value;
+    }
   }
-  uint64_t key_hash = KeyHashProxy<T>(key);
+  return Get_Pair(key);
+}
+
+template <class T>
+Value_t Finger_EH<T>::Get_Pair(T key) {
+  uint64_t key_hash = KeyHashProxy(key);
 //  if constexpr (std::is_pointer<T>::value) {
 //    key_hash = h(key->key, key->length);
 //  } else {
 //    key_hash = h(&key, sizeof(key));
 //  }
   auto meta_hash = ((uint8_t)(key_hash & kMask));  // the last 8 bits
+  contention::Backoff backoff;
 RETRY:
+  backoff.Retry(&contention::ContentionStats::reader_retries);
   auto old_sa = dir;
   auto x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
   auto y = BUCKET_INDEX(key_hash);
   auto dir_entry = old_sa->_;
-  auto old_entry = dir_entry[x];
+  auto old_entry = old_sa->Entry(x);
   Table<T> *target = reinterpret_cast<Table<T> *>(
       reinterpret_cast<uint64_t>(old_entry) & tailMask);
 
@@ -2404,6 +4144,14 @@ RETRY:
     goto RETRY;
   }
 
+  if (mirror::Mirrored(target)) {
+    Value_t value;
+    if (!Get_Mirrored(target, old_entry, key, key_hash, &value)) {
+      goto RETRY;
+    }
+    return value;
+  }
+
   Bucket<T> *target_bucket = target->bucket + y;
   Bucket<T> *neighbor_bucket = target->bucket + ((y + 1) & bucketMask);
 
@@ -2419,10 +4167,22 @@ RETRY:
   /*verification procedure*/
   old_sa = dir;
   x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
-  if (old_sa->_[x] != old_entry) {
+  if (old_sa->Entry(x) != old_entry) {
     goto RETRY;
   }
 
+  {
+    auto seg_filter = __atomic_load_n(&target->seg_filter, __ATOMIC_ACQUIRE);
+    if (seg_filter != nullptr && !seg_filter->Contains(key_hash)) {
+      /*a writer may have added the key after the versions were read*/
+      if (target_bucket->test_lock_version_change(old_version) ||
+          neighbor_bucket->test_lock_version_change(old_neighbor_version)) {
+        goto RETRY;
+      }
+      return NONE;
+    }
+  }
+
   auto ret = target_bucket->check_and_get(meta_hash, key, false);
   if (target_bucket->test_lock_version_change(old_version)) {
     goto RETRY;
@@ -2431,8 +4191,6 @@ RETRY:
     return ret;
   }
 
-  /*no need for verification procedure, we use the version number of
-   * target_bucket to test whether the bucket has ben spliteted*/
   ret = neighbor_bucket->check_and_get(meta_hash, key, true);
   if (neighbor_bucket->test_lock_version_change(old_neighbor_version)) {
     goto RETRY;
@@ -2510,146 +4268,179 @@ FINAL:
   return NONE;
 }
 
+/* Get_Pair on a mirrored segment: the versions and the metadata of the
+ * buckets are read from DRAM, PM only for the pairs whose fingerprint matches.
+ * Returns false if the caller has to retry.*/
 template <class T>
-Value_t Finger_EH<T>::Get(T key) {
-  uint64_t key_hash = KeyHashProxy(key);
-//  if constexpr (std::is_pointer<T>::value) {
-//    key_hash = h(key->key, key->length);
-//  } else {
-//    key_hash = h(&key, sizeof(key));
-//  }
-  auto meta_hash = ((uint8_t)(key_hash & kMask));  // the last 8 bits
-RETRY:
-  auto old_sa = dir;
-  auto x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
+bool Finger_EH<T>::Get_Mirrored(Table<T> *target, Table<T> *old_entry, T key,
+                                uint64_t key_hash, Value_t *value) {
+  auto meta_hash = ((uint8_t)(key_hash & kMask));
   auto y = BUCKET_INDEX(key_hash);
-  auto dir_entry = old_sa->_;
-  auto old_entry = dir_entry[x];
-  Table<T> *target = reinterpret_cast<Table<T> *>(
-      reinterpret_cast<uint64_t>(old_entry) & tailMask);
-
-  if ((reinterpret_cast<uint64_t>(old_entry) & headerMask) != crash_version) {
-    recoverTable(&dir_entry[x], key_hash, x, old_sa);
-    goto RETRY;
-  }
-
   Bucket<T> *target_bucket = target->bucket + y;
   Bucket<T> *neighbor_bucket = target->bucket + ((y + 1) & bucketMask);
+  auto target_meta = mirror::GetHeader(target_bucket);
+  auto neighbor_meta = mirror::GetHeader(neighbor_bucket);
 
   uint32_t old_version =
-      __atomic_load_n(&target_bucket->version_lock, __ATOMIC_ACQUIRE);
+      __atomic_load_n(&target_meta->version_lock, __ATOMIC_ACQUIRE);
   uint32_t old_neighbor_version =
-      __atomic_load_n(&neighbor_bucket->version_lock, __ATOMIC_ACQUIRE);
-
+      __atomic_load_n(&neighbor_meta->version_lock, __ATOMIC_ACQUIRE);
   if ((old_version & lockSet) || (old_neighbor_version & lockSet)) {
-    goto RETRY;
+    return false;
   }
 
   /*verification procedure*/
-  old_sa = dir;
-  x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
-  if (old_sa->_[x] != old_entry) {
-    goto RETRY;
+  auto old_sa = dir;
+  auto x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
+  if (old_sa->Entry(x) != old_entry) {
+    return false;
   }
 
-  auto ret = target_bucket->check_and_get(meta_hash, key, false);
-  if (target_bucket->test_lock_version_change(old_version)) {
-    goto RETRY;
+  *value = target_bucket->check_and_get(target_meta->finger_array,
+                                        target_meta->bitmap, meta_hash, key,
+                                        false);
+  if (__atomic_load_n(&target_meta->version_lock, __ATOMIC_ACQUIRE) !=
+      old_version) {
+    return false;
   }
-  if (ret != NONE) {
-    return ret;
+  if (*value != NONE) {
+    return true;
   }
 
-  ret = neighbor_bucket->check_and_get(meta_hash, key, true);
-  if (neighbor_bucket->test_lock_version_change(old_neighbor_version)) {
-    goto RETRY;
+  *value = neighbor_bucket->check_and_get(neighbor_meta->finger_array,
+                                          neighbor_meta->bitmap, meta_hash,
+                                          key, true);
+  if (__atomic_load_n(&neighbor_meta->version_lock, __ATOMIC_ACQUIRE) !=
+      old_neighbor_version) {
+    return false;
   }
-  if (ret != NONE) {
-    return ret;
+  if (*value != NONE) {
+    return true;
   }
 
-  if (target_bucket->test_stash_check()) {
-    auto test_stash = false;
-    if (target_bucket->test_overflow()) {
-      /*this only occur when the bucket has more key-values than 10 that are
-       * overfloed int he shared bucket area, therefore it needs to search in
-       * the extra bucket*/
-      test_stash = true;
+  if (target_meta->overflowBitmap & overflowSet) {
+    /*the stash buckets that may hold the key, in the order of Get_Pair*/
+    uint32_t candidates = 0;
+    if (target_meta->overflowCount) {
+      candidates = (1 << stashBucket) - 1;
     } else {
-      /*search in the original bucket*/
-      int mask = target_bucket->overflowBitmap & overflowBitmapMask;
-      if (mask != 0) {
-        for (int i = 0; i < 4; ++i) {
-          if (CHECK_BIT(mask, i) &&
-              (target_bucket->finger_array[14 + i] == meta_hash) &&
-              (((1 << i) & target_bucket->overflowMember) == 0)) {
-            Bucket<T> *stash =
-                target->bucket + kNumBucket +
-                ((target_bucket->overflowIndex >> (i * 2)) & stashMask);
-            auto ret = stash->check_and_get(meta_hash, key, false);
-            if (ret != NONE) {
-              if (target_bucket->test_lock_version_change(old_version)) {
-                goto RETRY;
-              }
-              return ret;
-            }
-          }
+      int mask = target_meta->overflowBitmap & overflowBitmapMask;
+      for (int i = 0; i < 4; ++i) {
+        if (CHECK_BIT(mask, i) &&
+            (target_meta->finger_array[14 + i] == meta_hash) &&
+            (((1 << i) & target_meta->overflowMember) == 0)) {
+          candidates |= 1 << ((target_meta->overflowIndex >> (i * 2)) &
+                              stashMask);
         }
       }
-
-      mask = neighbor_bucket->overflowBitmap & overflowBitmapMask;
-      if (mask != 0) {
-        for (int i = 0; i < 4; ++i) {
-          if (CHECK_BIT(mask, i) &&
-              (neighbor_bucket->finger_array[14 + i] == meta_hash) &&
-              (((1 << i) & neighbor_bucket->overflowMember) != 0)) {
-            Bucket<T> *stash =
-                target->bucket + kNumBucket +
-                ((neighbor_bucket->overflowIndex >> (i * 2)) & stashMask);
-            auto ret = stash->check_and_get(meta_hash, key, false);
-            if (ret != NONE) {
-              if (target_bucket->test_lock_version_change(old_version)) {
-                goto RETRY;
-              }
-              return ret;
-            }
-          }
+      mask = neighbor_meta->overflowBitmap & overflowBitmapMask;
+      for (int i = 0; i < 4; ++i) {
+        if (CHECK_BIT(mask, i) &&
+            (neighbor_meta->finger_array[14 + i] == meta_hash) &&
+            (((1 << i) & neighbor_meta->overflowMember) != 0)) {
+          candidates |= 1 << ((neighbor_meta->overflowIndex >> (i * 2)) &
+                              stashMask);
         }
       }
-      goto FINAL;
     }
-  TEST_STASH:
-    if (test_stash == true) {
-      for (int i = 0; i < stashBucket; ++i) {
-        Bucket<T> *stash =
-            target->bucket + kNumBucket + ((i + (y & stashMask)) & stashMask);
-        auto ret = stash->check_and_get(meta_hash, key, false);
-        if (ret != NONE) {
-          if (target_bucket->test_lock_version_change(old_version)) {
-            goto RETRY;
-          }
-          return ret;
-        }
+    for (int i = 0; i < stashBucket; ++i) {
+      if (!CHECK_BIT(candidates, i)) continue;
+      Bucket<T> *stash = target->bucket + kNumBucket + i;
+      auto stash_meta = mirror::GetHeader(stash);
+      *value = stash->check_and_get(stash_meta->finger_array,
+                                    stash_meta->bitmap, meta_hash, key, false);
+      if (*value != NONE) {
+        /*stash buckets are written under the lock of the target bucket*/
+        return __atomic_load_n(&target_meta->version_lock,
+                               __ATOMIC_ACQUIRE) == old_version;
       }
     }
   }
-FINAL:
-  return NONE;
+  *value = NONE;
+  return true;
+}
+
+/*sync the mirror of every segment, called before any operation starts*/
+template <class T>
+void Finger_EH<T>::EnableBucketMirror(size_t pool_size) {
+  if (mirror::Enabled()) return;
+  mirror::Initialize(::pool_addr, pool_size);
+  auto curr = first_table;
+  while (true) {
+    curr->Sync_Mirror();
+    if (OID_IS_NULL(curr->next)) break;
+    curr = reinterpret_cast<Table<T> *>(pmemobj_direct(curr->next));
+  }
+}
+
+template <class T>
+void Finger_EH<T>::Report_Bucket_Mirror() {
+  uint64_t segments = 0;
+  uint64_t mirrored = 0;
+  auto curr = first_table;
+  while (true) {
+    segments++;
+    if (mirror::Mirrored(curr)) mirrored++;
+    if (OID_IS_NULL(curr->next)) break;
+    curr = reinterpret_cast<Table<T> *>(pmemobj_direct(curr->next));
+  }
+  mirror::Report(segments, mirrored, kNumBucket + stashBucket);
 }
 
+/* A checkpoint walks the segment list, so no segment may be freed under it;
+ * a merge triggered meanwhile runs once the last checkpoint ended*/
 template <class T>
 void Finger_EH<T>::TryMerge(size_t key_hash) {
+  ADD(&merges, 1);
+  if (LOAD(&checkpoints) == 0) {
+    Merge_Segments(key_hash);
+  } else {
+    Defer_Merge(key_hash);
+  }
+  SUB(&merges, 1);
+}
+
+/* Only the segment that key_hash falls in matters, so the lowest bit marks a
+ * taken slot. With every slot taken the merge is dropped, as if the segment
+ * had not run empty; its next delete that empties it merges it*/
+template <class T>
+void Finger_EH<T>::Defer_Merge(size_t key_hash) {
+  uint64_t tag = key_hash | 1;
+  for (uint32_t i = 0; i < kDeferredMerges; ++i) {
+    uint64_t empty = 0;
+    if (!CAS(&deferred_merges[i], &empty, tag)) continue;
+    /*the checkpoint may have ended and run the deferred merges already*/
+    if (LOAD(&checkpoints) == 0 && CAS(&deferred_merges[i], &tag, 0)) {
+      Merge_Segments(key_hash);
+    }
+    return;
+  }
+}
+
+/*Merge_Segments checks again that one of the two segments is empty*/
+template <class T>
+void Finger_EH<T>::Run_Deferred_Merges() {
+  /*the merges retire segments, and this runs in the checkpoint caller*/
+  auto epoch_guard = Allocator::AquireEpochGuard();
+  for (uint32_t i = 0; i < kDeferredMerges; ++i) {
+    uint64_t tag = __atomic_exchange_n(&deferred_merges[i], 0, __ATOMIC_SEQ_CST);
+    if (tag != 0) TryMerge(tag);
+  }
+}
+
+template <class T>
+void Finger_EH<T>::Merge_Segments(size_t key_hash) {
   /*Compute the left segment and right segment*/
   do {
     auto old_dir = dir;
     auto x = (key_hash >> (8 * sizeof(key_hash) - old_dir->global_depth));
-    auto target = old_dir->_[x];
+    auto target = old_dir->Entry(x);
     int chunk_size = pow(2, old_dir->global_depth - (target->local_depth - 1));
     assert(chunk_size >= 2);
     int left = x - (x % chunk_size);
     int right = left + chunk_size / 2;
-    auto left_seg = old_dir->_[left];
-    auto right_seg = old_dir->_[right];
+    auto left_seg = old_dir->Entry(left);
+    auto right_seg = old_dir->Entry(right);
 
     if ((reinterpret_cast<uint64_t>(left_seg) & headerMask) != crash_version) {
       recoverTable(&old_dir->_[left], key_hash, left, old_dir);
@@ -2683,6 +4474,7 @@ void Finger_EH<T>::TryMerge(size_t key_hash) {
         }
         left_seg->Acquire_remaining_locks();
         right_seg->Acquire_remaining_locks();
+        pmstat::Scope merge_scope(pmstat::kMerge);
 
         /*First improve the local depth, */
         left_seg->local_depth = left_seg->local_depth - 1;
@@ -2692,21 +4484,22 @@ void Finger_EH<T>::TryMerge(size_t key_hash) {
         right_seg->state = -1;
         Allocator::Persist(&right_seg->state, sizeof(int));
       REINSERT:
-        old_dir = dir;
         /*Update the directory from left to right*/
-        while (Test_Directory_Lock_Set()) {
-          asm("nop");
-        }
+        Wait_Directory_Unlock();
+        old_dir = dir;
         /*start the merge operation*/
         Directory_Merge_Update(old_dir, key_hash, left_seg);
 
-        if (Test_Directory_Lock_Set() || old_dir->version != dir->version) {
+        if (Directory_Changed(old_dir)) {
           goto REINSERT;
         }
 
         if (right_seg->number != 0) {
           left_seg->Merge(right_seg);
         }
+        /*rebuilt rather than merged to shed the bits of deleted pairs*/
+        if (left_seg->seg_filter != nullptr) left_seg->Build_Filter();
+        filter::Retire(right_seg->seg_filter);
         auto reserve_item = Allocator::ReserveItem();
         TX_BEGIN(pool_addr) {
           pmemobj_tx_add_range_direct(reserve_item, sizeof(*reserve_item));
@@ -2748,17 +4541,33 @@ void Finger_EH<T>::TryMerge(size_t key_hash) {
 }
 
 template <class T>
-bool Finger_EH<T>::Delete(T key, bool is_in_epoch) {
-  if (!is_in_epoch) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
-    return Delete(key);
-  }
+bool Finger_EH<T>::Delete(T key, Session &session) {
+  session.Tick();
   return Delete(key);
 }
 
 /*By default, the merge operation is disabled*/
 template <class T>
 bool Finger_EH<T>::Delete(T key) {
+  cdc::Ordered<T> ordered(change_stream, key);
+  bool ret;
+  if constexpr (!std::is_pointer<T>::value) {
+    if (hot_cache != nullptr) {
+      uint64_t key_hash = KeyHashProxy(key);
+      hot_cache->BeginWrite(key_hash);
+      ret = Delete_Pair(key);
+      hot_cache->EndWrite(key_hash);
+      if (ret) ordered.Append(cdc::kDelete, NONE);
+      return ret;
+    }
+  }
+  ret = Delete_Pair(key);
+  if (ret) ordered.Append(cdc::kDelete, NONE);
+  return ret;
+}
+
+template <class T>
+bool Finger_EH<T>::Delete_Pair(T key) {
   /*Basic delete operation and merge operation*/
   uint64_t key_hash = KeyHashProxy(key);
 //  if constexpr (std::is_pointer<T>::value) {
@@ -2767,14 +4576,16 @@ bool Finger_EH<T>::Delete(T key) {
 //    key_hash = h(&key, sizeof(key));
 //  }
   auto meta_hash = ((uint8_t)(key_hash & kMask));  // the last 8 bits
+  bool combining = (publication != nullptr);
+  contention::Backoff backoff;
 RETRY:
   auto old_sa = dir;
   auto x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
   auto dir_entry = old_sa->_;
   Table<T> *target_table = reinterpret_cast<Table<T> *>(
-      reinterpret_cast<uint64_t>(dir_entry[x]) & tailMask);
+      reinterpret_cast<uint64_t>(old_sa->Entry(x)) & tailMask);
 
-  if ((reinterpret_cast<uint64_t>(dir_entry[x]) & headerMask) !=
+  if ((reinterpret_cast<uint64_t>(old_sa->Entry(x)) & headerMask) !=
       crash_version) {
     recoverTable(&dir_entry[x], key_hash, x, old_sa);
     goto RETRY;
@@ -2784,23 +4595,42 @@ RETRY:
   auto y = BUCKET_INDEX(key_hash);
   Bucket<T> *target = target_table->bucket + y;
   Bucket<T> *neighbor = target_table->bucket + ((y + 1) & bucketMask);
-  target->get_lock();
-  if (!neighbor->try_get_lock()) {
-    target->release_lock();
-    goto RETRY;
+  if (combining) {
+    bool locked = target->try_get_lock();
+    if (locked && !neighbor->try_get_lock()) {
+      target->release_lock();
+      locked = false;
+    }
+    if (!locked) {
+      /*the bucket is hot, let the lock holder apply the delete*/
+      auto ret =
+          Combine(target_table, combine::kOpDelete, key, NONE, key_hash);
+      if (ret != combine::kFallback) return ret == 1;
+      combining = false;
+      goto RETRY;
+    }
+  } else {
+    target->get_lock();
+    if (!neighbor->try_get_lock()) {
+      target->release_lock();
+      backoff.Spin(&contention::ContentionStats::trylock_failures);
+      goto RETRY;
+    }
   }
 
   old_sa = dir;
   x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
-  if (reinterpret_cast<Table<T> *>(reinterpret_cast<uint64_t>(old_sa->_[x]) &
+  if (reinterpret_cast<Table<T> *>(reinterpret_cast<uint64_t>(old_sa->Entry(x)) &
                                    tailMask) != target_table) {
     target->release_lock();
     neighbor->release_lock();
     goto RETRY;
   }
 
-  auto ret = target->Delete(key, meta_hash, false);
+  T stored_key;
+  auto ret = target->Delete(key, meta_hash, false, &stored_key);
   if (ret == 0) {
+    RetireKey(stored_key);
 #ifdef COUNTING
     auto num = SUB(&target_table->number, 1);
 #endif
@@ -2814,11 +4644,13 @@ RETRY:
       TryMerge(key_hash);
     }
 #endif
+    if (combining) Help_Combine(target_table);
     return true;
   }
 
-  ret = neighbor->Delete(key, meta_hash, true);
+  ret = neighbor->Delete(key, meta_hash, true, &stored_key);
   if (ret == 0) {
+    RetireKey(stored_key);
 #ifdef COUNTING
     auto num = SUB(&target_table->number, 1);
 #endif
@@ -2832,6 +4664,7 @@ RETRY:
       TryMerge(key_hash);
     }
 #endif
+    if (combining) Help_Combine(target_table);
     return true;
   }
 
@@ -2876,8 +4709,10 @@ RETRY:
       for (int i = 0; i < stashBucket; ++i) {
         int index = ((i + (y & stashMask)) & stashMask);
         Bucket<T> *curr_stash = target_table->bucket + kNumBucket + index;
-        auto ret = curr_stash->Delete(key, meta_hash, false);
+        auto ret = curr_stash->Delete(key, meta_hash, false, &stored_key);
         if (ret == 0) {
+          RetireKey(stored_key);
+          mirror::Copy(curr_stash);
           /*need to unset indicator in original bucket*/
           stash->release_lock();
 #ifdef PMEM
@@ -2908,6 +4743,62 @@ RETRY:
   return false;
 }
 
+/*used by the key arena compactor, the key is identified by its address*/
+template <class T>
+bool Finger_EH<T>::ReplaceKey(T old_key, T new_key) {
+  uint64_t key_hash = KeyHashProxy(old_key);
+  auto meta_hash = ((uint8_t)(key_hash & kMask));  // the last 8 bits
+  contention::Backoff backoff;
+RETRY:
+  auto old_sa = dir;
+  auto x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
+  auto dir_entry = old_sa->_;
+  Table<T> *target_table = reinterpret_cast<Table<T> *>(
+      reinterpret_cast<uint64_t>(old_sa->Entry(x)) & tailMask);
+
+  if ((reinterpret_cast<uint64_t>(old_sa->Entry(x)) & headerMask) !=
+      crash_version) {
+    recoverTable(&dir_entry[x], key_hash, x, old_sa);
+    goto RETRY;
+  }
+
+  auto y = BUCKET_INDEX(key_hash);
+  Bucket<T> *target = target_table->bucket + y;
+  Bucket<T> *neighbor = target_table->bucket + ((y + 1) & bucketMask);
+  target->get_lock();
+  if (!neighbor->try_get_lock()) {
+    target->release_lock();
+    backoff.Spin(&contention::ContentionStats::trylock_failures);
+    goto RETRY;
+  }
+
+  old_sa = dir;
+  x = (key_hash >> (8 * sizeof(key_hash) - old_sa->global_depth));
+  if (reinterpret_cast<Table<T> *>(reinterpret_cast<uint64_t>(old_sa->Entry(x)) &
+                                   tailMask) != target_table) {
+    target->release_lock();
+    neighbor->release_lock();
+    goto RETRY;
+  }
+
+  bool found = (target->Replace(old_key, new_key, meta_hash, false) == 0) ||
+               (neighbor->Replace(old_key, new_key, meta_hash, true) == 0);
+  if (!found && target->test_stash_check()) {
+    Bucket<T> *stash = target_table->bucket + kNumBucket;
+    stash->get_lock();
+    for (int i = 0; i < stashBucket; ++i) {
+      if ((stash + i)->Replace(old_key, new_key, meta_hash, false) == 0) {
+        found = true;
+        break;
+      }
+    }
+    stash->release_lock();
+  }
+  neighbor->release_lock();
+  target->release_lock();
+  return found;
+}
+
 /*DEBUG FUNCTION: search the position of the key in this table and print
  * correspongdign informantion in this table, to test whether it is correct*/
 
@@ -2932,7 +4823,7 @@ int Finger_EH<T>::FindAnyway(T key) {
   size_t depth_diff;
   int capacity = pow(2, global_depth);
   for (int i = 0; i < capacity;) {
-    ss = dir_entry[i];
+    ss = seg->Entry(i);
     Bucket<T> *curr_bucket;
     for (int j = 0; j < kNumBucket; ++j) {
       curr_bucket = ss->bucket + j;
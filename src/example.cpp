@@ -44,19 +44,18 @@ int main() {
   // Step 4: Operate on the hash table
   // If using multi-threads, we need to use epoch for correct memory
   // reclamation; To make it simple, this example program only use one thread
-  // but we still show how to use epoch mechanism; We enter into the epoch for
-  // every 1024 operations to reduce the overhead; The following example inserts
+  // but we still show how to use epoch mechanism; Each thread opens one
+  // session which keeps it in the epoch and refreshes the epoch every 1024
+  // operations to reduce the overhead; The following example inserts
   // 1024 * 1024 key-value pairs to the table, and then do the search and
   // delete operations
+  Session session(1024);
 
   // Insert
   int already_exists = 0;
   for (uint64_t i = 0; i < 1024; ++i) {
-    // Enroll into the epoch, if using one thread, epoch mechanism is actually
-    // not needed
-    auto epoch_guard = Allocator::AquireEpochGuard();
     for (uint64_t j = 0; j < 1024; ++j) {
-      auto ret = hash_table->Insert(i * 1024 + j, DEFAULT, true);
+      auto ret = hash_table->Insert(i * 1024 + j, DEFAULT, session);
       if (ret == -1) already_exists++;
     }
   }
@@ -66,11 +65,8 @@ int main() {
   // Duplicate insert
   already_exists = 0;
   for (uint64_t i = 0; i < 1024; ++i) {
-    // Enroll into the epoch, if using one thread, epoch mechanism is actually
-    // not needed
-    auto epoch_guard = Allocator::AquireEpochGuard();
     for (uint64_t j = 0; j < 1024; ++j) {
-      auto ret = hash_table->Insert(i * 1024 + j, DEFAULT, true);
+      auto ret = hash_table->Insert(i * 1024 + j, DEFAULT, session);
       if (ret == -1) already_exists++;
     }
   }
@@ -80,9 +76,8 @@ int main() {
   // Search
   uint64_t not_found = 0;
   for (uint64_t i = 0; i < 1024; ++i) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
     for (uint64_t j = 0; j < 1024; ++j) {
-      if (hash_table->Get(i * 1024 + j, true) == NONE) {
+      if (hash_table->Get(i * 1024 + j, session) == NONE) {
         not_found++;
       }
     }
@@ -91,9 +86,8 @@ int main() {
 
   // Delete
   for (uint64_t i = 0; i < 1024; ++i) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
     for (uint64_t j = 0; j < 1024; ++j) {
-      hash_table->Delete(i * 1024 + j, true);
+      hash_table->Delete(i * 1024 + j, session);
     }
   }
 
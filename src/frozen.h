@@ -0,0 +1,364 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Frozen snapshots of a Dash-EH index: an immutable file that is mapped and
+// served as is, without locks, versions or epochs. The file keeps the shape of
+// the index: the directory maps the top bits of a hash to a segment, and the
+// pairs of every segment are grouped by the bucket their hash selects, so a
+// lookup reads one directory entry, the bounds of one bucket and scans its
+// fingerprints. Unlike a live segment a frozen bucket has no capacity, a pair
+// is always in the bucket it hashes to and there is no stash.
+//   FileHeader
+//   directory  uint32_t[1 << global_depth], the segment of each entry
+//   starts     uint64_t[segments * kBuckets + 1], first slot of each bucket
+//   fingers    uint8_t[pairs]
+//   slots      Slot[pairs]
+//   keys       the records of variable-length keys: uint32_t length, bytes
+// every region padded to 8 bytes. The header is written last, so a file whose
+// conversion did not finish has no valid magic.
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../util/hash.h"
+#include "../util/pair.h"
+#include "Hash.h"
+
+namespace frozen {
+
+constexpr uint64_t kMagic = 0x4e5a524648534144ull; /*"DASHFRZN"*/
+constexpr uint32_t kFormatVersion = 1;
+constexpr uint64_t kAlign = 4096;
+constexpr uint32_t kFixedKeys = 1; /*otherwise the keys are string_key*/
+constexpr uint32_t kFingerBits = 8;
+constexpr uint64_t kBuckets = 64;
+
+struct FileHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t global_depth;
+  uint32_t segments;
+  uint64_t pairs;
+  /*offsets of the regions in the file*/
+  uint64_t directory;
+  uint64_t starts;
+  uint64_t fingers;
+  uint64_t slots;
+  uint64_t keys;
+  uint64_t bytes; /*end of the file*/
+};
+static_assert(sizeof(FileHeader) <= kAlign, "the header fits its block");
+
+/*key is the key itself, or the offset of its record in the keys region*/
+struct Slot {
+  uint64_t key;
+  Value_t value;
+};
+
+inline uint64_t Pad(uint64_t size, uint64_t align = 8) {
+  return (size + align - 1) & ~(align - 1);
+}
+
+inline uint64_t Record_Size(uint32_t length) {
+  return Pad(sizeof(uint32_t) + length);
+}
+
+inline uint64_t Bucket_Of(uint64_t key_hash) {
+  return (key_hash >> kFingerBits) & (kBuckets - 1);
+}
+
+inline uint8_t Finger_Of(uint64_t key_hash) {
+  return key_hash & ((1 << kFingerBits) - 1);
+}
+
+template <class T>
+inline uint64_t Key_Hash(T key) {
+  if constexpr (std::is_pointer<T>::value) {
+    return h(key->key, key->length);
+  } else {
+    return h(&key, sizeof(key));
+  }
+}
+
+/*the pairs of one segment, staged by the segment like a checkpoint sink*/
+template <class T>
+struct Staged {
+  std::vector<std::pair<T, Value_t>> pairs;
+
+  void Stage(T key, Value_t value) { pairs.emplace_back(key, value); }
+
+  uint64_t Key_Bytes() {
+    uint64_t size = 0;
+    if constexpr (std::is_pointer<T>::value) {
+      for (auto &pair : pairs) size += Record_Size(pair.first->length);
+    }
+    return size;
+  }
+};
+
+/* Writes a frozen file. The size of every segment is known up front, so the
+ * file is laid out at once and the segments are filled in place by any
+ * number of threads, each segment by one of them.*/
+template <class T>
+class Builder {
+ public:
+  Builder(const char *path, uint32_t global_depth,
+          const std::vector<uint32_t> &directory,
+          const std::vector<uint64_t> &pairs,
+          const std::vector<uint64_t> &key_bytes)
+      : start_(std::chrono::steady_clock::now()) {
+    uint32_t segments = pairs.size();
+    pair_base_.resize(segments + 1);
+    key_base_.resize(segments + 1);
+    uint64_t total_pairs = 0;
+    uint64_t total_key_bytes = 0;
+    for (uint32_t s = 0; s < segments; ++s) {
+      pair_base_[s] = total_pairs;
+      key_base_[s] = total_key_bytes;
+      total_pairs += pairs[s];
+      total_key_bytes += key_bytes[s];
+    }
+    pair_base_[segments] = total_pairs;
+    key_base_[segments] = total_key_bytes;
+
+    memset(&header_, 0, sizeof(header_));
+    header_.version = kFormatVersion;
+    header_.flags = std::is_pointer<T>::value ? 0 : kFixedKeys;
+    header_.global_depth = global_depth;
+    header_.segments = segments;
+    header_.pairs = total_pairs;
+    header_.directory = kAlign;
+    header_.starts =
+        header_.directory + Pad(directory.size() * sizeof(uint32_t));
+    header_.fingers =
+        header_.starts + (segments * kBuckets + 1) * sizeof(uint64_t);
+    header_.slots = header_.fingers + Pad(total_pairs);
+    header_.keys = header_.slots + total_pairs * sizeof(Slot);
+    header_.bytes = header_.keys + total_key_bytes;
+
+    file_ = nullptr;
+    fd_ = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0 || ftruncate(fd_, header_.bytes) != 0) {
+      std::cout << "failed to create the frozen snapshot " << path
+                << std::endl;
+      return;
+    }
+    auto file = mmap(nullptr, header_.bytes, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd_, 0);
+    if (file == MAP_FAILED) {
+      std::cout << "failed to map the frozen snapshot " << path << std::endl;
+      return;
+    }
+    file_ = reinterpret_cast<char *>(file);
+    memcpy(file_ + header_.directory, directory.data(),
+           directory.size() * sizeof(uint32_t));
+    Starts()[segments * kBuckets] = total_pairs;
+  }
+
+  ~Builder() {
+    if (file_ != nullptr) munmap(file_, header_.bytes);
+    if (fd_ >= 0) close(fd_);
+  }
+
+  bool Ok() { return file_ != nullptr; }
+
+  /* lay out the pairs of segment s by bucket, then by the order staged; a
+   * segment that no longer has the size it was laid out with is rejected,
+   * and with it the whole file*/
+  bool Fill(uint32_t s, const std::vector<std::pair<T, Value_t>> &pairs) {
+    uint64_t base = pair_base_[s];
+    uint64_t key_offset = key_base_[s];
+    uint64_t key_bytes = 0;
+    if constexpr (std::is_pointer<T>::value) {
+      for (auto &pair : pairs) key_bytes += Record_Size(pair.first->length);
+    }
+    if (pairs.size() != pair_base_[s + 1] - base ||
+        key_bytes != key_base_[s + 1] - key_offset) {
+      changed_.store(true);
+      return false;
+    }
+    uint64_t next[kBuckets + 1];
+    memset(next, 0, sizeof(next));
+    hashes_.resize(pairs.size());
+    for (uint64_t i = 0; i < pairs.size(); ++i) {
+      hashes_[i] = Key_Hash(pairs[i].first);
+      next[Bucket_Of(hashes_[i]) + 1]++;
+    }
+    auto starts = Starts() + s * kBuckets;
+    for (uint64_t b = 0; b < kBuckets; ++b) {
+      next[b + 1] += next[b];
+      starts[b] = base + next[b];
+    }
+
+    auto fingers = reinterpret_cast<uint8_t *>(file_ + header_.fingers);
+    auto slots = reinterpret_cast<Slot *>(file_ + header_.slots);
+    for (uint64_t i = 0; i < pairs.size(); ++i) {
+      uint64_t slot = base + next[Bucket_Of(hashes_[i])]++;
+      fingers[slot] = Finger_Of(hashes_[i]);
+      slots[slot].value = pairs[i].second;
+      if constexpr (std::is_pointer<T>::value) {
+        auto record = file_ + header_.keys + key_offset;
+        uint32_t length = pairs[i].first->length;
+        memcpy(record, &length, sizeof(length));
+        memcpy(record + sizeof(length), pairs[i].first->key, length);
+        slots[slot].key = key_offset;
+        key_offset += Record_Size(length);
+      } else {
+        slots[slot].key = pairs[i].first;
+      }
+    }
+    return true;
+  }
+
+  /*make the file durable with its header last, returns the number of pairs*/
+  uint64_t Finish(const char *index) {
+    if (file_ == nullptr) return 0;
+    if (changed_.load()) {
+      std::cout << index << " freeze: a segment changed while it was frozen"
+                << std::endl;
+      return 0;
+    }
+    msync(file_, header_.bytes, MS_SYNC);
+    header_.magic = kMagic;
+    memcpy(file_, &header_, sizeof(header_));
+    msync(file_, kAlign, MS_SYNC);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count();
+    std::cout << index << " freeze: pairs = " << header_.pairs
+              << ", segments = " << header_.segments
+              << ", bytes = " << header_.bytes
+              << ", time = " << elapsed / 1000.0 << " ms" << std::endl;
+    return header_.pairs;
+  }
+
+ private:
+  uint64_t *Starts() {
+    return reinterpret_cast<uint64_t *>(file_ + header_.starts);
+  }
+
+  FileHeader header_;
+  int fd_;
+  char *file_;
+  std::vector<uint64_t> pair_base_;
+  std::vector<uint64_t> key_base_;
+  std::atomic<bool> changed_{false}; /*a Fill was rejected*/
+  static thread_local std::vector<uint64_t> hashes_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+template <class T>
+thread_local std::vector<uint64_t> Builder<T>::hashes_;
+
+/* A frozen file opened read-only. Lookups only read the mapping, so any
+ * number of threads run them without synchronization; inserts and deletes
+ * are refused.*/
+template <class T>
+class Snapshot : public Hash<T> {
+ public:
+  /*null if path is not a frozen snapshot of keys of type T; populate
+   * prefaults the whole mapping instead of on first touch*/
+  static Snapshot *Open(const char *path, bool populate = false) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        (uint64_t)st.st_size < sizeof(FileHeader)) {
+      std::cout << "failed to open the frozen snapshot " << path << std::endl;
+      if (fd >= 0) close(fd);
+      return nullptr;
+    }
+    auto file = mmap(nullptr, st.st_size, PROT_READ,
+                     MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+      std::cout << "failed to map the frozen snapshot " << path << std::endl;
+      return nullptr;
+    }
+    auto header = reinterpret_cast<const FileHeader *>(file);
+    if (header->magic != kMagic || header->version != kFormatVersion ||
+        ((header->flags & kFixedKeys) != 0) == std::is_pointer<T>::value ||
+        header->bytes > (uint64_t)st.st_size || header->global_depth >= 32) {
+      std::cout << "not a frozen snapshot of this key type: " << path
+                << std::endl;
+      munmap(file, st.st_size);
+      return nullptr;
+    }
+    return new Snapshot(reinterpret_cast<const char *>(file), st.st_size);
+  }
+
+  ~Snapshot() { munmap(const_cast<char *>(file_), size_); }
+
+  Value_t Get(T key) {
+    uint64_t key_hash = Key_Hash(key);
+    uint64_t x = depth_shift_ == 64 ? 0 : key_hash >> depth_shift_;
+    uint64_t b = directory_[x] * kBuckets + Bucket_Of(key_hash);
+    uint8_t finger = Finger_Of(key_hash);
+    for (uint64_t i = starts_[b], end = starts_[b + 1]; i < end; ++i) {
+      if (fingers_[i] == finger && Key_Equal(key, slots_[i].key)) {
+        return slots_[i].value;
+      }
+    }
+    return NONE;
+  }
+
+  Value_t Get(T key, Session &) { return Get(key); }
+  int Insert(T, Value_t) { return -1; }
+  int Insert(T, Value_t, Session &) { return -1; }
+  bool Delete(T) { return false; }
+  bool Delete(T, Session &) { return false; }
+  void Recovery() {}
+
+  void getNumber() {
+    std::cout << "frozen snapshot: pairs = " << header_->pairs
+              << ", segments = " << header_->segments
+              << ", bytes = " << header_->bytes << std::endl;
+  }
+
+ private:
+  Snapshot(const char *file, uint64_t size) : file_(file), size_(size) {
+    header_ = reinterpret_cast<const FileHeader *>(file);
+    depth_shift_ = 64 - header_->global_depth;
+    directory_ = reinterpret_cast<const uint32_t *>(file + header_->directory);
+    starts_ = reinterpret_cast<const uint64_t *>(file + header_->starts);
+    fingers_ = reinterpret_cast<const uint8_t *>(file + header_->fingers);
+    slots_ = reinterpret_cast<const Slot *>(file + header_->slots);
+    keys_ = file + header_->keys;
+  }
+
+  inline bool Key_Equal(T key, uint64_t stored) {
+    if constexpr (std::is_pointer<T>::value) {
+      uint32_t length;
+      memcpy(&length, keys_ + stored, sizeof(length));
+      return length == (uint32_t)key->length &&
+             !memcmp(keys_ + stored + sizeof(length), key->key, length);
+    } else {
+      return key == stored;
+    }
+  }
+
+  const char *file_;
+  uint64_t size_;
+  const FileHeader *header_;
+  uint32_t depth_shift_;
+  const uint32_t *directory_;
+  const uint64_t *starts_;
+  const uint8_t *fingers_;
+  const Slot *slots_;
+  const char *keys_;
+};
+
+}  // namespace frozen
@@ -0,0 +1,220 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Relaxed durability through group commit. A writer inside a Deferred scope
+// does not flush the cache lines it persists; it appends them to a ring of its
+// own and moves on. A flusher thread drains all rings every interval with one
+// fence per ring, a writer whose ring is full drains it itself, and Sync()
+// drains everything. The writes of the last interval may be lost in a crash,
+// and a line may reach PM before an older one of the same interval, so the
+// recovery of an index that ran in this mode has to validate its pairs. Moves
+// of pairs that may already be durable run in an Eager scope, so a crash
+// only loses new writes. While a group runs, a delete durably overwrites the
+// key of the slot it frees before the slot can be refilled, so an insert that
+// loses its pair in a crash cannot bring the deleted key back.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef PMEM
+#include <libpmemobj.h>
+#endif
+
+#include "persist_policy.h"
+#include "pm_stats.h"
+
+namespace durability {
+
+constexpr uint64_t kLineSize = 64;
+constexpr uint64_t kRingSize = 1024; /*cache lines a writer may defer*/
+
+struct GroupCommit;
+
+struct alignas(64) DirtyRing {
+  uint64_t lines[kRingSize];
+  std::atomic<uint64_t> head{0}; /*advanced by the owner only*/
+  std::atomic<uint64_t> tail{0}; /*advanced by whoever drains*/
+  std::mutex drain_lock;
+  GroupCommit *owner = nullptr;
+  uint64_t deferred = 0;  /*lines appended, by the owner*/
+  uint64_t overflows = 0; /*drains by the owner because the ring was full*/
+  uint64_t flushed = 0;   /*lines written back, under drain_lock*/
+  uint64_t drains = 0;    /*one fence each, under drain_lock*/
+};
+
+struct GroupStats {
+  uint64_t deferred;
+  uint64_t flushed;
+  uint64_t drains;
+  uint64_t overflows;
+};
+
+/*the ring of the calling thread while it is inside a Deferred scope*/
+inline thread_local DirtyRing *deferred_ring = nullptr;
+
+/*groups alive in the process; the deletes scrub the slots they free while
+ * there is one*/
+inline std::atomic<uint32_t> live_groups{0};
+
+inline bool ScrubDeletes() {
+  return live_groups.load(std::memory_order_relaxed) != 0;
+}
+
+struct GroupCommit {
+  GroupCommit(PMEMobjpool *pool, uint32_t interval_us)
+      : pool_(pool), interval_us_(interval_us), id_(NextId()) {
+    live_groups.fetch_add(1);
+    flusher_ = std::thread(&GroupCommit::Run, this);
+  }
+
+  ~GroupCommit() {
+    stop_.store(true);
+    flusher_.join();
+    Sync();
+    live_groups.fetch_sub(1);
+  }
+
+  /* The ring of the calling thread, registered on its first write. A thread
+   * keeps the rings of every group it wrote to, which may have been deleted
+   * since, so they are told apart by the id of their group and never read*/
+  DirtyRing *Local() {
+    struct LocalRing {
+      uint64_t group_id;
+      DirtyRing *ring;
+    };
+    thread_local std::vector<LocalRing> rings;
+    for (auto &local : rings) {
+      if (local.group_id == id_) return local.ring;
+    }
+    auto ring = new DirtyRing();
+    ring->owner = this;
+    {
+      std::lock_guard<std::mutex> guard(rings_lock_);
+      rings_.emplace_back(ring);
+    }
+    rings.push_back({id_, ring});
+    return ring;
+  }
+
+  void Drain(DirtyRing *ring) {
+    std::lock_guard<std::mutex> guard(ring->drain_lock);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    if (head == tail) return;
+    /*the write-back of the persistence policy, like an eager persist*/
+    persist::Dispatch([&](auto policy) {
+      for (uint64_t i = tail; i < head; ++i) {
+        decltype(policy)::Flush(
+            reinterpret_cast<void *>(ring->lines[i & (kRingSize - 1)]),
+            kLineSize);
+      }
+      decltype(policy)::Fence();
+    });
+    /*charged to the drainer: the flusher thread, or the writer on overflow*/
+    pmstat::Current().flushes += head - tail;
+    pmstat::Current().bytes += (head - tail) * kLineSize;
+    pmstat::Fence();
+    ring->tail.store(head, std::memory_order_release);
+    ring->flushed += head - tail;
+    ring->drains++;
+  }
+
+  /*make every write deferred so far durable*/
+  void Sync() {
+    std::lock_guard<std::mutex> guard(rings_lock_);
+    for (auto &ring : rings_) Drain(ring.get());
+  }
+
+  GroupStats Stats() {
+    GroupStats stats;
+    memset(&stats, 0, sizeof(stats));
+    std::lock_guard<std::mutex> guard(rings_lock_);
+    for (auto &ring : rings_) {
+      stats.deferred += __atomic_load_n(&ring->deferred, __ATOMIC_RELAXED);
+      stats.overflows += __atomic_load_n(&ring->overflows, __ATOMIC_RELAXED);
+      std::lock_guard<std::mutex> drain_guard(ring->drain_lock);
+      stats.flushed += ring->flushed;
+      stats.drains += ring->drains;
+    }
+    return stats;
+  }
+
+  void Report() {
+    auto stats = Stats();
+    std::cout << "group commit: interval = " << interval_us_
+              << " us, deferred lines = " << stats.deferred
+              << ", flushed lines = " << stats.flushed
+              << ", drains = " << stats.drains
+              << ", overflows = " << stats.overflows << std::endl;
+  }
+
+  void Run() {
+    while (!stop_.load()) {
+      std::this_thread::sleep_for(std::chrono::microseconds(interval_us_));
+      Sync();
+    }
+  }
+
+  static uint64_t NextId() {
+    static std::atomic<uint64_t> next_id{0};
+    return next_id.fetch_add(1);
+  }
+
+  PMEMobjpool *pool_;
+  uint32_t interval_us_;
+  uint64_t id_; /*unique across the groups of the process*/
+  std::atomic<bool> stop_{false};
+  std::thread flusher_;
+  std::mutex rings_lock_;
+  std::vector<std::unique_ptr<DirtyRing>> rings_;
+};
+
+/*append the lines of [ptr, ptr + size) to the ring of the calling thread*/
+inline void Defer(const void *ptr, size_t size) {
+  auto ring = deferred_ring;
+  uint64_t line = reinterpret_cast<uint64_t>(ptr) & ~(kLineSize - 1);
+  uint64_t end = reinterpret_cast<uint64_t>(ptr) + size;
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  for (; line < end; line += kLineSize) {
+    if (head - ring->tail.load(std::memory_order_acquire) == kRingSize) {
+      ring->head.store(head, std::memory_order_release);
+      ring->owner->Drain(ring);
+      ring->overflows++;
+    }
+    ring->lines[head & (kRingSize - 1)] = line;
+    head++;
+    ring->deferred++;
+  }
+  ring->head.store(head, std::memory_order_release);
+}
+
+/* Makes the persists of the calling thread eager again while it lives, inside
+ * a Deferred scope. For writes that move a pair that may already be durable:
+ * the clear of its old slot must not reach PM before the pair in its new one*/
+class Eager {
+ public:
+  Eager() : ring_(deferred_ring) { deferred_ring = nullptr; }
+  ~Eager() { deferred_ring = ring_; }
+
+ private:
+  DirtyRing *ring_;
+};
+
+/*defers the persists of the calling thread to group while it lives*/
+class Deferred {
+ public:
+  explicit Deferred(GroupCommit *group) {
+    if (group != nullptr) deferred_ring = group->Local();
+  }
+  ~Deferred() { deferred_ring = nullptr; }
+};
+
+}  // namespace durability
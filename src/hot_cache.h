@@ -0,0 +1,214 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Direct-mapped DRAM cache of recent lookups in front of the PM table. A miss
+// fills the slot of the key with the result of the table lookup, and a small
+// second array remembers keys that were not found. Writers never touch the
+// slots: every write bumps the version stripe of its key, and a slot is only a
+// hit while the stripe still holds the version that was read before the table
+// lookup that filled it. Only fixed-length keys are cached.
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "../util/pair.h"
+
+namespace hotcache {
+
+constexpr uint32_t kNegativeShare = 8; /*1/8 of the budget holds negatives*/
+constexpr uint32_t kStatStripes = 64;
+constexpr uint32_t kStatStripeMask = kStatStripes - 1;
+/* a version stripe counts the writers in progress in its low 16 bits and the
+ * finished writes above them*/
+constexpr uint64_t kWriterMask = (1ull << 16) - 1;
+constexpr uint64_t kWriteBegin = 1;
+constexpr uint64_t kWriteEnd = (1ull << 16) - 1; /*one more write, one writer less*/
+
+struct Slot {
+  uint64_t seq; /*odd while a fill rewrites the slot*/
+  uint64_t key;
+  Value_t value;
+  uint64_t tag; /*the version of the stripe when the table was read*/
+};
+
+struct alignas(64) StatStripe {
+  uint64_t hits;
+  uint64_t negative_hits;
+  uint64_t misses;
+  uint64_t fills;
+};
+
+struct CacheStats {
+  uint64_t hits;
+  uint64_t negative_hits;
+  uint64_t misses;
+  uint64_t fills;
+  uint64_t slots;
+  uint64_t negative_slots;
+};
+
+inline uint32_t Stat_Stripe() {
+  static uint32_t next_stripe = 0;
+  static thread_local uint32_t stripe =
+      __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) & kStatStripeMask;
+  return stripe;
+}
+
+/*the largest power of two not above x, at least 1*/
+inline uint64_t Floor_Pow2(uint64_t x) {
+  uint64_t ret = 1;
+  while ((ret << 1) <= x) ret <<= 1;
+  return ret;
+}
+
+class HotCache {
+ public:
+  explicit HotCache(size_t size_mb) {
+    uint64_t budget = static_cast<uint64_t>(size_mb) << 20;
+    uint64_t negative_budget = budget / kNegativeShare;
+    /*every hot slot comes with its version stripe*/
+    slot_num_ = Floor_Pow2((budget - negative_budget) /
+                           (sizeof(Slot) + sizeof(uint64_t)));
+    negative_num_ = Floor_Pow2(negative_budget / sizeof(Slot));
+    slots_ = Alloc<Slot>(slot_num_);
+    negatives_ = Alloc<Slot>(negative_num_);
+    versions_ = Alloc<uint64_t>(slot_num_);
+    memset(stats_, 0, sizeof(stats_));
+  }
+
+  ~HotCache() {
+    free(slots_);
+    free(negatives_);
+    free(versions_);
+  }
+
+  HotCache(const HotCache &) = delete;
+  HotCache &operator=(const HotCache &) = delete;
+
+  /* returns true on a hit, *value is NONE for a cached negative; on a miss,
+   * *tag is the version to pass to Fill after the table lookup*/
+  inline bool Lookup(uint64_t key, uint64_t key_hash, Value_t *value,
+                     uint64_t *tag) {
+    auto &stats = stats_[Stat_Stripe()];
+    uint64_t *version = versions_ + (key_hash & (slot_num_ - 1));
+    if (Read_Slot(slots_ + (key_hash & (slot_num_ - 1)), key, version,
+                  value)) {
+      __atomic_fetch_add(&stats.hits, 1, __ATOMIC_RELAXED);
+      return true;
+    }
+    if (Read_Slot(negatives_ + (key_hash & (negative_num_ - 1)), key, version,
+                  value)) {
+      *value = NONE;
+      __atomic_fetch_add(&stats.negative_hits, 1, __ATOMIC_RELAXED);
+      return true;
+    }
+    __atomic_fetch_add(&stats.misses, 1, __ATOMIC_RELAXED);
+    *tag = __atomic_load_n(version, __ATOMIC_ACQUIRE);
+    return false;
+  }
+
+  /*remember the result of a table lookup that started after Lookup*/
+  inline void Fill(uint64_t key, uint64_t key_hash, Value_t value,
+                   uint64_t tag) {
+    /*a writer was in progress, the table may have shown either state*/
+    if (tag & kWriterMask) return;
+    Slot *slot = (value == NONE)
+                     ? negatives_ + (key_hash & (negative_num_ - 1))
+                     : slots_ + (key_hash & (slot_num_ - 1));
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    /*another thread is filling this slot, give way*/
+    if ((seq & 1) ||
+        !__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return;
+    }
+    __atomic_store_n(&slot->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->value, value, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->tag, tag, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&stats_[Stat_Stripe()].fills, 1, __ATOMIC_RELAXED);
+  }
+
+  /* bracket every insert and delete of the key: a writer that has begun
+   * invalidates all cached results of its stripe*/
+  inline void BeginWrite(uint64_t key_hash) {
+    __atomic_fetch_add(versions_ + (key_hash & (slot_num_ - 1)), kWriteBegin,
+                       __ATOMIC_SEQ_CST);
+  }
+
+  inline void EndWrite(uint64_t key_hash) {
+    __atomic_fetch_add(versions_ + (key_hash & (slot_num_ - 1)), kWriteEnd,
+                       __ATOMIC_SEQ_CST);
+  }
+
+  CacheStats Stats() {
+    CacheStats total;
+    memset(&total, 0, sizeof(total));
+    for (uint32_t i = 0; i < kStatStripes; ++i) {
+      total.hits += __atomic_load_n(&stats_[i].hits, __ATOMIC_RELAXED);
+      total.negative_hits +=
+          __atomic_load_n(&stats_[i].negative_hits, __ATOMIC_RELAXED);
+      total.misses += __atomic_load_n(&stats_[i].misses, __ATOMIC_RELAXED);
+      total.fills += __atomic_load_n(&stats_[i].fills, __ATOMIC_RELAXED);
+    }
+    total.slots = slot_num_;
+    total.negative_slots = negative_num_;
+    return total;
+  }
+
+  void Report() {
+    auto stats = Stats();
+    uint64_t lookups = stats.hits + stats.negative_hits + stats.misses;
+    std::cout << "hot_cache_slots = " << stats.slots
+              << ", negative_slots = " << stats.negative_slots << std::endl;
+    std::cout << "hot_cache_hits = " << stats.hits
+              << ", negative_hits = " << stats.negative_hits
+              << ", misses = " << stats.misses << ", fills = " << stats.fills
+              << std::endl;
+    std::cout << "hot_cache_hit_rate = "
+              << (lookups ? (double)(stats.hits + stats.negative_hits) / lookups
+                          : 0)
+              << std::endl;
+  }
+
+ private:
+  template <class S>
+  static S *Alloc(uint64_t num) {
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, 64, num * sizeof(S)) != 0) {
+      std::cout << "hot cache allocation of " << num * sizeof(S)
+                << " bytes failed" << std::endl;
+      exit(1);
+    }
+    memset(ptr, 0, num * sizeof(S));
+    return reinterpret_cast<S *>(ptr);
+  }
+
+  /*a seqlock read of the slot, valid only if no write began since the fill*/
+  inline bool Read_Slot(Slot *slot, uint64_t key, uint64_t *version,
+                        Value_t *value) {
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == 0 || (seq & 1)) return false;
+    uint64_t slot_key = __atomic_load_n(&slot->key, __ATOMIC_RELAXED);
+    Value_t slot_value = __atomic_load_n(&slot->value, __ATOMIC_RELAXED);
+    uint64_t tag = __atomic_load_n(&slot->tag, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) return false;
+    if (slot_key != key) return false;
+    if (__atomic_load_n(version, __ATOMIC_ACQUIRE) != tag) return false;
+    *value = slot_value;
+    return true;
+  }
+
+  uint64_t slot_num_;
+  uint64_t negative_num_;
+  Slot *slots_;
+  Slot *negatives_; /*keys whose lookup found nothing*/
+  uint64_t *versions_;
+  StatStripe stats_[kStatStripes];
+};
+
+}  // namespace hotcache
@@ -0,0 +1,414 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Index-managed storage for variable-length keys. The index copies every
+// inserted string_key into a per-thread log-structured PM block and frees the
+// bytes through the epoch garbage list on delete, so callers no longer have to
+// keep the key memory alive. A background compactor frees dead blocks and
+// evacuates sparse ones so that the arena stays bounded under churn.
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../util/pair.h"
+#include "../util/utils.h"
+#include "allocator.h"
+
+#ifdef PMEM
+#include <libpmemobj.h>
+#endif
+
+/* Called by the compactor to swing the index entry that points to old_key over
+ * to new_key; returns false if the index no longer references old_key*/
+typedef bool (*RelocateCallback)(void *context, string_key *old_key,
+                                 string_key *new_key);
+
+namespace arena {
+
+constexpr size_t kDefaultBlockSize = 4 * 1024 * 1024;
+constexpr uint32_t kDefaultCompactThreshold = 50; /*percentage of live bytes*/
+constexpr uint32_t kCompactInterval = 100;        /*milliseconds*/
+
+/*record states*/
+constexpr uint32_t kRecordLive = 1;
+constexpr uint32_t kRecordRetired = 2; /*deleted, waiting for the epoch*/
+constexpr uint32_t kRecordDead = 3;
+
+struct KeyRecord {
+  uint32_t size;   /*size of the whole record, 0 terminates a block*/
+  uint32_t state;  /*persisted whenever a record leaves the live state*/
+  uint64_t offset; /*offset of this record in the block data area*/
+  string_key key;
+};
+
+struct KeyBlock {
+  PMEMoid next;
+  uint64_t capacity; /*bytes usable in data*/
+  /*the following fields are DRAM-only and rebuilt when the arena opens*/
+  uint64_t tail;
+  uint64_t live;
+  uint64_t active; /*1 if a thread is still appending to this block*/
+  char dummy[16];
+  char data[0];
+};
+
+struct KeyArenaRoot {
+  PMEMoid head;       /*chain of all blocks*/
+  PMEMoid back_block; /*block allocation writes here first*/
+  uint64_t block_size;
+};
+
+class KeyArena {
+ public:
+  static void New(PMEMoid *root, size_t block_size) {
+#ifdef PMEM
+    auto callback = [](PMEMobjpool *pool, void *ptr, void *arg) {
+      auto root_ptr = reinterpret_cast<KeyArenaRoot *>(ptr);
+      root_ptr->head = OID_NULL;
+      root_ptr->back_block = OID_NULL;
+      root_ptr->block_size = *reinterpret_cast<size_t *>(arg);
+      pmemobj_persist(pool, root_ptr, sizeof(KeyArenaRoot));
+      return 0;
+    };
+    Allocator::Allocate(root, kCacheLineSize, sizeof(KeyArenaRoot), callback,
+                        reinterpret_cast<void *>(&block_size));
+#endif
+  }
+
+  KeyArena(KeyArenaRoot *root, RelocateCallback relocate, void *context,
+           uint32_t threshold = kDefaultCompactThreshold)
+      : root_(root),
+        relocate_(relocate),
+        context_(context),
+        threshold_(threshold),
+        id_(NextId()) {
+    Recovery();
+    auto &live = Live();
+    std::lock_guard<std::mutex> guard(live.lock);
+    live.ids.push_back(id_);
+  }
+
+  ~KeyArena() {
+    {
+      auto &live = Live();
+      std::lock_guard<std::mutex> guard(live.lock);
+      for (auto &id : live.ids) {
+        if (id == id_) {
+          id = live.ids.back();
+          live.ids.pop_back();
+          break;
+        }
+      }
+    }
+    StopCompactor();
+  }
+
+  /*copy the key into the calling thread's block, returns the owned copy*/
+  string_key *Store(string_key *key) {
+    uint64_t size = RecordSize(key->length);
+    auto &cursor = Cursor();
+    if (cursor.arena_id != id_ || cursor.block == nullptr ||
+        cursor.block->tail + size > cursor.block->capacity) {
+      cursor.Seal();
+      cursor.arena_id = id_;
+      cursor.block = NewBlock(size);
+    }
+    auto block = cursor.block;
+    auto record = reinterpret_cast<KeyRecord *>(block->data + block->tail);
+    record->offset = block->tail;
+    record->state = kRecordLive;
+    record->key.length = key->length;
+    memcpy(record->key.key, key->key, key->length);
+    record->size = size;
+#ifdef PMEM
+    Allocator::Persist(record, size);
+#endif
+    block->tail += size;
+    ADD(&block->live, size);
+    return &record->key;
+  }
+
+  /*the key was removed from the index, free its bytes after the epoch*/
+  void Retire(string_key *key) {
+    auto record = GetRecord(key);
+    STORE(&record->state, kRecordRetired);
+#ifdef PMEM
+    Allocator::Persist(&record->state, sizeof(record->state));
+#endif
+    Allocator::Free(key, &KeyArena::ReclaimCallback, this);
+  }
+
+  /*the key never became visible (e.g. duplicate insert), free it directly*/
+  void Release(string_key *key) { Kill(GetRecord(key), kRecordLive); }
+
+  void StartCompactor() {
+    if (compactor_ != nullptr) return;
+    STORE(&stop_, false);
+    compactor_ = new std::thread([this]() {
+      while (!LOAD(&stop_)) {
+        CompactOnce();
+        msleep(kCompactInterval);
+      }
+    });
+  }
+
+  void StopCompactor() {
+    if (compactor_ == nullptr) return;
+    STORE(&stop_, true);
+    compactor_->join();
+    delete compactor_;
+    compactor_ = nullptr;
+  }
+
+  /*one pass over the sealed blocks: free the empty ones and evacuate the
+   * sparse ones*/
+  void CompactOnce() {
+    std::vector<KeyBlock *> blocks;
+    {
+      std::lock_guard<std::mutex> guard(chain_lock_);
+      auto curr = reinterpret_cast<KeyBlock *>(pmemobj_direct(root_->head));
+      while (curr != nullptr) {
+        blocks.push_back(curr);
+        curr = reinterpret_cast<KeyBlock *>(pmemobj_direct(curr->next));
+      }
+    }
+
+    for (auto block : blocks) {
+      if (LOAD(&block->active)) continue;
+      if (LOAD(&block->live) == 0) {
+        Unlink(block);
+        continue;
+      }
+      if (LOAD(&block->live) * 100 < block->tail * threshold_) {
+        Evacuate(block);
+        if (LOAD(&block->live) == 0) {
+          Unlink(block);
+        }
+      }
+    }
+  }
+
+  void Report() {
+    uint64_t block_num = 0, used = 0, live = 0;
+    std::lock_guard<std::mutex> guard(chain_lock_);
+    auto curr = reinterpret_cast<KeyBlock *>(pmemobj_direct(root_->head));
+    while (curr != nullptr) {
+      block_num++;
+      used += curr->tail;
+      live += LOAD(&curr->live);
+      curr = reinterpret_cast<KeyBlock *>(pmemobj_direct(curr->next));
+    }
+    std::cout << "key_arena_blocks = " << block_num << std::endl;
+    std::cout << "key_arena_used_bytes = " << used << std::endl;
+    std::cout << "key_arena_live_bytes = " << live << std::endl;
+    std::cout << "key_arena_freed_blocks = " << freed_blocks_ << std::endl;
+    std::cout << "key_arena_relocated_keys = " << relocated_ << std::endl;
+  }
+
+ private:
+  /* The arenas alive in the process, by id. A block is sealed only while its
+   * arena is alive: the blocks of a closed arena are sealed by the recovery
+   * of the next one, and an arena at the same address is not the same one*/
+  struct LiveArenas {
+    std::mutex lock;
+    std::vector<uint64_t> ids;
+  };
+
+  static LiveArenas &Live() {
+    static LiveArenas live;
+    return live;
+  }
+
+  static uint64_t NextId() {
+    static std::atomic<uint64_t> next_id{1};
+    return next_id.fetch_add(1);
+  }
+
+  struct TlsCursor {
+    uint64_t arena_id = 0;
+    KeyBlock *block = nullptr;
+
+    /*hand the block the thread appends to over to the compactor*/
+    void Seal() {
+      if (block == nullptr) return;
+      auto &live = Live();
+      std::lock_guard<std::mutex> guard(live.lock);
+      for (auto id : live.ids) {
+        if (id == arena_id) {
+          STORE(&block->active, 0);
+          break;
+        }
+      }
+      block = nullptr;
+    }
+
+    /*a thread that exits leaves its block to the compactor*/
+    ~TlsCursor() { Seal(); }
+  };
+
+  static TlsCursor &Cursor() {
+    thread_local TlsCursor cursor;
+    return cursor;
+  }
+
+  static uint64_t RecordSize(int length) {
+    uint64_t size = sizeof(KeyRecord) + length;
+    return (size + 7) & ~7UL;
+  }
+
+  static KeyRecord *GetRecord(string_key *key) {
+    return reinterpret_cast<KeyRecord *>(reinterpret_cast<char *>(key) -
+                                         offsetof(KeyRecord, key));
+  }
+
+  static KeyBlock *GetBlock(KeyRecord *record) {
+    return reinterpret_cast<KeyBlock *>(reinterpret_cast<char *>(record) -
+                                        record->offset -
+                                        offsetof(KeyBlock, data));
+  }
+
+  /*whoever moves the record out of from_state owns the live-byte accounting*/
+  static bool Kill(KeyRecord *record, uint32_t from_state) {
+    uint32_t expected = from_state;
+    if (!CAS(&record->state, &expected, kRecordDead)) return false;
+#ifdef PMEM
+    if (from_state == kRecordLive) {
+      Allocator::Persist(&record->state, sizeof(record->state));
+    }
+#endif
+    SUB(&GetBlock(record)->live, record->size);
+    return true;
+  }
+
+  static void ReclaimCallback(void *, void *ptr) {
+    Kill(GetRecord(reinterpret_cast<string_key *>(ptr)), kRecordRetired);
+  }
+
+  KeyBlock *NewBlock(uint64_t record_size) {
+    std::pair<uint64_t, PMEMoid> callback_args;
+    callback_args.first = root_->block_size;
+    if (callback_args.first < record_size) callback_args.first = record_size;
+
+    std::lock_guard<std::mutex> guard(chain_lock_);
+    callback_args.second = root_->head;
+#ifdef PMEM
+    auto callback = [](PMEMobjpool *pool, void *ptr, void *arg) {
+      auto value_ptr = reinterpret_cast<std::pair<uint64_t, PMEMoid> *>(arg);
+      auto block = reinterpret_cast<KeyBlock *>(ptr);
+      block->next = value_ptr->second;
+      block->capacity = value_ptr->first;
+      block->tail = 0;
+      block->live = 0;
+      block->active = 1;
+      /*a zero record size terminates the scan during recovery*/
+      memset(block->data, 0, value_ptr->first);
+      pmemobj_persist(pool, block, sizeof(KeyBlock) + value_ptr->first);
+      return 0;
+    };
+    Allocator::Allocate(&root_->back_block, kCacheLineSize,
+                        sizeof(KeyBlock) + callback_args.first, callback,
+                        reinterpret_cast<void *>(&callback_args));
+    root_->head = root_->back_block;
+    Allocator::Persist(&root_->head, sizeof(root_->head));
+    root_->back_block = OID_NULL;
+    Allocator::Persist(&root_->back_block, sizeof(root_->back_block));
+#endif
+    return reinterpret_cast<KeyBlock *>(pmemobj_direct(root_->head));
+  }
+
+  /*unlink an empty block from the chain and free it after the epoch*/
+  void Unlink(KeyBlock *block) {
+    {
+      std::lock_guard<std::mutex> guard(chain_lock_);
+      PMEMoid *prev_next = &root_->head;
+      auto curr = reinterpret_cast<KeyBlock *>(pmemobj_direct(*prev_next));
+      while (curr != nullptr && curr != block) {
+        prev_next = &curr->next;
+        curr = reinterpret_cast<KeyBlock *>(pmemobj_direct(*prev_next));
+      }
+      if (curr == nullptr) return;
+      *prev_next = block->next;
+      Allocator::Persist(prev_next, sizeof(PMEMoid));
+    }
+    Allocator::Free(block);
+    ++freed_blocks_;
+  }
+
+  /*copy every live record into the compactor's own block and let the index
+   * point to the new copy*/
+  void Evacuate(KeyBlock *block) {
+    auto epoch_guard = Allocator::AquireEpochGuard();
+    uint64_t offset = 0;
+    while (offset < block->tail) {
+      auto record = reinterpret_cast<KeyRecord *>(block->data + offset);
+      offset += record->size;
+      if (LOAD(&record->state) != kRecordLive) continue;
+
+      auto new_key = Store(&record->key);
+      if (relocate_(context_, &record->key, new_key)) {
+        Kill(record, kRecordLive);
+        ++relocated_;
+      } else {
+        /* The index does not reference this record: either the delete is
+         * still in flight (state is retired and the reclaim callback does the
+         * accounting), or the key was leaked by a crash between the arena
+         * append and the index update*/
+        Release(new_key);
+        Kill(record, kRecordLive);
+      }
+    }
+  }
+
+  /* Rebuild the DRAM state of all blocks, every block is sealed after restart.
+   * A crash between the arena append and the index update (or between the
+   * index delete and the retire) leaks at most one record per thread*/
+  void Recovery() {
+#ifdef PMEM
+    if (!OID_IS_NULL(root_->back_block)) {
+      if (!OID_EQUALS(root_->back_block, root_->head)) {
+        pmemobj_free(&root_->back_block);
+      } else {
+        root_->back_block = OID_NULL;
+        Allocator::Persist(&root_->back_block, sizeof(root_->back_block));
+      }
+    }
+#endif
+    auto curr = reinterpret_cast<KeyBlock *>(pmemobj_direct(root_->head));
+    while (curr != nullptr) {
+      uint64_t offset = 0, live = 0;
+      while (offset + sizeof(KeyRecord) <= curr->capacity) {
+        auto record = reinterpret_cast<KeyRecord *>(curr->data + offset);
+        if (record->size == 0) break;
+        if (record->state == kRecordLive) {
+          live += record->size;
+        } else {
+          record->state = kRecordDead;
+        }
+        offset += record->size;
+      }
+      curr->tail = offset;
+      curr->live = live;
+      curr->active = 0;
+      curr = reinterpret_cast<KeyBlock *>(pmemobj_direct(curr->next));
+    }
+  }
+
+  KeyArenaRoot *root_;
+  RelocateCallback relocate_;
+  void *context_;
+  uint32_t threshold_;
+  uint64_t id_;
+  std::mutex chain_lock_;
+  std::thread *compactor_{nullptr};
+  bool stop_{false};
+  uint64_t freed_blocks_{0};
+  uint64_t relocated_{0};
+};
+
+}  // namespace arena
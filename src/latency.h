@@ -0,0 +1,244 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Per-thread latency histograms of the benchmark operations. A Sample times
+// one operation with the TSC and adds it to a log-linear histogram of the
+// calling thread: exact below 2 * kSubBuckets cycles, then kSubBuckets
+// buckets per power of two, so a recorded value is off by at most 1 /
+// kSubBuckets. Only the owning thread writes its histograms; they are merged
+// when a report reads them. With a sampling period of n, only every n-th
+// operation of a thread is timed.
+
+#pragma once
+
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace latency {
+
+enum Op : uint32_t { kInsert = 0, kGet, kDelete, kNumOps };
+
+inline const char *Name(uint32_t op) {
+  static const char *names[kNumOps] = {"insert", "get", "delete"};
+  return names[op];
+}
+
+constexpr uint32_t kSubBucketBits = 5;
+constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+constexpr uint32_t kNumBuckets = 2 * kSubBuckets + (63 - kSubBucketBits) *
+                                                       kSubBuckets;
+
+inline uint32_t Bucket_Of(uint64_t cycles) {
+  if (cycles < 2 * kSubBuckets) return cycles;
+  uint32_t shift = 63 - __builtin_clzll(cycles) - kSubBucketBits;
+  return 2 * kSubBuckets + (shift - 1) * kSubBuckets +
+         ((cycles >> shift) - kSubBuckets);
+}
+
+/*the largest number of cycles recorded in bucket*/
+inline uint64_t Bucket_Top(uint32_t bucket) {
+  if (bucket < 2 * kSubBuckets) return bucket;
+  uint32_t shift = (bucket - 2 * kSubBuckets) / kSubBuckets + 1;
+  uint64_t top = (bucket - 2 * kSubBuckets) % kSubBuckets + kSubBuckets;
+  return ((top + 1) << shift) - 1;
+}
+
+struct Histogram {
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[kNumBuckets];
+
+  void Add(const Histogram &other) {
+    count += other.count;
+    if (other.max > max) max = other.max;
+    for (uint32_t i = 0; i < kNumBuckets; ++i) {
+      buckets[i] += other.buckets[i];
+    }
+  }
+
+  /*the cycles at or below which a fraction p of the samples fall*/
+  uint64_t Percentile(double p) const {
+    uint64_t target = p * count;
+    if (target < p * count || target == 0) target++;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < kNumBuckets; ++i) {
+      seen += buckets[i];
+      if (seen >= target) return std::min(Bucket_Top(i), max);
+    }
+    return max;
+  }
+};
+
+struct LatencyStats {
+  Histogram op[kNumOps];
+
+  void Add(const LatencyStats &other) {
+    for (uint32_t i = 0; i < kNumOps; ++i) op[i].Add(other.op[i]);
+  }
+};
+
+/*histograms of live threads, plus the sum of the exited ones*/
+struct Registry {
+  std::mutex mutex;
+  std::vector<LatencyStats *> threads;
+  LatencyStats retired;
+  double cycles_per_ns = 1;
+};
+
+/* Kept apart from the registry and the thread slot, so that an operation
+ * that is not timed reads two plain variables and no guard of a static*/
+inline uint32_t period = 0; /*time one in period operations, 0 times none*/
+inline thread_local uint32_t countdown = 1; /*operations until the next timed*/
+
+inline Registry &GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+struct alignas(64) ThreadSlot {
+  LatencyStats stats;
+
+  ThreadSlot() {
+    memset(&stats, 0, sizeof(stats));
+    auto &registry = GetRegistry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.threads.push_back(&stats);
+  }
+
+  ~ThreadSlot() {
+    auto &registry = GetRegistry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.retired.Add(stats);
+    for (auto it = registry.threads.begin(); it != registry.threads.end();
+         ++it) {
+      if (*it == &stats) {
+        registry.threads.erase(it);
+        break;
+      }
+    }
+  }
+};
+
+inline ThreadSlot &Local() {
+  static thread_local ThreadSlot slot;
+  return slot;
+}
+
+/* Time every n-th operation of each thread from now on, 0 stops the
+ * timing. Measures the TSC frequency the first time.*/
+inline void Enable(uint32_t n) {
+  auto &registry = GetRegistry();
+  if (n != 0 && period == 0) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t start_cycles = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t cycles = __rdtsc() - start_cycles;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    registry.cycles_per_ns = (double)cycles / ns;
+  }
+  period = n;
+}
+
+inline bool Enabled() { return period != 0; }
+
+/*times the operation op of the calling thread while it lives, if sampled*/
+class Sample {
+ public:
+  explicit Sample(Op op) : start_(0) {
+    if (period == 0 || --countdown != 0) return;
+    countdown = period;
+    op_ = op;
+    _mm_lfence();
+    start_ = __rdtsc();
+  }
+
+  ~Sample() {
+    if (start_ == 0) return;
+    unsigned aux;
+    uint64_t cycles = __rdtscp(&aux) - start_;
+    auto &histogram = Local().stats.op[op_];
+    histogram.count++;
+    histogram.buckets[Bucket_Of(cycles)]++;
+    if (cycles > histogram.max) histogram.max = cycles;
+  }
+
+ private:
+  uint64_t start_;
+  uint32_t op_;
+};
+
+/*the histograms of live threads are read without synchronization*/
+inline LatencyStats Snapshot() {
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> guard(registry.mutex);
+  LatencyStats total = registry.retired;
+  for (auto stats : registry.threads) {
+    total.Add(*stats);
+  }
+  return total;
+}
+
+/*only meaningful while no index operation is running*/
+inline void Reset() {
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> guard(registry.mutex);
+  memset(&registry.retired, 0, sizeof(registry.retired));
+  for (auto stats : registry.threads) {
+    memset(stats, 0, sizeof(*stats));
+  }
+}
+
+constexpr uint32_t kNumPercentiles = 5;
+constexpr double kPercentiles[kNumPercentiles] = {0.5, 0.9, 0.99, 0.999,
+                                                  0.9999};
+constexpr const char *kPercentileNames[kNumPercentiles] = {
+    "p50", "p90", "p99", "p99.9", "p99.99"};
+
+/* One text line per kind of operation that was timed; with a json_path, the
+ * same as one JSON object per line appended to that file, tagged by bench*/
+inline void Report(const std::string &bench, const std::string &json_path) {
+  if (!Enabled()) return;
+  auto stats = Snapshot();
+  double cycles_per_ns = GetRegistry().cycles_per_ns;
+  FILE *json = nullptr;
+  if (!json_path.empty()) json = fopen(json_path.c_str(), "a");
+  for (uint32_t i = 0; i < kNumOps; ++i) {
+    auto &histogram = stats.op[i];
+    if (histogram.count == 0) continue;
+    char line[512];
+    int length = snprintf(line, sizeof(line), "latency: %s samples = %lu",
+                          Name(i), histogram.count);
+    for (uint32_t j = 0; j < kNumPercentiles; ++j) {
+      length += snprintf(line + length, sizeof(line) - length,
+                         ", %s = %.0f ns", kPercentileNames[j],
+                         histogram.Percentile(kPercentiles[j]) / cycles_per_ns);
+    }
+    snprintf(line + length, sizeof(line) - length, ", max = %.0f ns",
+             histogram.max / cycles_per_ns);
+    std::cout << line << std::endl;
+
+    if (json == nullptr) continue;
+    fprintf(json, "{\"bench\": \"%s\", \"op\": \"%s\", \"samples\": %lu",
+            bench.c_str(), Name(i), histogram.count);
+    for (uint32_t j = 0; j < kNumPercentiles; ++j) {
+      fprintf(json, ", \"%s_ns\": %.0f", kPercentileNames[j],
+              histogram.Percentile(kPercentiles[j]) / cycles_per_ns);
+    }
+    fprintf(json, ", \"max_ns\": %.0f}\n", histogram.max / cycles_per_ns);
+  }
+  if (json != nullptr) fclose(json);
+}
+
+}  // namespace latency
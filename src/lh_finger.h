@@ -25,6 +25,12 @@
 #include "../util/pair.h"
 #include "Hash.h"
 #include "allocator.h"
+#include "checkpoint.h"
+#include "warm_up.h"
+#include "contention.h"
+#include "eager_recovery.h"
+#include "hot_cache.h"
+#include "segment_filter.h"
 #define DOUBLE_EXPANSION 1
 
 #ifdef PMEM
@@ -51,6 +57,7 @@ const size_t kNumPairPerBucket = 14;
 const size_t kFingerBits = 8;
 const uint32_t kNumBucket = 64;
 const uint32_t stashBucket = 2;
+const uint64_t kMaxChainWalk = 1 << 16; /*overflow buckets of one table*/
 const uint64_t recoverBit = 1UL << 63;
 const uint64_t lockBit = 1UL << 62;
 const uint8_t overflowBitmapMask = (1 << 4) - 1;
@@ -75,6 +82,16 @@ constexpr uint64_t high32Mask = ~low32Mask;
 constexpr uint32_t shiftBits = (31 - __builtin_clz(kNumBucket)) + kFingerBits;
 constexpr uint32_t expandShiftBits = fixedExpandBits + baseShifBits;
 constexpr uint64_t recoverLockBit = recoverBit | lockBit;
+/*buckets exposed by one claim of the cooperative expansion*/
+constexpr uint32_t kExpandUnit = 2;
+constexpr uint32_t kExpanderBatch = fixedExpandNum; /*claims per round*/
+constexpr uint32_t kLoadSampleSize = 64; /*tables sampled per round*/
+constexpr uint64_t kExpanderInterval = 1; /*ms between expander rounds*/
+constexpr uint32_t kOccupancyStripes = 64;
+constexpr uint32_t kOccupancyStripeMask = kOccupancyStripes - 1;
+/*inserts counted by a stripe between two load factor checks*/
+constexpr int64_t kLoadCheckInterval = 64;
+constexpr uint32_t kChainHistogramSize = 8; /*the last slot counts longer ones*/
 
 #define BUCKET_INDEX(hash) (((hash) >> (64 - shiftBits)) & bucketMask)
 #define META_HASH(hash) ((uint8_t)((hash) >> (64 - kFingerBits)))
@@ -131,6 +148,21 @@ inline uint32_t SEG_SIZE_BY_SEGARR_ID(uint32_t segarr_idx) {
   return segmentSize * pow2(segarr_idx / fixedExpandNum);
 }
 
+/* a slice of the occupancy counter, padded to a cacheline to avoid false
+ * sharing; each thread always updates the same stripe*/
+struct OccupancyStripe {
+  int64_t count;
+  int64_t dummy[7];
+};
+
+inline uint32_t Occupancy_Stripe() {
+  static uint32_t next_stripe = 0;
+  static thread_local uint32_t stripe =
+      __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) &
+      kOccupancyStripeMask;
+  return stripe;
+}
+
 /* overflow Bucket*/
 template <class T>
 struct overflowBucket {
@@ -238,6 +270,7 @@ struct overflowBucket {
   inline void get_lock() {
     uint32_t new_value = 0;
     uint32_t old_value = 0;
+    contention::Backoff backoff;
     do {
       while (true) {
         old_value = __atomic_load_n(&version_lock, __ATOMIC_ACQUIRE);
@@ -245,6 +278,7 @@ struct overflowBucket {
           old_value &= lockMask;
           break;
         }
+        backoff.Spin(&contention::ContentionStats::lock_spins);
       }
       new_value = old_value | lockSet;
     } while (!CAS(&version_lock, &old_value, new_value));
@@ -658,6 +692,7 @@ struct Bucket {
   inline void get_lock() {
     uint32_t new_value = 0;
     uint32_t old_value = 0;
+    contention::Backoff backoff;
     do {
       while (true) {
         old_value = __atomic_load_n(&version_lock, __ATOMIC_ACQUIRE);
@@ -665,6 +700,7 @@ struct Bucket {
           old_value &= lockMask;
           break;
         }
+        backoff.Spin(&contention::ContentionStats::lock_spins);
       }
       new_value = old_value | lockSet;
     } while (!CAS(&version_lock, &old_value, new_value));
@@ -704,7 +740,7 @@ struct Bucket {
   inline void set_initialize() { version_lock = version_lock | initialSet; }
 
   inline void unset_initialize() {
-    version_lock = version_lock & (!initialSet);
+    version_lock = version_lock & (~initialSet);
   }
 
   int Insert(T key, Value_t value, uint8_t meta_hash, bool probe) {
@@ -906,6 +942,8 @@ struct Directory {
   table_p _[directorySize];
   uint64_t recover_counter[directorySize];
   uint64_t crash_version; /* it does not influence the correctness*/
+  uint64_t shrink_from; /* N_next before the in-flight shrink, 0 if none*/
+  uint64_t shrink_committed; /* N_next has been moved backwards*/
 
   static void New(PMEMoid *dir) {
     auto callback = [](PMEMobjpool *pool, void *ptr, void *arg) {
@@ -913,6 +951,8 @@ struct Directory {
       dir_ptr->N_next = baseShifBits << 32;
       dir_ptr->recovered_index = 0;
       dir_ptr->crash_version = 0;
+      dir_ptr->shrink_from = 0;
+      dir_ptr->shrink_committed = 0;
       memset(&dir_ptr->_, 0, sizeof(table_p) * directorySize);
       memset(&dir_ptr->recover_counter, 0, sizeof(uint64_t) * directorySize);
       return 0;
@@ -1015,6 +1055,8 @@ struct Table {
   void Insert4merge(T key, Value_t value, size_t key_hash, uint8_t meta_hash,
                     bool flag = false);
   void Merge(Table<T> *neighbor, bool flag = false);
+  void Clear();
+  void Persist_With_Chain();
   void Split(Table<T> *org_table, uint64_t base_level, int org_idx,
              Directory<T> *);
   int Insert2Org(T key, Value_t value, size_t key_hash, size_t pos);
@@ -1149,7 +1191,9 @@ struct Table {
     uint32_t N = new_N_next >> 32;
     uint32_t next = (uint32_t)new_N_next;
 
-    if (((old_next <= index) && (next > index)) || (old_N != N)) {
+    /*the last check catches the tables retracted by a shrink*/
+    if (((old_next <= index) && (next > index)) || (old_N != N) ||
+        (index >= pow2(N) + next)) {
       return -1;
     }
     return 0;
@@ -1166,10 +1210,12 @@ struct Table {
     uint32_t dir_idx;
     uint32_t offset;
     SEG_IDX_OFFSET(static_cast<uint32_t>(expan_idx), dir_idx, offset);
-    if (dir->_[dir_idx] == NULL)
+    /*a shrink may release the array of an unexposed buddy meanwhile*/
+    Table<T> *seg_array = LOAD(&dir->_[dir_idx]);
+    if (seg_array == NULL || seg_array == reinterpret_cast<Table<T> *>(-1))
       return NULL;
     else
-      return (dir->_[dir_idx] + offset);
+      return (seg_array + offset);
   }
   /*
    *@param idx the index of the original bucket
@@ -1190,6 +1236,110 @@ struct Table {
     return org_table;
   }
 
+  static inline uint64_t Pair_Hash(T key) {
+    if constexpr (std::is_pointer_v<T>) {
+      return h(key->key, key->length);
+    } else {
+      return h(&key, sizeof(Key_t));
+    }
+  }
+
+  /*rebuild the filter from the pairs, the caller holds all bucket locks*/
+  void Build_Filter() {
+    filter::SegmentFilter rebuilt;
+    memset(&rebuilt, 0, sizeof(rebuilt));
+    for (int i = 0; i < kNumBucket; ++i) {
+      auto mask = GET_BITMAP(bucket[i].bitmap);
+      for (int j = 0; j < kNumPairPerBucket; ++j) {
+        if (CHECK_BIT(mask, j)) rebuilt.Add(Pair_Hash(bucket[i]._[j].key));
+      }
+    }
+    for (int i = 0; i < stashBucket; ++i) {
+      auto mask = GET_BITMAP(stash[i].bitmap);
+      for (int j = 0; j < kNumPairPerBucket; ++j) {
+        if (CHECK_BIT(mask, j)) rebuilt.Add(Pair_Hash(stash[i]._[j].key));
+      }
+    }
+    for (auto curr = stash->next; curr != NULL; curr = curr->next) {
+      auto mask = GET_BITMAP(curr->bitmap);
+      for (int j = 0; j < kNumPairPerBucket; ++j) {
+        if (CHECK_BIT(mask, j)) rebuilt.Add(Pair_Hash(curr->_[j].key));
+      }
+    }
+    if (seg_filter == nullptr) {
+      auto fresh = filter::New();
+      fresh->Assign(rebuilt);
+      __atomic_store_n(&seg_filter, fresh, __ATOMIC_RELEASE);
+    } else {
+      seg_filter->Assign(rebuilt);
+    }
+  }
+
+  template <class B, class S>
+  static void Stage_Bucket(B *curr_bucket, S *sink) {
+    auto mask = GET_BITMAP(curr_bucket->bitmap);
+    for (int j = 0; j < kNumPairPerBucket; ++j) {
+      if (CHECK_BIT(mask, j)) {
+        sink->Stage(curr_bucket->_[j].key, curr_bucket->_[j].value);
+      }
+    }
+  }
+
+  /*false if the overflow chain changed under an unlocked walk*/
+  template <class S>
+  bool Stage_Pairs(S *sink) {
+    for (int i = 0; i < kNumBucket; ++i) Stage_Bucket(bucket + i, sink);
+    for (int i = 0; i < stashBucket; ++i) Stage_Bucket(stash + i, sink);
+    /*a chain read without locks may be cut or even cyclic*/
+    uint64_t length = 0;
+    for (auto curr = stash->next; curr != NULL; curr = curr->next) {
+      if (++length > kMaxChainWalk) return false;
+      Stage_Bucket(curr, sink);
+    }
+    return true;
+  }
+
+  /* Copy the pairs of the table to sink. The stash and the overflow chain are
+   * only written under the locks of normal buckets, so the copy is consistent
+   * if none of their versions moved; after kOptimisticTries the table is
+   * locked. The caller is in an epoch, which keeps the freed overflow buckets*/
+  void Export(checkpoint::Sink<T> *sink, checkpoint::Exporter *exporter) {
+    uint32_t versions[kNumBucket];
+    for (int tries = 0; tries < checkpoint::kOptimisticTries; ++tries) {
+      bool locked = false;
+      for (int i = 0; i < kNumBucket && !locked; ++i) {
+        locked = bucket[i].test_lock_set(versions[i]);
+      }
+      if (locked) {
+        _mm_pause();
+        continue;
+      }
+      bool changed = !Stage_Pairs(sink);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      for (int i = 0; i < kNumBucket && !changed; ++i) {
+        changed = bucket[i].test_lock_version_change(versions[i]);
+      }
+      if (!changed) {
+        sink->Commit();
+        exporter->Count_Segment(false);
+        return;
+      }
+      sink->Drop();
+    }
+    for (int i = 0; i < kNumBucket; ++i) bucket[i].get_lock();
+    Stage_Pairs(sink);
+    sink->Commit();
+    for (int i = 0; i < kNumBucket; ++i) bucket[i].release_lock();
+    exporter->Count_Segment(true);
+  }
+
+  /*unlink the filter of a table that lost its pairs*/
+  void Drop_Filter() {
+    auto old_filter = __atomic_exchange_n(&seg_filter, nullptr,
+                                          __ATOMIC_ACQ_REL);
+    filter::Retire(old_filter);
+  }
+
   void recoverMetadata() {
     Bucket<T> *curr_bucket, *neighbor_bucket;
     uint64_t knumber = 0;
@@ -1275,7 +1425,8 @@ struct Table {
   int state; /*0: normal state; 1: split bucket; 2: expand bucket(in the
                 right)*/
   uint64_t seg_version;
-  char dummy[48];
+  filter::SegmentFilter *seg_filter; /*DRAM, null unless filters are enabled*/
+  char dummy[40];
   PMEMmutex lock_bit;
 };
 
@@ -1327,6 +1478,7 @@ int Table<T>::Insert2Org(T key, Value_t value, size_t key_hash, size_t pos) {
 template <class T>
 void Table<T>::Split(Table<T> *org_table, uint64_t base_level, int org_idx,
                      Directory<T> *_dir) {
+  pmstat::Scope split_scope(pmstat::kSplit);
   Bucket<T> *curr_bucket;
   for (int i = 0; i < kNumBucket; ++i) {
     curr_bucket = org_table->bucket + i;
@@ -1522,6 +1674,11 @@ void Table<T>::Split(Table<T> *org_table, uint64_t base_level, int org_idx,
 
   Allocator::Persist(org_table, sizeof(Table));
 #endif
+  /*the caller holds the locks of this table, so readers wait for both*/
+  if (org_table->seg_filter != nullptr) {
+    Build_Filter();
+    org_table->Build_Filter();
+  }
 
   org_table->state = 0;
   Allocator::Persist(&org_table->state, sizeof(org_table->state));
@@ -1664,6 +1821,62 @@ void Table<T>::Merge(Table<T> *neighbor, bool unique_check_flag) {
   }
 }
 
+/* drop all the pairs of a table whose pairs have been merged into its buddy;
+ * the caller holds all of its bucket locks. The table is left uninitialized,
+ * so it is split again from its buddy if it is exposed later*/
+template <class T>
+void Table<T>::Clear() {
+  for (int i = 0; i < kNumBucket; ++i) {
+    Bucket<T> *curr_bucket = bucket + i;
+    curr_bucket->bitmap = 0;
+    curr_bucket->resetOverflowFP();
+    curr_bucket->unset_initialize();
+  }
+  for (int i = 0; i < stashBucket; ++i) {
+    stash[i].bitmap = 0;
+  }
+  overflowBucket<T> *next_bucket = stash->next;
+  stash->next = NULL;
+  Drop_Filter();
+#ifdef COUNTING
+  number = 0;
+#endif
+#ifdef PMEM
+  Allocator::Persist(this, sizeof(Table));
+#endif
+  /*the unlinked buckets may still be read, so they go to the garbage list
+   * of the epoch; a crash before all are freed only leaks the rest*/
+  while (next_bucket != NULL) {
+    overflowBucket<T> *curr_bucket = next_bucket;
+    next_bucket = next_bucket->next;
+#ifdef PMEM
+    auto reserve_item = Allocator::ReserveItem();
+    TX_BEGIN(Allocator::GetPool()) {
+      pmemobj_tx_add_range_direct(reserve_item, sizeof(*reserve_item));
+      Allocator::Free(reserve_item, curr_bucket);
+    }
+    TX_ONABORT {
+      std::cout << "TXN fails during clearing a table" << std::endl;
+    }
+    TX_END
+#else
+    Allocator::Free(curr_bucket);
+#endif
+  }
+}
+
+template <class T>
+void Table<T>::Persist_With_Chain() {
+#ifdef PMEM
+  overflowBucket<T> *next_bucket = stash->next;
+  while (next_bucket != NULL) {
+    Allocator::Persist(next_bucket, sizeof(struct overflowBucket<T>));
+    next_bucket = next_bucket->next;
+  }
+  Allocator::Persist(this, sizeof(Table));
+#endif
+}
+
 /* it needs to verify whether this bucket has been deleted...*/
 template <class T>
 int Table<T>::Insert(T key, Value_t value, size_t key_hash, Directory<T> *_dir,
@@ -1675,6 +1888,7 @@ int Table<T>::Insert(T key, Value_t value, size_t key_hash, Directory<T> *_dir,
   Bucket<T> *neighbor = bucket + ((y + 1) & bucketMask);
   target->get_lock();
   if (!neighbor->try_get_lock()) {
+    contention::Local().trylock_failures++;
     target->release_lock();
     return -2;
   }
@@ -1723,6 +1937,7 @@ int Table<T>::Insert(T key, Value_t value, size_t key_hash, Directory<T> *_dir,
       target->release_lock();
       return -3; /* duplicate insert*/
     }
+    if (seg_filter != nullptr) seg_filter->Add(key_hash);
 
     int target_num = GET_COUNT(target->bitmap);
     int neighbor_num = GET_COUNT(neighbor->bitmap);
@@ -1732,6 +1947,7 @@ int Table<T>::Insert(T key, Value_t value, size_t key_hash, Directory<T> *_dir,
       Bucket<T> *next_neighbor = bucket + ((y + 2) & bucketMask);
       // Next displacement
       if (!next_neighbor->try_get_lock()) {
+        contention::Local().trylock_failures++;
         neighbor->release_lock();
         target->release_lock();
         return -2;
@@ -1754,6 +1970,7 @@ int Table<T>::Insert(T key, Value_t value, size_t key_hash, Directory<T> *_dir,
       }
 
       if (!prev_neighbor->try_get_lock()) {
+        contention::Local().trylock_failures++;
         target->release_lock();
         neighbor->release_lock();
         return -2;
@@ -1950,18 +2167,101 @@ class Linear : public Hash<T> {
   ~Linear(void);
   int Insert(T key, Value_t value);
   bool Delete(T);
-  int Insert(T key, Value_t value, bool);
-  bool Delete(T, bool);
+  int Insert(T key, Value_t value, Session &);
+  bool Delete(T, Session &);
+  bool Delete_Pair(T);
   inline Value_t Get(T);
-  Value_t Get(T key, bool is_in_epoch);
+  Value_t Get(T key, Session &session);
+  /*the table operations behind the hot-key cache*/
+  inline int Insert_Pair(T key, Value_t value);
+  inline Value_t Get_Pair(T);
   void FindAnyway(T key);
   void Recovery();
+  /*recover every segment now on num_threads threads instead of on its first
+   * access, called right after Recovery()*/
+  void EagerRecovery(uint32_t num_threads);
+  /*fault in the tables and their overflow buckets on num_threads threads
+   * after the pool is opened*/
+  void WarmUp(uint32_t num_threads);
   void ShutDown() {
+    Stop_Expander();
+    Release_Occupancy();
     clean = true;
     Allocator::Persist(&clean, sizeof(clean));
   }
-  bool TryMerge(uint64_t, Table<T> *);
+  bool TryMerge();
+  void Recover_Shrink();
+  void Release_Segment_Arrays();
+  Table<T> *Locate_Table(uint32_t x);
   void recoverSegment(Table<T> **seg_ptr, size_t, size_t, size_t);
+  /*inserters that hit a full table post expansion work instead of expanding
+   * themselves; a target_load_factor > 0 also starts the expander thread*/
+  void EnableCooperativeExpansion(double target_load_factor);
+  uint32_t Help_Expand(uint64_t *claims, uint32_t max_claims);
+  void Split_Exposed(uint32_t x);
+  /* write the pairs to a checkpoint file at path on num_threads threads while
+   * writers go on, at most mb_per_sec MB/s if it is not 0; a pair present
+   * during the whole walk is in the file, shrinks wait until it ends. Returns
+   * the number of pairs written, 0 if writing the file failed*/
+  uint64_t Checkpoint(const char *path, uint32_t num_threads = 4,
+                      uint64_t mb_per_sec = 0, bool with_hashes = false);
+  double Sample_Load_Factor(uint64_t *seed);
+  void Expander_Loop();
+  void Stop_Expander();
+  /*expand as soon as the number of pairs exceeds max_load_factor of the
+   * capacity instead of waiting for overflow buckets, 0 disables it; shrink
+   * once it drops below min_load_factor, 0 never shrinks*/
+  void SetLoadFactorPolicy(double max_load_factor,
+                           double min_load_factor = 0);
+  void Check_Load_Factor();
+  /*x was computed from a stale N_next and a shrink released its array*/
+  static inline bool Released(Table<T> *seg_array) {
+    return seg_array == NULL || seg_array == reinterpret_cast<Table<T> *>(-1);
+  }
+  /*cache hot fixed-length keys and negative lookups in size_mb of DRAM*/
+  void EnableHotCache(size_t size_mb);
+  /*answer most negative lookups from a DRAM filter per table*/
+  void EnableSegmentFilters();
+  void Reset_Segment_Filters();
+  void Report_Segment_Filters();
+  int64_t Occupancy();
+  uint64_t Count_Pairs();
+
+  /*the DRAM count goes away with the policy that keeps it*/
+  void Release_Occupancy() {
+    max_load_factor = 0;
+    min_load_factor = 0;
+    delete[] occupancy;
+    occupancy = nullptr;
+  }
+
+  inline void Update_Occupancy(int64_t delta) {
+    auto count = ADD(&occupancy[Occupancy_Stripe()].count, delta);
+    if (count % kLoadCheckInterval == 0) {
+      Check_Load_Factor();
+    }
+  }
+
+  inline void Reset_Expansion_State() {
+    cooperative = false;
+    expand_work = 0;
+    inserter_claims = 0;
+    expander_claims = 0;
+    target_load_factor = 0;
+    stop_expander = false;
+    expander = nullptr;
+    max_load_factor = 0;
+    min_load_factor = 0;
+    load_check_lock = 0;
+    shrink_lock = 0;
+    shrink_count = 0;
+    released_arrays = 0;
+    policy_claims = 0;
+    occupancy = nullptr;
+    hot_cache = nullptr;
+    segment_filters = false;
+  }
+
   void getNumber() {
     uint64_t count = 0;
     uint64_t prev_length = 0;
@@ -1975,6 +2275,7 @@ class Linear : public Hash<T> {
     uint32_t occupied_bucket = pow2(N) + next;
     uint64_t recount_num = 0;
     uint32_t max_dir = 0;
+    uint64_t chain_histogram[kChainHistogramSize] = {0};
 
     for (int i = 0; i < occupied_bucket; ++i) {
       uint32_t dir_idx;
@@ -2017,7 +2318,9 @@ class Linear : public Hash<T> {
 
       overflowBucket<T> *prev_bucket = curr_table->stash;
       overflowBucket<T> *next_bucket = prev_bucket->next;
+      uint32_t chain_length = 0;
       while (next_bucket != NULL) {
+        chain_length++;
         count += GET_COUNT(next_bucket->bitmap);
         int mask = GET_BITMAP(next_bucket->bitmap);
         int micro_count = 0;
@@ -2038,6 +2341,10 @@ class Linear : public Hash<T> {
         }
         Bucket_num++;
       }
+      if (chain_length >= kChainHistogramSize) {
+        chain_length = kChainHistogramSize - 1;
+      }
+      chain_histogram[chain_length]++;
     }
 
     std::cout << "The # directory entries is " << max_dir << std::endl;
@@ -2055,14 +2362,42 @@ class Linear : public Hash<T> {
     std::cout << "the local raw sapce utilization = " << (double)count / (Bucket_num * 16) << std::endl;
     std::cout << "the prev_length = " << prev_length << std::endl;
     std::cout << "the after_length = " << after_length << std::endl;
+    std::cout << "overflow chain length histogram (#tables):";
+    for (uint32_t i = 0; i < kChainHistogramSize; ++i) {
+      std::cout << " " << i << (i == kChainHistogramSize - 1 ? "+" : "")
+                << " = " << chain_histogram[i] << ";";
+    }
+    std::cout << std::endl;
+    if (shrink_count) {
+      std::cout << "shrinks = " << shrink_count
+                << ", released segment arrays = " << released_arrays
+                << std::endl;
+    }
+    if (max_load_factor > 0) {
+      std::cout << "load factor policy: max = " << max_load_factor
+                << ", min = " << min_load_factor
+                << ", tracked pairs = " << Occupancy()
+                << ", claims = " << policy_claims << std::endl;
+    }
+    if (cooperative) {
+      std::cout << "expansion claims: inserters = " << inserter_claims
+                << ", expander = " << expander_claims
+                << ", pending = " << expand_work << std::endl;
+    }
+    if (hot_cache != nullptr) {
+      hot_cache->Report();
+    }
+    if (segment_filters) {
+      Report_Segment_Filters();
+    }
   }
 
   /**
    * @brief Expand operation
    * @param numBuckets the number of "Buckets" to expand
-   * @return void
+   * @return the index of the first bucket exposed by this expansion
    */
-  inline void Expand(uint32_t numBuckets) {
+  inline uint32_t Expand(uint32_t numBuckets) {
   RE_EXPAND:
     uint64_t old_N_next = dir.N_next;
     uint32_t old_N = old_N_next >> 32;
@@ -2121,6 +2456,7 @@ class Linear : public Hash<T> {
     if ((uint32_t)new_N_next == 0) {
       printf("expand to level %lu\n", new_N_next >> 32);
     }
+    return pow2(old_N) + old_next;
   }
 
 #ifdef PMEM
@@ -2130,6 +2466,26 @@ class Linear : public Hash<T> {
   Directory<T> dir;
   int lock;
   bool clean;
+  /*cooperative expansion, DRAM state that is reset when the pool is reopened*/
+  bool cooperative;
+  uint64_t expand_work; /*posted expansion claims that are not taken yet*/
+  uint64_t inserter_claims;
+  uint64_t expander_claims;
+  double target_load_factor;
+  bool stop_expander;
+  std::thread *expander;
+  /*load factor policy, DRAM state as well*/
+  double max_load_factor;
+  double min_load_factor;
+  int load_check_lock;
+  int shrink_lock;
+  uint64_t shrink_count;
+  uint64_t released_arrays;
+  uint64_t policy_claims;
+  OccupancyStripe *occupancy;
+  hotcache::HotCache *hot_cache; /*DRAM, reset when the pool is reopened*/
+  bool segment_filters;
+  bool filters_used; /*set for good once a run gave the tables filters*/
 };
 
 template <class T>
@@ -2138,6 +2494,10 @@ Linear<T>::Linear(PMEMobjpool *_pool) {
   pool_addr = _pool;
   lock = 0;
   clean = false;
+  filters_used = false;
+  Reset_Expansion_State();
+  dir.shrink_from = 0;
+  dir.shrink_committed = 0;
   dir.N_next = baseShifBits << 32;
   std::cout << "Table size is " << sizeof(Table<T>) << std::endl;
   memset(dir._, 0, directorySize * sizeof(uint64_t));
@@ -2156,56 +2516,259 @@ Linear<T>::Linear(PMEMobjpool *_pool) {
 template <class T>
 Linear<T>::Linear(void) {
   std::cout << "Reinitialize Up for linear hashing" << std::endl;
+  Reset_Expansion_State();
+  if (filters_used) Reset_Segment_Filters();
+}
+
+/* The filters live in DRAM, so the pointers left in the tables by a
+ * previous run are dropped when the pool is reopened, if it had any*/
+template <class T>
+void Linear<T>::Reset_Segment_Filters() {
+  Table<T> *RESERVED = reinterpret_cast<Table<T> *>(-1);
+  for (uint32_t i = 0; i < directorySize; ++i) {
+    if (dir._[i] == NULL || dir._[i] == RESERVED) continue;
+    Table<T> *seg = (Table<T> *)((uint64_t)dir._[i] & (~recoverLockBit));
+    for (uint32_t j = 0; j < SEG_SIZE_BY_SEGARR_ID(i); ++j) {
+      seg[j].seg_filter = nullptr;
+    }
+  }
+}
+
+/* build the filters of the initialized tables, called before any operation
+ * starts; a table gets its filter from its buddy when it is split*/
+template <class T>
+void Linear<T>::EnableSegmentFilters() {
+  if (segment_filters) return;
+  filters_used = true;
+  Allocator::Persist(&filters_used, sizeof(filters_used));
+  uint32_t exposed = pow2(dir.N_next >> 32) + (uint32_t)dir.N_next;
+  for (uint32_t x = 0; x < exposed; ++x) {
+    Table<T> *target = Locate_Table(x);
+    if (target != nullptr && target->bucket->test_initialize()) {
+      target->Build_Filter();
+    }
+  }
+  segment_filters = true;
+}
+
+template <class T>
+void Linear<T>::Report_Segment_Filters() {
+  uint64_t segments = 0;
+  uint64_t bits = 0;
+  uint32_t exposed = pow2(dir.N_next >> 32) + (uint32_t)dir.N_next;
+  for (uint32_t x = 0; x < exposed; ++x) {
+    uint32_t dir_idx, offset;
+    SEG_IDX_OFFSET(x, dir_idx, offset);
+    Table<T> *curr_table =
+        (Table<T> *)((uint64_t)(dir._[dir_idx]) & (~recoverLockBit)) + offset;
+    if (curr_table->seg_filter != nullptr) {
+      segments++;
+      bits += curr_table->seg_filter->Bits_Set();
+    }
+  }
+  filter::Report(segments, bits);
+}
+
+template <class T>
+void Linear<T>::EnableHotCache(size_t size_mb) {
+  if constexpr (!std::is_pointer_v<T>) {
+    if (hot_cache != nullptr || size_mb == 0) return;
+    hot_cache = new hotcache::HotCache(size_mb);
+  } else {
+    LOG("the hot-key cache only applies to fixed-length keys");
+  }
 }
 
 template <class T>
 Linear<T>::~Linear(void) {
   // TO-DO
+  Release_Occupancy();
 }
 
+/* Shrink by kExpandUnit tables: the last tables are merged back into their
+ * buddies and N_next moves backwards, the mirror of an expansion. The tables
+ * are locked in descending index order as in Split, so a retracted table
+ * cannot be split or written while N_next moves. The shrink is logged in the
+ * directory so that Recover_Shrink can redo an interrupted merge; returns
+ * false if there is nothing to shrink or an expansion raced with it*/
 template <class T>
-bool Linear<T>::TryMerge(uint64_t x, Table<T> *shrunk_table) {
-  /* Get all of the locks*/
-  for (int i = 0; i < kNumBucket; ++i) {
-    Bucket<T> *curr_bucket = shrunk_table->bucket + i;
-    curr_bucket->get_lock();
-  }
+bool Linear<T>::TryMerge() {
+  int unlocked = 0;
+  if (!CAS(&shrink_lock, &unlocked, 1)) return false;
 
-  if (shrunk_table->state != 0) {
-    /* If its buddy is still in a unmerged state, just give up the merge
-     * operation*/
-    uint64_t idx, base_diff;
-    Table<T> *expand_table =
-        shrunk_table->get_expan_table(x, &idx, &base_diff, &dir);
-    if ((expand_table != NULL) && (expand_table->state == 1)) {
+  uint64_t old_N_next = dir.N_next;
+  uint32_t N = old_N_next >> 32;
+  uint32_t next = (uint32_t)old_N_next;
+  if (next == 0) {
+    if (N <= baseShifBits) {
+      __atomic_store_n(&shrink_lock, 0, __ATOMIC_RELEASE);
       return false;
     }
+    N--;
+    next = pow2(N);
+  }
+  uint64_t new_N_next = ((uint64_t)N << 32) + next - kExpandUnit;
+  uint32_t last = pow2(N) + next; /*the tables [last - kExpandUnit, last)*/
+  pmstat::Scope merge_scope(pmstat::kMerge);
 
-    /*Get all the locks from original table*/
-    Table<T> *org_table =
-        shrunk_table->get_org_table(x, &idx, &base_diff, &dir);
-    for (int i = 0; i < kNumBucket; ++i) {
-      Bucket<T> *curr_bucket = org_table->bucket + i;
-      curr_bucket->get_lock();
+  /*the shrink lock keeps the arrays of exposed tables from being released*/
+  Table<T> *shrunk[kExpandUnit];
+  Table<T> *org[kExpandUnit];
+  for (uint32_t i = 0; i < kExpandUnit; ++i) {
+    shrunk[i] = Locate_Table(last - kExpandUnit + i);
+    org[i] = Locate_Table(next - kExpandUnit + i);
+    assert(shrunk[i] != nullptr && org[i] != nullptr);
+  }
+  for (int i = kExpandUnit - 1; i >= 0; --i) {
+    for (int j = 0; j < kNumBucket; ++j) shrunk[i]->bucket[j].get_lock();
+  }
+  for (int i = kExpandUnit - 1; i >= 0; --i) {
+    for (int j = 0; j < kNumBucket; ++j) org[i]->bucket[j].get_lock();
+  }
+
+  dir.shrink_from = old_N_next;
+  dir.shrink_committed = 0;
+  Allocator::Persist(&dir.shrink_from, sizeof(uint64_t) * 2);
+  bool committed = CAS(&dir.N_next, &old_N_next, new_N_next);
+  if (committed) {
+    Allocator::Persist(&dir.N_next, sizeof(uint64_t));
+    dir.shrink_committed = 1;
+    Allocator::Persist(&dir.shrink_committed, sizeof(uint64_t));
+    for (uint32_t i = 0; i < kExpandUnit; ++i) {
+      /*an unsplit table still has its pairs in the buddy*/
+      if (shrunk[i]->bucket->test_initialize()) {
+        org[i]->Merge(shrunk[i]);
+        org[i]->Persist_With_Chain();
+        /*rebuilt rather than merged to shed the bits of deleted pairs*/
+        if (org[i]->seg_filter != nullptr) org[i]->Build_Filter();
+      }
+      shrunk[i]->Clear();
     }
+  }
+  dir.shrink_from = 0;
+  Allocator::Persist(&dir.shrink_from, sizeof(uint64_t));
 
-    /*Do the merge operation*/
-    org_table->Merge(shrunk_table);
-    shrunk_table->state = 0;
+  for (uint32_t i = 0; i < kExpandUnit; ++i) {
+    for (int j = 0; j < kNumBucket; ++j) {
+      org[i]->bucket[j].release_lock();
+      shrunk[i]->bucket[j].release_lock();
+    }
   }
+  if (committed) {
+    ADD(&shrink_count, 1);
+    Release_Segment_Arrays();
+  }
+  __atomic_store_n(&shrink_lock, 0, __ATOMIC_RELEASE);
+  return committed;
+}
 
-  for (int i = 0; i < kNumBucket; ++i) {
-    Bucket<T> *curr_bucket = shrunk_table->bucket + i;
-    curr_bucket->release_lock();
+/* Free the segment arrays beyond the one right after the last exposed table.
+ * That spare array is kept since a racing Expand may expose it; an array
+ * further away can only be exposed after N_next moved, which is checked
+ * after the array is reserved. The caller holds the shrink lock*/
+template <class T>
+void Linear<T>::Release_Segment_Arrays() {
+#ifndef PREALLOC
+  Table<T> *RESERVED = reinterpret_cast<Table<T> *>(-1);
+  auto last_array = [this]() {
+    uint64_t old_N_next = LOAD(&dir.N_next);
+    uint32_t dir_idx, offset;
+    SEG_IDX_OFFSET(pow2(old_N_next >> 32) + (uint32_t)old_N_next - 1, dir_idx,
+                   offset);
+    return dir_idx;
+  };
+
+  for (uint32_t k = directorySize - 1; k >= last_array() + 2; --k) {
+    Table<T> *seg = dir._[k];
+    if (seg == NULL || seg == RESERVED) continue;
+    if (!CAS(&dir._[k], &seg, RESERVED)) break;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (k < last_array() + 2) {
+      STORE(&dir._[k], seg);
+      break;
+    }
+
+    auto reserve_item = Allocator::ReserveItem();
+    TX_BEGIN(pool_addr) {
+      pmemobj_tx_add_range_direct(reserve_item, sizeof(*reserve_item));
+      pmemobj_tx_add_range_direct(&dir._[k], sizeof(Table<T> *));
+      Allocator::Free(reserve_item, reinterpret_cast<Table<T> *>(
+                                        (uint64_t)seg & (~recoverLockBit)));
+      dir._[k] = NULL;
+    }
+    TX_ONABORT { std::cout << "TXN fails during shrinking" << std::endl; }
+    TX_END
+    ADD(&released_arrays, 1);
   }
+#endif
+}
 
-  /*Try to reset the N_next to the normal state*/
-  uint64_t old_N_next = dir->N_next;
-  uint32_t right_index = pow2(old_N_next >> 32) + (uint32_t)old_N_next;
+/*redo a shrink interrupted by a crash, single-threaded*/
+template <class T>
+void Linear<T>::Recover_Shrink() {
+  if (dir.shrink_from == 0) return;
+  uint32_t N = dir.shrink_from >> 32;
+  uint32_t next = (uint32_t)dir.shrink_from;
+  if (next == 0) {
+    N--;
+    next = pow2(N);
+  }
+  uint32_t last = pow2(N) + next;
+  uint32_t exposed = pow2(dir.N_next >> 32) + (uint32_t)dir.N_next;
+
+  /*nothing has been merged before the commit; after it, the tables may
+   * have been exposed again by an expansion, then they are split from their
+   * buddies right away, since a lazy split would take the stale seg_version of
+   * a buddy that is not recovered yet*/
+  if (dir.shrink_committed || exposed < last) {
+    for (uint32_t x = last - kExpandUnit; x < last; ++x) {
+      uint32_t dir_idx, offset;
+      SEG_IDX_OFFSET(x, dir_idx, offset);
+      Table<T> *shrunk =
+          (Table<T> *)((uint64_t)(dir._[dir_idx]) & (~recoverLockBit)) +
+          offset;
+      uint64_t org_idx, base_level;
+      Table<T> *org_table =
+          shrunk->get_org_table(x, &org_idx, &base_level, &dir);
+      bool initialized = shrunk->bucket->test_initialize();
+      if (initialized) {
+        org_table->recoverMetadata();
+        org_table->Merge(shrunk, true);
+        org_table->Persist_With_Chain();
+        if (org_table->seg_filter != nullptr) org_table->Build_Filter();
+      }
+      shrunk->Clear();
+      for (int i = 0; i < kNumBucket; ++i) {
+        shrunk->bucket[i].resetLock();
+      }
+      Allocator::Persist(shrunk->bucket, sizeof(Bucket<T>) * kNumBucket);
+      if (initialized && x < exposed) {
+        shrunk->Split(org_table, base_level, org_idx, &dir);
+      }
+    }
+  }
+  dir.shrink_from = 0;
+  dir.shrink_committed = 0;
+  Allocator::Persist(&dir.shrink_from, sizeof(uint64_t) * 2);
+}
 
-  /*Reset the N_next to the new state*/
-  /*recursively merge the (org)table */
-  return true;
+/* The segment array is loaded once: a shrink may swap it for RESERVED and
+ * free it at any time, so checking one load and indexing another could use a
+ * freed array. Returns nullptr if the array of x was released, which only
+ * happens if x was computed from a stale N_next*/
+template <class T>
+Table<T> *Linear<T>::Locate_Table(uint32_t x) {
+  uint32_t dir_idx;
+  uint32_t offset;
+  SEG_IDX_OFFSET(x, dir_idx, offset);
+  Table<T> *seg_array = LOAD(&dir._[dir_idx]);
+  if (Released(seg_array)) return nullptr;
+  if (reinterpret_cast<uint64_t>(seg_array) & recoverLockBit) {
+    recoverSegment(&dir._[dir_idx], x, dir_idx, offset);
+    seg_array = LOAD(&dir._[dir_idx]);
+    if (Released(seg_array)) return nullptr;
+  }
+  return (Table<T> *)((uint64_t)seg_array & (~recoverLockBit)) + offset;
 }
 
 template <class T>
@@ -2215,6 +2778,7 @@ void Linear<T>::Recovery() {
     return;
   }
   Allocator::EpochRecovery();
+  Recover_Shrink();
   uint64_t old_N_next = dir.N_next;
   uint32_t N = old_N_next >> 32;
   uint32_t next = (uint32_t)old_N_next;
@@ -2250,6 +2814,50 @@ void Linear<T>::Recovery() {
   }
 }
 
+/* Recover the segments up to recovered_index that are still behind the crash
+ * version, the same way Locate_Table does on the first access.*/
+template <class T>
+void Linear<T>::EagerRecovery(uint32_t num_threads) {
+  recovery::Run("Dash-LH", dir.recovered_index + 1, num_threads,
+                [&](uint64_t x) -> uint64_t {
+                  uint32_t dir_idx;
+                  uint32_t offset;
+                  SEG_IDX_OFFSET(static_cast<uint32_t>(x), dir_idx, offset);
+                  if (!(reinterpret_cast<uint64_t>(dir._[dir_idx]) &
+                        recoverLockBit)) {
+                    return 0;
+                  }
+                  Table<T> *target =
+                      (Table<T> *)((uint64_t)(dir._[dir_idx]) &
+                                   (~recoverLockBit)) +
+                      offset;
+                  if (target->seg_version == dir.crash_version) return 0;
+                  recoverSegment(&dir._[dir_idx], x, dir_idx, offset);
+                  return 1;
+                });
+}
+
+/* Walking the pairs of a table reads every bucket of its overflow chain and
+ * the variable-length keys*/
+template <class T>
+void Linear<T>::WarmUp(uint32_t num_threads) {
+  uint32_t exposed = pow2(dir.N_next >> 32) + (uint32_t)dir.N_next;
+  warmup::Run("Dash-LH", exposed, num_threads, [&](uint64_t x) -> uint64_t {
+    uint32_t dir_idx;
+    uint32_t offset;
+    SEG_IDX_OFFSET(static_cast<uint32_t>(x), dir_idx, offset);
+    Table<T> *seg_array = LOAD(&dir._[dir_idx]);
+    if (Released(seg_array)) return 0;
+    Table<T> *target =
+        (Table<T> *)((uint64_t)seg_array & (~recoverLockBit)) + offset;
+    uint64_t pages = warmup::Touch(target, sizeof(Table<T>));
+    warmup::Sink<T> sink;
+    auto epoch_guard = Allocator::AquireEpochGuard();
+    target->Stage_Pairs(&sink);
+    return pages;
+  });
+}
+
 template <class T>
 void Linear<T>::recoverSegment(Table<T> **seg_ptr, size_t index, size_t dir_idx,
                                size_t offset) {
@@ -2285,10 +2893,12 @@ RETRY:
     }
 
     org_table->Merge(target, true);
-    for (int i = 0; i, kNumBucket; ++i) {
+    for (int i = 0; i < kNumBucket; ++i) {
       auto curr_bucket = target->bucket + i;
       curr_bucket->unset_initialize();
     }
+    if (org_table->seg_filter != nullptr) org_table->Build_Filter();
+    target->Drop_Filter();
 
     target->state = 0;
     Allocator::Persist(&target->state, sizeof(target->state));
@@ -2308,219 +2918,366 @@ RETRY:
   }
 }
 
+/* Cooperative expansion: an inserter that finds its table full posts one
+ * claim to expand_work and returns after taking at most one claim. Every claim
+ * exposes kExpandUnit buckets through Expand and splits them eagerly, so the
+ * split work is spread over the claimers instead of being paid by whoever
+ * touches a fresh bucket first, and only claimers race on N_next. The expander
+ * thread samples the load factor and posts batches of claims while it stays
+ * above the target.*/
 template <class T>
-int Linear<T>::Insert(T key, Value_t value, bool is_in_epoch) {
-  if (!is_in_epoch) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
-    return Insert(key, value);
+void Linear<T>::EnableCooperativeExpansion(double _target_load_factor) {
+  target_load_factor = _target_load_factor;
+  cooperative = true;
+  if (target_load_factor > 0 && expander == nullptr) {
+    stop_expander = false;
+    expander = new std::thread(&Linear<T>::Expander_Loop, this);
   }
-  return Insert(key, value);
 }
 
+/*returns the number of claims taken; the caller must be epoch protected*/
 template <class T>
-int Linear<T>::Insert(T key, Value_t value) {
-  uint64_t key_hash;
-  if constexpr (std::is_pointer_v<T>) {
-    key_hash = h(key->key, key->length);
-  } else {
-    key_hash = h(&key, sizeof(key));
+uint32_t Linear<T>::Help_Expand(uint64_t *claims, uint32_t max_claims) {
+  uint32_t taken = 0;
+  while (taken < max_claims) {
+    uint64_t work = LOAD(&expand_work);
+    if (work == 0) break;
+    if (!CAS(&expand_work, &work, work - 1)) continue;
+    uint32_t first = Expand(kExpandUnit);
+    for (uint32_t i = 0; i < kExpandUnit; ++i) {
+      Split_Exposed(first + i);
+    }
+    taken++;
+  }
+  if (taken) ADD(claims, taken);
+  return taken;
+}
+
+/*same as the lazy split in Table::Insert, but done right after the expansion
+ * exposed bucket x, so it needs no verification against N_next*/
+template <class T>
+void Linear<T>::Split_Exposed(uint32_t x) {
+  Table<T> *target = Locate_Table(x);
+  if (target == nullptr || target->bucket->test_initialize()) return;
+
+  for (int i = 0; i < kNumBucket; ++i) {
+    Bucket<T> *curr_bucket = target->bucket + i;
+    curr_bucket->get_lock();
   }
-RETRY:
+  /*an inserter may have split it while we were taking the locks, or a shrink
+   * may have retracted it*/
+  uint64_t old_N_next = dir.N_next;
+  if (!target->bucket->test_initialize() &&
+      x < pow2(old_N_next >> 32) + (uint32_t)old_N_next) {
+    uint64_t org_idx;
+    uint64_t base_level;
+    Table<T> *org_table =
+        target->get_org_table(x, &org_idx, &base_level, &dir);
+    target->Split(org_table, base_level, org_idx, &dir);
+  }
+  for (int i = 0; i < kNumBucket; ++i) {
+    Bucket<T> *curr_bucket = target->bucket + i;
+    curr_bucket->release_lock();
+  }
+}
+
+/* The walkers take the tables exposed when the walk starts by index ranges,
+ * then the tables exposed meanwhile. A table not split yet has its pairs in
+ * its buddy and could be split right after the buddy was copied, so it is
+ * split before it is copied; a pair moved by a split is then copied from the
+ * buddy, the new table or both. The shrink lock keeps N_next from moving
+ * backwards and every segment array in place.*/
+template <class T>
+uint64_t Linear<T>::Checkpoint(const char *path, uint32_t num_threads,
+                               uint64_t mb_per_sec, bool with_hashes) {
+  if (num_threads == 0) num_threads = 1;
+  int unlocked = 0;
+  while (!CAS(&shrink_lock, &unlocked, 1)) {
+    unlocked = 0;
+    _mm_pause();
+  }
+  checkpoint::Exporter exporter(path, "Dash-LH", !std::is_pointer_v<T>,
+                                with_hashes, mb_per_sec, 0);
+  auto exposed = [this]() {
+    uint64_t old_N_next = LOAD(&dir.N_next);
+    return pow2(old_N_next >> 32) + (uint32_t)old_N_next;
+  };
+  auto walk = [&](uint32_t begin, uint32_t end) {
+    checkpoint::Sink<T> sink(&exporter);
+    for (uint32_t x = begin; x < end; ++x) {
+      Split_Exposed(x);
+      auto epoch_guard = Allocator::AquireEpochGuard();
+      Table<T> *target = Locate_Table(x);
+      if (target != nullptr) target->Export(&sink, &exporter);
+    }
+  };
+
+  uint32_t end = exposed();
+  uint32_t stride = (end + num_threads - 1) / num_threads;
+  std::vector<std::thread> threads;
+  for (uint32_t begin = stride; begin < end; begin += stride) {
+    threads.emplace_back(walk, begin, std::min(begin + stride, end));
+  }
+  walk(0, std::min(stride, end));
+  for (auto &thread : threads) thread.join();
+  /*expansions only add tables, and the ones added during this pass are
+   * taken by the next*/
+  for (uint32_t begin = end; (end = exposed()) > begin; begin = end) {
+    walk(begin, end);
+  }
+  __atomic_store_n(&shrink_lock, 0, __ATOMIC_RELEASE);
+  return exporter.Finish();
+}
+
+/*the sampling reads the tables without locks, the estimate is approximate*/
+template <class T>
+double Linear<T>::Sample_Load_Factor(uint64_t *seed) {
   uint64_t old_N_next = dir.N_next;
   uint32_t N = old_N_next >> 32;
   uint32_t next = (uint32_t)old_N_next;
-  auto x = IDX(key_hash, N);
-  if (x < next) {
-    x = IDX(key_hash, N + 1);
+  uint32_t occupied_bucket = pow2(N) + next;
+  uint64_t count = 0;
+  uint64_t sampled = 0;
+
+  for (uint32_t s = 0; s < kLoadSampleSize; ++s) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    uint32_t x = *seed % occupied_bucket;
+    uint32_t dir_idx;
+    uint32_t offset;
+    SEG_IDX_OFFSET(x, dir_idx, offset);
+    Table<T> *curr_table =
+        (Table<T> *)((uint64_t)(dir._[dir_idx]) & (~recoverLockBit)) + offset;
+    if (!curr_table->bucket->test_initialize()) continue;
+
+    for (int j = 0; j < kNumBucket; ++j) {
+      count += GET_COUNT(curr_table->bucket[j].bitmap);
+    }
+    for (int j = 0; j < stashBucket; ++j) {
+      count += GET_COUNT(curr_table->stash[j].bitmap);
+    }
+    overflowBucket<T> *next_bucket = curr_table->stash->next;
+    while (next_bucket != NULL) {
+      count += GET_COUNT(next_bucket->bitmap);
+      next_bucket = next_bucket->next;
+    }
+    sampled++;
   }
 
-  uint32_t dir_idx;
-  uint32_t offset;
-  SEG_IDX_OFFSET(static_cast<uint32_t>(x), dir_idx, offset);
-  Table<T> *target = dir._[dir_idx] + offset;
-  if (reinterpret_cast<uint64_t>(dir._[dir_idx]) & recoverLockBit) {
-    recoverSegment(&dir._[dir_idx], x, dir_idx, offset);
-    target =
+  if (sampled == 0) return 0;
+  return (double)count /
+         (sampled * (kNumBucket + stashBucket) * kNumPairPerBucket);
+}
+
+template <class T>
+void Linear<T>::Expander_Loop() {
+  uint64_t seed = reinterpret_cast<uint64_t>(this) | 1;
+  while (!LOAD(&stop_expander)) {
+    bool expanded = false;
+    {
+      auto epoch_guard = Allocator::AquireEpochGuard();
+      if (Sample_Load_Factor(&seed) > target_load_factor) {
+        ADD(&expand_work, kExpanderBatch);
+        Help_Expand(&expander_claims, kExpanderBatch);
+        expanded = true;
+      }
+    }
+    if (!expanded) msleep(kExpanderInterval);
+  }
+}
+
+template <class T>
+void Linear<T>::Stop_Expander() {
+  if (expander != nullptr) {
+    STORE(&stop_expander, true);
+    expander->join();
+    delete expander;
+    expander = nullptr;
+  }
+}
+
+/* The policy keeps a DRAM count of the pairs, striped per thread, and every
+ * kLoadCheckInterval inserts of a stripe compares it with the capacity of the
+ * exposed tables. The count is rebuilt by a scan when the policy is enabled,
+ * which should happen before the workload starts.*/
+template <class T>
+void Linear<T>::SetLoadFactorPolicy(double _max_load_factor,
+                                    double _min_load_factor) {
+  if (occupancy == nullptr) {
+    occupancy = new OccupancyStripe[kOccupancyStripes];
+  }
+  memset(occupancy, 0, sizeof(OccupancyStripe) * kOccupancyStripes);
+  if (_max_load_factor > 0) {
+    occupancy[0].count = Count_Pairs();
+  }
+  min_load_factor = _min_load_factor;
+  max_load_factor = _max_load_factor;
+}
+
+template <class T>
+int64_t Linear<T>::Occupancy() {
+  int64_t sum = 0;
+  for (uint32_t i = 0; i < kOccupancyStripes; ++i) {
+    sum += LOAD(&occupancy[i].count);
+  }
+  return sum;
+}
+
+template <class T>
+uint64_t Linear<T>::Count_Pairs() {
+  uint64_t old_N_next = dir.N_next;
+  uint32_t occupied_bucket = pow2(old_N_next >> 32) + (uint32_t)old_N_next;
+  uint64_t count = 0;
+  for (uint32_t i = 0; i < occupied_bucket; ++i) {
+    uint32_t dir_idx;
+    uint32_t offset;
+    SEG_IDX_OFFSET(i, dir_idx, offset);
+    Table<T> *curr_table =
         (Table<T> *)((uint64_t)(dir._[dir_idx]) & (~recoverLockBit)) + offset;
+    /*pairs of an unsplit table are still counted in its original table*/
+    if (!curr_table->bucket->test_initialize()) continue;
+    for (int j = 0; j < kNumBucket; ++j) {
+      count += GET_COUNT(curr_table->bucket[j].bitmap);
+    }
+    for (int j = 0; j < stashBucket; ++j) {
+      count += GET_COUNT(curr_table->stash[j].bitmap);
+    }
+    overflowBucket<T> *next_bucket = curr_table->stash->next;
+    while (next_bucket != NULL) {
+      count += GET_COUNT(next_bucket->bitmap);
+      next_bucket = next_bucket->next;
+    }
   }
+  return count;
+}
 
-  auto ret = target->Insert(key, value, key_hash, &dir, x, N, next);
+/*one thread checks at a time, the others keep inserting*/
+template <class T>
+void Linear<T>::Check_Load_Factor() {
+  int unlocked = 0;
+  if (!CAS(&load_check_lock, &unlocked, 1)) return;
 
-  if (ret == -2) {
-    goto RETRY;
-  } else if (ret == -1) {
-    Expand(2);
-  } else if (ret == -3){
-    return -1;
+  uint64_t old_N_next = dir.N_next;
+  int64_t occupied_bucket = pow2(old_N_next >> 32) + (uint32_t)old_N_next;
+  double table_capacity =
+      (kNumBucket + stashBucket) * kNumPairPerBucket * max_load_factor;
+  int64_t missing = static_cast<int64_t>(Occupancy() / table_capacity) + 1 -
+                    occupied_bucket;
+  if (missing > 0) {
+    uint32_t claims = (missing + kExpandUnit - 1) / kExpandUnit;
+    if (claims > kExpanderBatch) claims = kExpanderBatch;
+    if (cooperative) {
+      ADD(&expand_work, claims);
+      Help_Expand(&policy_claims, claims);
+    } else {
+      for (uint32_t i = 0; i < claims; ++i) {
+        Expand(kExpandUnit);
+      }
+      ADD(&policy_claims, claims);
+    }
+  } else if (min_load_factor > 0) {
+    /*the tables needed at min_load_factor, shrink down to them*/
+    int64_t surplus =
+        occupied_bucket - 1 -
+        static_cast<int64_t>(Occupancy() / table_capacity * max_load_factor /
+                             min_load_factor);
+    int64_t merges = surplus / static_cast<int64_t>(kExpandUnit);
+    if (merges > kExpanderBatch) merges = kExpanderBatch;
+    for (int64_t i = 0; i < merges; ++i) {
+      if (!TryMerge()) break;
+    }
   }
+  __atomic_store_n(&load_check_lock, 0, __ATOMIC_RELEASE);
+}
 
-  return 0;
+template <class T>
+int Linear<T>::Insert(T key, Value_t value, Session &session) {
+  session.Tick();
+  return Insert(key, value);
 }
 
 template <class T>
-Value_t Linear<T>::Get(T key, bool is_in_epoch) {
-  if (!is_in_epoch) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
-    return Get(key);
+int Linear<T>::Insert(T key, Value_t value) {
+  if constexpr (!std::is_pointer_v<T>) {
+    if (hot_cache != nullptr) {
+      uint64_t key_hash = h(&key, sizeof(key));
+      hot_cache->BeginWrite(key_hash);
+      auto ret = Insert_Pair(key, value);
+      hot_cache->EndWrite(key_hash);
+      return ret;
+    }
   }
+  return Insert_Pair(key, value);
+}
 
+template <class T>
+int Linear<T>::Insert_Pair(T key, Value_t value) {
   uint64_t key_hash;
   if constexpr (std::is_pointer_v<T>) {
     key_hash = h(key->key, key->length);
   } else {
     key_hash = h(&key, sizeof(key));
   }
-  auto meta_hash = META_HASH(key_hash);
-  auto y = BUCKET_INDEX(key_hash);
+  contention::Backoff backoff;
 RETRY:
   uint64_t old_N_next = dir.N_next;
   uint32_t N = old_N_next >> 32;
   uint32_t next = (uint32_t)old_N_next;
-
   auto x = IDX(key_hash, N);
   if (x < next) {
     x = IDX(key_hash, N + 1);
   }
 
-  uint32_t dir_idx;
-  uint32_t offset;
-  SEG_IDX_OFFSET(static_cast<uint32_t>(x), dir_idx, offset);
-  Table<T> *target = dir._[dir_idx] + offset;
+  Table<T> *target = Locate_Table(static_cast<uint32_t>(x));
+  if (target == nullptr) goto RETRY;
 
-  if (reinterpret_cast<uint64_t>(dir._[dir_idx]) & recoverLockBit) {
-    recoverSegment(&dir._[dir_idx], x, dir_idx, offset);
-    target =
-        (Table<T> *)((uint64_t)(dir._[dir_idx]) & (~recoverLockBit)) + offset;
-  }
-
-  Bucket<T> *target_bucket = target->bucket + y;
-  Bucket<T> *neighbor_bucket = target->bucket + ((y + 1) & bucketMask);
-  uint32_t old_version = target_bucket->version_lock;
-  uint32_t old_neighbor_version = neighbor_bucket->version_lock;
+  auto ret = target->Insert(key, value, key_hash, &dir, x, N, next);
 
-  if ((old_version & lockSet) || (old_neighbor_version & lockSet)) {
+  if (ret == -2) {
+    backoff.Pause();
     goto RETRY;
-  }
-
-  if (old_version & initialSet) {
-    uint64_t new_N_next = dir.N_next;
-    uint32_t new_N = new_N_next >> 32;
-    uint32_t new_next = (uint32_t)new_N_next;
-    if (((next <= x) && (new_next > x)) || (new_N != N)) {
-      goto RETRY;
-    }
-
-    auto ret = target_bucket->check_and_get(meta_hash, key, false);
-    if (target_bucket->test_lock_version_change(old_version)) {
-      goto RETRY;
-    }
-
-    if (ret != NONE) {
-      return ret;
-    }
-
-    /*no need for verification procedure, we use the version number of
-     * target_bucket to test whether the bucket has ben spliteted*/
-    ret = neighbor_bucket->check_and_get(meta_hash, key, true);
-    if (neighbor_bucket->test_lock_version_change(old_neighbor_version)) {
-      goto RETRY;
-    }
-    if (ret != NONE) {
-      return ret;
-    }
-
-    if (target_bucket->test_stash_check()) {
-      auto test_stash = false;
-      if (target_bucket->test_overflow()) {
-        test_stash = true;
-      } else {
-        // search in the original bucket
-        int mask = target_bucket->overflowBitmap & overflowBitmapMask;
-        if (mask != 0) {
-          for (int i = 0; i < 4; ++i) {
-            if (CHECK_BIT(mask, i) &&
-                (target_bucket->finger_array[14 + i] == meta_hash) &&
-                (((1 << i) & target_bucket->overflowMember) == 0)) {
-              test_stash = true;
-              goto TEST_STASH;
-            }
-          }
-        }
-
-        mask = neighbor_bucket->overflowBitmap & overflowBitmapMask;
-        if (mask != 0) {
-          for (int i = 0; i < 4; ++i) {
-            if (CHECK_BIT(mask, i) &&
-                (neighbor_bucket->finger_array[14 + i] == meta_hash) &&
-                (((1 << i) & neighbor_bucket->overflowMember) != 0)) {
-              test_stash = true;
-              break;
-            }
-          }
-        }
-      }
-    TEST_STASH:
-      if (test_stash == true) {
-        for (int i = 0; i < stashBucket; ++i) {
-          overflowBucket<T> *curr_bucket =
-              target->stash + ((i + (y & stashMask)) & stashMask);
-          auto ret = curr_bucket->check_and_get(meta_hash, key);
-          if (ret != NONE) {
-            if (target_bucket->test_lock_version_change(old_version)) {
-              goto RETRY;
-            }
-            return ret;
-          }
-        }
-
-        overflowBucket<T> *prev_bucket = target->stash;
-        overflowBucket<T> *next_bucket = target->stash->next;
-        while (next_bucket != NULL) {
-          auto ret = next_bucket->check_and_get(meta_hash, key);
-          if (ret != NONE) {
-            if (target_bucket->test_lock_version_change(old_version)) {
-              goto RETRY;
-            }
-            return ret;
-          }
-          prev_bucket = next_bucket;
-          next_bucket = next_bucket->next;
-        }
-      }
-    }
-  } else {
-    for (int i = 0; i < kNumBucket; ++i) {
-      Bucket<T> *curr_bucket = target->bucket + i;
-      curr_bucket->get_lock();
-    }
-
-    uint64_t new_N_next = dir.N_next;
-    uint32_t new_N = new_N_next >> 32;
-    uint32_t new_next = (uint32_t)new_N_next;
-    if (((next <= x) && (new_next > x)) || (new_N != N)) {
-      for (int i = 0; i < kNumBucket; ++i) {
-        Bucket<T> *curr_bucket = target->bucket + i;
-        curr_bucket->release_lock();
-      }
-      goto RETRY;
+  } else if (ret == -1) {
+    if (cooperative) {
+      /*post the work and take at most one claim, someone else may have
+       * taken it already*/
+      ADD(&expand_work, 1);
+      Help_Expand(&inserter_claims, 1);
+    } else {
+      Expand(2);
     }
+  } else if (ret == -3){
+    return -1;
+  }
 
-    uint64_t org_idx;
-    uint64_t base_level;
-    Table<T> *org_table = target->get_org_table(x, &org_idx, &base_level, &dir);
-    target->Split(org_table, base_level, org_idx, &dir);
+  if (max_load_factor > 0) Update_Occupancy(1);
+  return 0;
+}
 
-    for (int i = 0; i < kNumBucket; ++i) {
-      Bucket<T> *curr_bucket = target->bucket + i;
-      curr_bucket->release_lock();
-    }
-    goto RETRY;
-  }
-  return NONE;
+template <class T>
+Value_t Linear<T>::Get(T key, Session &session) {
+  session.Tick();
+  return Get(key);
 }
 
 template <class T>
 Value_t Linear<T>::Get(T key) {
+  if constexpr (!std::is_pointer_v<T>) {
+    if (hot_cache != nullptr) {
+      uint64_t key_hash = h(&key, sizeof(key));
+      Value_t value;
+      uint64_t tag;
+      if (hot_cache->Lookup(key, key_hash, &value, &tag)) return value;
+      value = Get_Pair(key);
+      hot_cache->Fill(key, key_hash, value, tag);
+      return value;
+    }
+  }
+  return Get_Pair(key);
+}
+
+template <class T>
+Value_t Linear<T>::Get_Pair(T key) {
   uint64_t key_hash;
   if constexpr (std::is_pointer_v<T>) {
     key_hash = h(key->key, key->length);
@@ -2529,7 +3286,9 @@ Value_t Linear<T>::Get(T key) {
   }
   auto meta_hash = META_HASH(key_hash);
   auto y = BUCKET_INDEX(key_hash);
+  contention::Backoff backoff;
 RETRY:
+  backoff.Retry(&contention::ContentionStats::reader_retries);
   uint64_t old_N_next = dir.N_next;
   uint32_t N = old_N_next >> 32;
   uint32_t next = (uint32_t)old_N_next;
@@ -2539,16 +3298,8 @@ RETRY:
     x = IDX(key_hash, N + 1);
   }
 
-  uint32_t dir_idx;
-  uint32_t offset;
-  SEG_IDX_OFFSET(static_cast<uint32_t>(x), dir_idx, offset);
-  Table<T> *target = dir._[dir_idx] + offset;
-
-  if (reinterpret_cast<uint64_t>(dir._[dir_idx]) & recoverLockBit) {
-    recoverSegment(&dir._[dir_idx], x, dir_idx, offset);
-    target =
-        (Table<T> *)((uint64_t)(dir._[dir_idx]) & (~recoverLockBit)) + offset;
-  }
+  Table<T> *target = Locate_Table(static_cast<uint32_t>(x));
+  if (target == nullptr) goto RETRY;
 
   Bucket<T> *target_bucket = target->bucket + y;
   Bucket<T> *neighbor_bucket = target->bucket + ((y + 1) & bucketMask);
@@ -2563,10 +3314,21 @@ RETRY:
     uint64_t new_N_next = dir.N_next;
     uint32_t new_N = new_N_next >> 32;
     uint32_t new_next = (uint32_t)new_N_next;
-    if (((next <= x) && (new_next > x)) || (new_N != N)) {
+    if (((next <= x) && (new_next > x)) || (new_N != N) ||
+        (x >= pow2(new_N) + new_next)) {
       goto RETRY;
     }
 
+    auto seg_filter = __atomic_load_n(&target->seg_filter, __ATOMIC_ACQUIRE);
+    if (seg_filter != nullptr && !seg_filter->Contains(key_hash)) {
+      /*a writer may have added the key after the versions were read*/
+      if (target_bucket->test_lock_version_change(old_version) ||
+          neighbor_bucket->test_lock_version_change(old_neighbor_version)) {
+        goto RETRY;
+      }
+      return NONE;
+    }
+
     auto ret = target_bucket->check_and_get(meta_hash, key, false);
     if (target_bucket->test_lock_version_change(old_version)) {
       goto RETRY;
@@ -2657,7 +3419,8 @@ RETRY:
     uint64_t new_N_next = dir.N_next;
     uint32_t new_N = new_N_next >> 32;
     uint32_t new_next = (uint32_t)new_N_next;
-    if (((next <= x) && (new_next > x)) || (new_N != N)) {
+    if (((next <= x) && (new_next > x)) || (new_N != N) ||
+        (x >= pow2(new_N) + new_next)) {
       for (int i = 0; i < kNumBucket; ++i) {
         Bucket<T> *curr_bucket = target->bucket + i;
         curr_bucket->release_lock();
@@ -2680,18 +3443,33 @@ RETRY:
 }
 
 template <class T>
-bool Linear<T>::Delete(T key, bool is_in_epoch) {
-  if (!is_in_epoch) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
-    return Delete(key);
-  }
+bool Linear<T>::Delete(T key, Session &session) {
+  session.Tick();
   return Delete(key);
 }
 
-/*Current version of Dash linear hashing does not support concurrent shrink
- * operation*/
 template <class T>
 bool Linear<T>::Delete(T key) {
+  bool ret;
+  if constexpr (!std::is_pointer_v<T>) {
+    if (hot_cache != nullptr) {
+      uint64_t key_hash = h(&key, sizeof(key));
+      hot_cache->BeginWrite(key_hash);
+      ret = Delete_Pair(key);
+      hot_cache->EndWrite(key_hash);
+    } else {
+      ret = Delete_Pair(key);
+    }
+  } else {
+    ret = Delete_Pair(key);
+  }
+  if (!ret) return false;
+  if (max_load_factor > 0) Update_Occupancy(-1);
+  return true;
+}
+
+template <class T>
+bool Linear<T>::Delete_Pair(T key) {
   uint64_t key_hash;
   if constexpr (std::is_pointer_v<T>) {
     key_hash = h(key->key, key->length);
@@ -2700,6 +3478,7 @@ bool Linear<T>::Delete(T key) {
   }
   auto meta_hash = META_HASH(key_hash);
   auto y = BUCKET_INDEX(key_hash);
+  contention::Backoff backoff;
 RETRY:
   uint64_t old_N_next = dir.N_next;
   uint32_t N = old_N_next >> 32;
@@ -2710,15 +3489,8 @@ RETRY:
     x = IDX(key_hash, N + 1);
   }
 
-  uint32_t dir_idx;
-  uint32_t offset;
-  SEG_IDX_OFFSET(static_cast<uint32_t>(x), dir_idx, offset);
-  Table<T> *target = dir._[dir_idx] + offset;
-  if (reinterpret_cast<uint64_t>(dir._[dir_idx]) & recoverLockBit) {
-    recoverSegment(&dir._[dir_idx], x, dir_idx, offset);
-    target =
-        (Table<T> *)((uint64_t)(dir._[dir_idx]) & (~recoverLockBit)) + offset;
-  }
+  Table<T> *target = Locate_Table(static_cast<uint32_t>(x));
+  if (target == nullptr) goto RETRY;
 
   uint32_t old_version;
   Bucket<T> *target_bucket = target->bucket + y;
@@ -2727,6 +3499,7 @@ RETRY:
   target_bucket->get_lock();
   if (!neighbor_bucket->try_get_lock()) {
     target_bucket->release_lock();
+    backoff.Spin(&contention::ContentionStats::trylock_failures);
     goto RETRY;
   }
 
@@ -2741,7 +3514,8 @@ RETRY:
     uint64_t new_N_next = dir.N_next;
     uint32_t new_N = new_N_next >> 32;
     uint32_t new_next = (uint32_t)new_N_next;
-    if (((next <= x) && (new_next > x)) || (new_N != N)) {
+    if (((next <= x) && (new_next > x)) || (new_N != N) ||
+        (x >= pow2(new_N) + new_next)) {
       for (int i = 0; i < kNumBucket; ++i) {
         Bucket<T> *curr_bucket = target->bucket + i;
         curr_bucket->release_lock();
@@ -2763,7 +3537,8 @@ RETRY:
     uint64_t new_N_next = dir.N_next;
     uint32_t new_N = new_N_next >> 32;
     uint32_t new_next = (uint32_t)new_N_next;
-    if (((next <= x) && (new_next > x)) || (new_N != N)) {
+    if (((next <= x) && (new_next > x)) || (new_N != N) ||
+        (x >= pow2(new_N) + new_next)) {
       target_bucket->release_lock();
       neighbor_bucket->release_lock();
       goto RETRY;
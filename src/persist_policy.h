@@ -0,0 +1,229 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Persistence policies behind Allocator::Persist. A policy writes back the
+// cache lines of a range (Flush) and orders the write-backs before the later
+// stores (Fence):
+//   None         eADR platforms and DRAM-backed pools, the caches are in the
+//                persistence domain, so nothing is written back
+//   CLWB         clwb + sfence, the lines stay cached
+//   CLFLUSHOPT   clflushopt + sfence, the lines are evicted
+//   NT           clwb + sfence, and the writers that can stream use
+//                non-temporal stores (kStreaming)
+//   PMDK         pmemobj_persist, which picks the instruction itself
+// A build can fix the policy with -DPERSIST_POLICY=PERSIST_<NAME>, otherwise
+// it is chosen at startup: CLWB or CLFLUSHOPT if CPUID reports them, PMDK
+// else. eADR is not visible through CPUID, so None is only taken on request.
+
+#pragma once
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef PMEM
+#include <libpmemobj.h>
+#endif
+
+#define PERSIST_PMDK 0
+#define PERSIST_NONE 1
+#define PERSIST_CLWB 2
+#define PERSIST_CLFLUSHOPT 3
+#define PERSIST_NT 4
+
+namespace persist {
+
+enum Policy : uint32_t {
+  kPmdk = PERSIST_PMDK,
+  kNone = PERSIST_NONE,
+  kClwb = PERSIST_CLWB,
+  kClflushopt = PERSIST_CLFLUSHOPT,
+  kNonTemporal = PERSIST_NT,
+};
+
+constexpr uint64_t kLineSize = 64;
+
+/*the encodings PMDK uses, so no -mclwb/-mclflushopt is needed*/
+inline void Clwb(const void *line) {
+  asm volatile(".byte 0x66; xsaveopt %0" : "+m"(*(volatile char *)line));
+}
+
+inline void Clflushopt(const void *line) {
+  asm volatile(".byte 0x66; clflush %0" : "+m"(*(volatile char *)line));
+}
+
+template <void (*WriteBack)(const void *)>
+inline void Flush_Lines(const void *ptr, size_t size) {
+  uint64_t line = reinterpret_cast<uint64_t>(ptr) & ~(kLineSize - 1);
+  uint64_t end = reinterpret_cast<uint64_t>(ptr) + size;
+  for (; line < end; line += kLineSize) {
+    WriteBack(reinterpret_cast<const void *>(line));
+  }
+}
+
+struct NoFlush {
+  static constexpr bool kStreaming = false;
+  static inline void Flush(const void *, size_t) {}
+  /*stores become durable in program order, only the compiler may reorder*/
+  static inline void Fence() { asm volatile("" ::: "memory"); }
+};
+
+struct ClwbFence {
+  static constexpr bool kStreaming = false;
+  static inline void Flush(const void *ptr, size_t size) {
+    Flush_Lines<Clwb>(ptr, size);
+  }
+  static inline void Fence() { asm volatile("sfence" ::: "memory"); }
+};
+
+struct ClflushoptFence {
+  static constexpr bool kStreaming = false;
+  static inline void Flush(const void *ptr, size_t size) {
+    Flush_Lines<Clflushopt>(ptr, size);
+  }
+  static inline void Fence() { asm volatile("sfence" ::: "memory"); }
+};
+
+struct NonTemporal {
+  static constexpr bool kStreaming = true;
+  static inline void Flush(const void *ptr, size_t size) {
+    Flush_Lines<Clwb>(ptr, size);
+  }
+  static inline void Fence() { asm volatile("sfence" ::: "memory"); }
+};
+
+#ifdef PMEM
+inline PMEMobjpool *pmdk_pool = nullptr; /*set when the pool is opened*/
+
+struct Pmdk {
+  static constexpr bool kStreaming = false;
+  static inline void Flush(const void *ptr, size_t size) {
+    pmemobj_flush(pmdk_pool, ptr, size);
+  }
+  static inline void Fence() { pmemobj_drain(pmdk_pool); }
+};
+#endif
+
+template <class P>
+inline void Persist(const void *ptr, size_t size) {
+  P::Flush(ptr, size);
+  P::Fence();
+}
+
+inline const char *Name(Policy policy) {
+  switch (policy) {
+    case kNone:
+      return "none";
+    case kClwb:
+      return "clwb";
+    case kClflushopt:
+      return "clflushopt";
+    case kNonTemporal:
+      return "nt";
+    default:
+      return "pmdk";
+  }
+}
+
+/*returns false for an unknown name*/
+inline bool Parse(const std::string &name, Policy *policy) {
+  for (uint32_t p = PERSIST_PMDK; p <= PERSIST_NT; ++p) {
+    if (name == Name(static_cast<Policy>(p))) {
+      *policy = static_cast<Policy>(p);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline Policy Detect() {
+  uint32_t eax, ebx, ecx, edx;
+  if (__get_cpuid_max(0, nullptr) < 7) return kPmdk;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  if (ebx & (1u << 24)) return kClwb;
+  if (ebx & (1u << 23)) return kClflushopt;
+  return kPmdk;
+}
+
+#ifdef PERSIST_POLICY
+inline Policy Current() { return static_cast<Policy>(PERSIST_POLICY); }
+inline void Select(Policy) {}
+#else
+inline Policy &Selected() {
+  static Policy policy = Detect();
+  return policy;
+}
+inline Policy Current() { return Selected(); }
+inline void Select(Policy policy) { Selected() = policy; }
+#endif
+
+#ifdef PMEM
+/*call f with the policy in use, the switch folds away in a fixed build*/
+template <class F>
+inline void Dispatch(F &&f) {
+  switch (Current()) {
+    case kNone:
+      f(NoFlush());
+      break;
+    case kClwb:
+      f(ClwbFence());
+      break;
+    case kClflushopt:
+      f(ClflushoptFence());
+      break;
+    case kNonTemporal:
+      f(NonTemporal());
+      break;
+    default:
+      f(Pmdk());
+  }
+}
+#endif
+
+/*whether writers should stream their bulk stores past the caches*/
+inline bool Streaming() { return Current() == kNonTemporal; }
+
+/* Copy size bytes from DRAM to PM with non-temporal stores, 32 bytes at a
+ * time with AVX. The lines dst only partly covers are stored through the cache
+ * and written back. Needs a Fence() before the copy is durable.*/
+inline void Stream_Copy(void *dst, const void *src, size_t size) {
+  auto d = reinterpret_cast<char *>(dst);
+  auto s = reinterpret_cast<const char *>(src);
+  uint64_t first = (reinterpret_cast<uint64_t>(d) + kLineSize - 1) &
+                   ~(kLineSize - 1);
+  uint64_t last = (reinterpret_cast<uint64_t>(d) + size) & ~(kLineSize - 1);
+  if (first >= last) {
+    memcpy(d, s, size);
+    Flush_Lines<Clwb>(d, size);
+    return;
+  }
+  uint64_t head = first - reinterpret_cast<uint64_t>(d);
+  uint64_t tail = reinterpret_cast<uint64_t>(d) + size - last;
+  if (head) {
+    memcpy(d, s, head);
+    Clwb(d);
+  }
+  for (uint64_t off = head; off < size - tail; off += 32) {
+#ifdef __AVX__
+    _mm256_stream_si256(
+        reinterpret_cast<__m256i *>(d + off),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + off)));
+#else
+    _mm_stream_si128(
+        reinterpret_cast<__m128i *>(d + off),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + off)));
+    _mm_stream_si128(
+        reinterpret_cast<__m128i *>(d + off + 16),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + off + 16)));
+#endif
+  }
+  if (tail) {
+    memcpy(d + size - tail, s + size - tail, tail);
+    Clwb(d + size - tail);
+  }
+}
+
+}  // namespace persist
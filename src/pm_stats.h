@@ -0,0 +1,169 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Per-thread counters of the cache-line flushes, fences and bytes written to
+// PM, kept apart for each kind of operation. A thread charges its persists to
+// the innermost Scope it is in, so the flushes of a split run by an insert are
+// charged to the split and not to the insert. The counters are plain
+// thread-local increments, cheap enough to stay on.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace pmstat {
+
+enum Op : uint32_t { kOther = 0, kInsert, kDelete, kSplit, kMerge, kNumOps };
+
+inline const char *Name(uint32_t op) {
+  static const char *names[kNumOps] = {"other", "insert", "delete", "split",
+                                       "merge"};
+  return names[op];
+}
+
+struct OpCounters {
+  uint64_t ops;
+  uint64_t flushes; /*cache lines written back*/
+  uint64_t fences;
+  uint64_t bytes;   /*the written-back lines plus the non-temporal stores*/
+};
+
+struct PersistStats {
+  OpCounters op[kNumOps];
+
+  void Add(const PersistStats &other) {
+    for (uint32_t i = 0; i < kNumOps; ++i) {
+      op[i].ops += other.op[i].ops;
+      op[i].flushes += other.op[i].flushes;
+      op[i].fences += other.op[i].fences;
+      op[i].bytes += other.op[i].bytes;
+    }
+  }
+};
+
+/*counters of live threads, plus the sum of the exited ones*/
+struct Registry {
+  std::mutex mutex;
+  std::vector<PersistStats *> threads;
+  PersistStats retired;
+};
+
+inline Registry &GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+struct alignas(64) ThreadSlot {
+  PersistStats stats;
+  uint32_t current; /*the operation the persists are charged to*/
+
+  ThreadSlot() : current(kOther) {
+    memset(&stats, 0, sizeof(stats));
+    auto &registry = GetRegistry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.threads.push_back(&stats);
+  }
+
+  ~ThreadSlot() {
+    auto &registry = GetRegistry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.retired.Add(stats);
+    for (auto it = registry.threads.begin(); it != registry.threads.end();
+         ++it) {
+      if (*it == &stats) {
+        registry.threads.erase(it);
+        break;
+      }
+    }
+  }
+};
+
+inline ThreadSlot &Local() {
+  static thread_local ThreadSlot slot;
+  return slot;
+}
+
+inline OpCounters &Current() {
+  auto &slot = Local();
+  return slot.stats.op[slot.current];
+}
+
+/*the write-back of the lines of [ptr, ptr + size)*/
+inline void Flush(const void *ptr, size_t size) {
+  uint64_t first = reinterpret_cast<uint64_t>(ptr) >> 6;
+  uint64_t last = (reinterpret_cast<uint64_t>(ptr) + size - 1) >> 6;
+  auto &counters = Current();
+  counters.flushes += last - first + 1;
+  counters.bytes += (last - first + 1) << 6;
+}
+
+inline void Fence() { Current().fences++; }
+
+inline void NTWrite(size_t size) { Current().bytes += size; }
+
+/*charges the persists of the calling thread to op while it lives*/
+class Scope {
+ public:
+  explicit Scope(Op op) {
+    auto &slot = Local();
+    prev_ = slot.current;
+    slot.current = op;
+    slot.stats.op[op].ops++;
+  }
+  ~Scope() { Local().current = prev_; }
+
+ private:
+  uint32_t prev_;
+};
+
+/*the counters of live threads are read without synchronization*/
+inline PersistStats Snapshot() {
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> guard(registry.mutex);
+  PersistStats total = registry.retired;
+  for (auto stats : registry.threads) {
+    total.Add(*stats);
+  }
+  return total;
+}
+
+/*only meaningful while no index operation is running*/
+inline void Reset() {
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> guard(registry.mutex);
+  memset(&registry.retired, 0, sizeof(registry.retired));
+  for (auto stats : registry.threads) {
+    memset(stats, 0, sizeof(*stats));
+  }
+}
+
+/*one line per kind of operation that ran or persisted anything*/
+inline void Report() {
+  auto stats = Snapshot();
+  for (uint32_t i = 0; i < kNumOps; ++i) {
+    auto &c = stats.op[i];
+    if (c.ops == 0 && c.flushes == 0 && c.fences == 0 && c.bytes == 0) {
+      continue;
+    }
+    char line[256];
+    if (c.ops == 0) {
+      snprintf(line, sizeof(line),
+               "pm writes: %s flushes = %lu, fences = %lu, bytes = %lu",
+               Name(i), c.flushes, c.fences, c.bytes);
+    } else {
+      snprintf(line, sizeof(line),
+               "pm writes: %s ops = %lu, flushes/op = %.2f, fences/op = %.2f, "
+               "bytes/op = %.1f",
+               Name(i), c.ops, (double)c.flushes / c.ops,
+               (double)c.fences / c.ops, (double)c.bytes / c.ops);
+    }
+    std::cout << line << std::endl;
+  }
+}
+
+}  // namespace pmstat
@@ -0,0 +1,128 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Per-segment Bloom filters in DRAM. A lookup consults the filter of its
+// segment before reading any bucket on PM, so most misses are answered
+// without touching PM. Inserts add their key under the bucket locks before the
+// pair becomes visible; deletes leave their bits behind until the next
+// rebuild, which happens on split, merge and recovery.
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "allocator.h"
+
+namespace filter {
+
+/* a register-blocked Bloom filter: a key sets kFilterHashes bits in one
+ * word, 8 bits per pair of a full segment*/
+constexpr uint32_t kFilterWords = 128;
+constexpr uint32_t kFilterHashes = 4;
+constexpr uint32_t kWordBits = 7; /*log2(kFilterWords)*/
+
+struct SegmentFilter {
+  uint64_t words[kFilterWords];
+
+  /*the pairs of a segment share the high bits of their hash, so remix*/
+  static inline uint64_t Mix(uint64_t key_hash) {
+    key_hash ^= key_hash >> 31;
+    key_hash *= 0xbf58476d1ce4e5b9ull;
+    key_hash ^= key_hash >> 29;
+    return key_hash;
+  }
+
+  static inline uint64_t Mask(uint64_t mix) {
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < kFilterHashes; ++i) {
+      mask |= 1ull << ((mix >> (kWordBits + 6 * i)) & 63);
+    }
+    return mask;
+  }
+
+  inline void Add(uint64_t key_hash) {
+    auto mix = Mix(key_hash);
+    __atomic_fetch_or(&words[mix & (kFilterWords - 1)], Mask(mix),
+                      __ATOMIC_RELAXED);
+  }
+
+  /*false only if the key was never added since the last rebuild*/
+  inline bool Contains(uint64_t key_hash) {
+    auto mix = Mix(key_hash);
+    auto mask = Mask(mix);
+    return (__atomic_load_n(&words[mix & (kFilterWords - 1)],
+                            __ATOMIC_RELAXED) &
+            mask) == mask;
+  }
+
+  /* replace the content with other, every word is stored at once so that
+   * a concurrent reader never misses a key present in both*/
+  void Assign(const SegmentFilter &other) {
+    for (uint32_t i = 0; i < kFilterWords; ++i) {
+      __atomic_store_n(&words[i], other.words[i], __ATOMIC_RELAXED);
+    }
+  }
+
+  uint64_t Bits_Set() {
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < kFilterWords; ++i) {
+      bits += __builtin_popcountll(words[i]);
+    }
+    return bits;
+  }
+};
+
+inline SegmentFilter *New() {
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, 64, sizeof(SegmentFilter)) != 0) {
+    std::cout << "failed to allocate a segment filter" << std::endl;
+    exit(1);
+  }
+  memset(ptr, 0, sizeof(SegmentFilter));
+  return reinterpret_cast<SegmentFilter *>(ptr);
+}
+
+/* filters unlinked from their segment; a reader may still hold one until it
+ * leaves its epoch*/
+struct RetiredFilters {
+  std::mutex mutex;
+  std::vector<std::pair<SegmentFilter *, Epoch>> filters;
+};
+
+inline RetiredFilters &GetRetired() {
+  static RetiredFilters retired;
+  return retired;
+}
+
+inline void Retire(SegmentFilter *segment_filter) {
+  if (segment_filter == nullptr) return;
+  auto epoch_manager = &Allocator::Get()->epoch_manager_;
+  auto &retired = GetRetired();
+  std::lock_guard<std::mutex> guard(retired.mutex);
+  retired.filters.emplace_back(segment_filter,
+                               epoch_manager->GetCurrentEpoch());
+  epoch_manager->BumpCurrentEpoch();
+  size_t kept = 0;
+  for (auto &item : retired.filters) {
+    if (epoch_manager->IsSafeToReclaim(item.second)) {
+      free(item.first);
+    } else {
+      retired.filters[kept++] = item;
+    }
+  }
+  retired.filters.resize(kept);
+}
+
+inline void Report(uint64_t segments, uint64_t bits) {
+  std::cout << "segment filters: segments = " << segments << ", memory = "
+            << segments * sizeof(SegmentFilter) / 1024 << " KB, fill = "
+            << (segments ? (double)bits / (segments * kFilterWords * 64) : 0)
+            << std::endl;
+}
+
+}  // namespace filter
@@ -0,0 +1,153 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Asynchronous segment split service. An insert that leaves a segment above the
+// high-water mark hands the hash of its key to the service, and background
+// splitter threads split the segment that owns the hash. Inserts then rarely
+// find a full segment and pay for the split themselves.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../util/utils.h"
+
+/* Splits the segment that owns key_hash if it is still above the high-water
+ * mark; returns true if a split was performed*/
+typedef bool (*SplitCallback)(void *context, uint64_t key_hash);
+
+namespace split {
+
+constexpr size_t kMaxQueueDepth = 4096; /*requests beyond it are dropped*/
+
+struct SplitStats {
+  uint64_t enqueued;
+  uint64_t dropped;          /*the queue was full*/
+  uint64_t splits;           /*splits performed by the service*/
+  uint64_t skipped;          /*the segment no longer needed a split*/
+  uint64_t queue_depth;      /*requests waiting right now*/
+  uint64_t max_queue_depth;
+  uint64_t total_latency_ns; /*from enqueue to the end of the split*/
+  uint64_t max_latency_ns;
+};
+
+class SplitService {
+ public:
+  SplitService(SplitCallback split, void *context)
+      : split_(split), context_(context) {
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  ~SplitService() { Stop(); }
+
+  void Start(uint32_t num_threads) {
+    stop_ = false;
+    for (uint32_t i = 0; i < num_threads; ++i) {
+      threads_.emplace_back(&SplitService::Run, this);
+    }
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : threads_) {
+      t.join();
+    }
+    threads_.clear();
+  }
+
+  /*returns false if the request is dropped*/
+  bool Enqueue(uint64_t key_hash) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (stop_ || queue_.size() >= kMaxQueueDepth) {
+        stats_.dropped++;
+        return false;
+      }
+      queue_.push_back(Request{key_hash, std::chrono::steady_clock::now()});
+      stats_.enqueued++;
+      if (queue_.size() > stats_.max_queue_depth) {
+        stats_.max_queue_depth = queue_.size();
+      }
+    }
+    cv_.notify_one();
+    return true;
+  }
+
+  SplitStats Stats() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    SplitStats stats = stats_;
+    stats.queue_depth = queue_.size();
+    return stats;
+  }
+
+  void Report() {
+    auto stats = Stats();
+    uint64_t completed = stats.splits + stats.skipped;
+    std::cout << "split_service_enqueued = " << stats.enqueued << std::endl;
+    std::cout << "split_service_dropped = " << stats.dropped << std::endl;
+    std::cout << "split_service_splits = " << stats.splits << std::endl;
+    std::cout << "split_service_skipped = " << stats.skipped << std::endl;
+    std::cout << "split_service_queue_depth = " << stats.queue_depth
+              << ", max = " << stats.max_queue_depth << std::endl;
+    std::cout << "split_service_latency: avg = "
+              << (completed ? stats.total_latency_ns / completed / 1000.0 : 0)
+              << " us, max = " << stats.max_latency_ns / 1000.0 << " us"
+              << std::endl;
+  }
+
+ private:
+  struct Request {
+    uint64_t key_hash;
+    std::chrono::steady_clock::time_point enqueue_time;
+  };
+
+  void Run() {
+    while (true) {
+      Request request;
+      {
+        std::unique_lock<std::mutex> guard(mutex_);
+        cv_.wait(guard, [this] { return stop_ || !queue_.empty(); });
+        if (stop_) return;
+        request = queue_.front();
+        queue_.pop_front();
+      }
+
+      bool done = split_(context_, request.key_hash);
+      uint64_t latency =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - request.enqueue_time)
+              .count();
+
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (done) {
+        stats_.splits++;
+      } else {
+        stats_.skipped++;
+      }
+      stats_.total_latency_ns += latency;
+      if (latency > stats_.max_latency_ns) stats_.max_latency_ns = latency;
+    }
+  }
+
+  SplitCallback split_;
+  void *context_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Request> queue_;
+  bool stop_{false};
+  std::vector<std::thread> threads_;
+  SplitStats stats_;
+};
+
+}  // namespace split
@@ -20,6 +20,7 @@
 #include "Hash.h"
 #include "allocator.h"
 #include "ex_finger.h"
+#include "latency.h"
 #include "lh_finger.h"
 #include "libpmemobj.h"
 
@@ -46,7 +47,77 @@ DEFINE_uint32(e, 0, "whether register epoch in application level:0/1");
 DEFINE_uint32(ms, 100, "#miliseconds to sample the operations");
 DEFINE_uint32(vl, 16, "the length of the variable length key");
 DEFINE_uint64(ps, 30ul, "The size of the memory pool (GB)");
-DEFINE_uint64(ed, 1000, "The frequency to enroll into the epoch");
+DEFINE_uint64(ed, 1000,
+              "The number of operations after which a session refreshes its "
+              "epoch");
+DEFINE_uint32(ka, 0,
+              "whether the index owns variable-length keys in a PM key arena "
+              "(dash-ex only):0/1");
+DEFINE_uint32(ss, 0,
+              "the number of background splitter threads, 0 splits segments "
+              "inline (dash-ex only)");
+DEFINE_uint32(ce, 0,
+              "whether inserters expand cooperatively through claimed split "
+              "work (dash-lh only):0/1");
+DEFINE_double(lf, 0,
+              "the load factor the background expander keeps the table below, "
+              "0 runs no expander (dash-lh with -ce 1 only)");
+DEFINE_double(lp, 0,
+              "the load factor at which dash-lh expands before any overflow "
+              "bucket is chained, 0 expands on overflow only");
+DEFINE_double(ls, 0,
+              "the load factor below which dash-lh shrinks, 0 never shrinks "
+              "(dash-lh with -lp only)");
+DEFINE_uint64(hc, 0,
+              "the size (MB) of the DRAM hot-key cache in front of dash-ex and "
+              "dash-lh, 0 disables it (fixed-length keys only)");
+DEFINE_uint32(fc, 0,
+              "whether writers that find their bucket locked hand the "
+              "operation to the lock holder (dash-ex only):0/1");
+DEFINE_uint32(sf, 0,
+              "whether lookups consult a DRAM Bloom filter per segment "
+              "before the buckets (dash-ex and dash-lh):0/1");
+DEFINE_uint32(dd, 0,
+              "whether dash-ex keeps its directory in DRAM only and rebuilds "
+              "it from the segments at recovery:0/1");
+DEFINE_uint32(bm, 0,
+              "whether dash-ex mirrors the bucket metadata in DRAM and "
+              "serves lookups from it:0/1");
+DEFINE_uint32(er, 0,
+              "number of threads that recover all segments right after the "
+              "recovery instead of on their first access, 0 recovers lazily "
+              "(dash-ex and dash-lh)");
+DEFINE_uint32(gc, 0,
+              "the interval (us) of the group flush of dash-ex inserts that "
+              "defer their flushes, 0 flushes every write:0~");
+DEFINE_string(pp, "auto",
+              "the persistence policy of all indexes, unless fixed at build "
+              "time: auto/none/clwb/clflushopt/nt/pmdk");
+DEFINE_string(cdc, "",
+              "the file dash-ex streams its inserts and deletes to, tailed by "
+              "a follower thread; empty disables the change stream");
+DEFINE_string(ck, "",
+              "the file dash-ex/dash-lh write a checkpoint to while the "
+              "benchmark runs, started after the pre-load; empty disables it");
+DEFINE_uint64(ckmb, 0,
+              "the write bandwidth cap of the checkpoint (MB/s), 0 is "
+              "uncapped:0~");
+DEFINE_string(cl, "",
+              "a checkpoint file loaded into the index instead of the "
+              "pre-load of -n keys; empty disables it");
+DEFINE_uint32(wu, 0,
+              "the number of threads that fault in the directory and segments "
+              "of dash-ex/dash-lh when an existing pool is opened, 0 disables "
+              "it:0~");
+DEFINE_uint32(lt, 0,
+              "time one in every lt operations of each thread in latency "
+              "histograms reported as percentiles, 0 disables it:0~");
+DEFINE_string(lj, "",
+              "the file the latency percentiles of every benchmark are "
+              "appended to as JSON lines; empty only prints them");
+DEFINE_string(fz, "",
+              "the file dash-ex is frozen to after the pre-load, pos/neg then "
+              "search the frozen snapshot; empty disables it");
 
 uint64_t initCap, thread_num, load_num, operation_num;
 std::string operation;
@@ -95,6 +166,129 @@ void set_affinity(uint32_t idx) {
   sched_setaffinity(0, sizeof(cpu_set_t), &my_set);
 }
 
+/*recover all segments of a recovered index now if -er asks for it*/
+template <class T>
+void EagerRecovery(Hash<T> *eh) {
+  if (FLAGS_er == 0) return;
+  if (index_type == "dash-ex") {
+    reinterpret_cast<extendible::Finger_EH<T> *>(eh)->EagerRecovery(FLAGS_er);
+  } else if (index_type == "dash-lh") {
+    reinterpret_cast<linear::Linear<T> *>(eh)->EagerRecovery(FLAGS_er);
+  }
+}
+
+/*fault in the pages of an opened dash-ex/dash-lh pool if -wu asks for it*/
+template <class T>
+void WarmUp(Hash<T> *eh) {
+  if (FLAGS_wu == 0) return;
+  if (index_type == "dash-ex") {
+    reinterpret_cast<extendible::Finger_EH<T> *>(eh)->WarmUp(FLAGS_wu);
+  } else if (index_type == "dash-lh") {
+    reinterpret_cast<linear::Linear<T> *>(eh)->WarmUp(FLAGS_wu);
+  }
+}
+
+/*a follower that tails the change stream and counts what it would apply*/
+struct Follower {
+  cdc::Reader *reader;
+  std::thread thread;
+  std::atomic<bool> stop{false};
+  uint64_t inserts = 0;
+  uint64_t deletes = 0;
+
+  uint64_t Poll() {
+    auto count = reader->Poll([&](const cdc::Record &record) {
+      if (record.op == cdc::kInsert) {
+        inserts++;
+      } else {
+        deletes++;
+      }
+    });
+    reader->Checkpoint();
+    return count;
+  }
+
+  void Run() {
+    while (!stop.load()) {
+      if (Poll() == 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+    while (Poll() != 0)
+      ;
+  }
+};
+
+Follower *StartFollower() {
+  if (FLAGS_cdc.empty() || index_type != "dash-ex") return nullptr;
+  auto reader = cdc::Reader::Open(FLAGS_cdc.c_str());
+  if (reader == nullptr) return nullptr;
+  auto follower = new Follower();
+  follower->reader = reader;
+  follower->thread = std::thread(&Follower::Run, follower);
+  return follower;
+}
+
+void StopFollower(Follower *follower) {
+  if (follower == nullptr) return;
+  follower->stop.store(true);
+  follower->thread.join();
+  std::cout << "change stream follower: inserts = " << follower->inserts
+            << ", deletes = " << follower->deletes
+            << ", applied seq = " << follower->reader->Applied_Seq()
+            << std::endl;
+}
+
+/*write a checkpoint of dash-ex or dash-lh in a background thread if -ck is
+ * set, the benchmark goes on meanwhile*/
+template <class T>
+std::thread *StartCheckpoint(Hash<T> *index) {
+  if (FLAGS_ck.empty()) return nullptr;
+  if (index_type != "dash-ex" && index_type != "dash-lh") {
+    std::cout << "checkpoints only apply to dash-ex and dash-lh" << std::endl;
+    return nullptr;
+  }
+  return new std::thread([index]() {
+    if (index_type == "dash-ex") {
+      reinterpret_cast<extendible::Finger_EH<T> *>(index)->Checkpoint(
+          FLAGS_ck.c_str(), thread_num, FLAGS_ckmb, true);
+    } else {
+      reinterpret_cast<linear::Linear<T> *>(index)->Checkpoint(
+          FLAGS_ck.c_str(), thread_num, FLAGS_ckmb, true);
+    }
+  });
+}
+
+void WaitCheckpoint(std::thread *checkpointer) {
+  if (checkpointer == nullptr) return;
+  checkpointer->join();
+  delete checkpointer;
+}
+
+/*freeze dash-ex to -fz if it is set and return the snapshot the searches run
+ * on, or the index itself*/
+template <class T>
+Hash<T> *FreezeIndex(Hash<T> *index) {
+  if (FLAGS_fz.empty()) return index;
+  if (index_type != "dash-ex" || (operation != "pos" && operation != "neg")) {
+    std::cout << "frozen snapshots only apply to pos/neg on dash-ex"
+              << std::endl;
+    return index;
+  }
+  reinterpret_cast<extendible::Finger_EH<T> *>(index)->Freeze(
+      FLAGS_fz.c_str(), thread_num);
+  auto start = std::chrono::steady_clock::now();
+  auto snapshot = frozen::Snapshot<T>::Open(FLAGS_fz.c_str());
+  if (snapshot == nullptr) return index;
+  std::cout << "frozen snapshot open time = "
+            << std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " us" << std::endl;
+  snapshot->getNumber();
+  return snapshot;
+}
+
 template <class T>
 Hash<T> *InitializeIndex(int seg_num) {
   Hash<T> *eh;
@@ -115,6 +309,44 @@ Hash<T> *InitializeIndex(int seg_num) {
     } else {
       new (eh) extendible::Finger_EH<T>();
     }
+    if (FLAGS_ka) {
+      reinterpret_cast<extendible::Finger_EH<T> *>(eh)->EnableKeyArena();
+    }
+    if (FLAGS_ss) {
+      reinterpret_cast<extendible::Finger_EH<T> *>(eh)->EnableSplitService(
+          FLAGS_ss);
+    }
+    if (FLAGS_hc) {
+      reinterpret_cast<extendible::Finger_EH<T> *>(eh)->EnableHotCache(
+          FLAGS_hc);
+    }
+    if (FLAGS_fc) {
+      reinterpret_cast<extendible::Finger_EH<T> *>(eh)->EnableCombining();
+    }
+    if (FLAGS_sf) {
+      reinterpret_cast<extendible::Finger_EH<T> *>(eh)->EnableSegmentFilters();
+    }
+    if (FLAGS_dd) {
+      reinterpret_cast<extendible::Finger_EH<T> *>(eh)->EnableDramDirectory();
+    }
+    if (file_exist && operation != "recovery" &&
+        reinterpret_cast<extendible::Finger_EH<T> *>(eh)->dram_directory) {
+      /*the directory did not survive the restart*/
+      eh->Recovery();
+      EagerRecovery(eh);
+    }
+    if (FLAGS_bm) {
+      reinterpret_cast<extendible::Finger_EH<T> *>(eh)->EnableBucketMirror(
+          pool_size);
+    }
+    if (FLAGS_gc) {
+      reinterpret_cast<extendible::Finger_EH<T> *>(eh)->EnableGroupCommit(
+          FLAGS_gc);
+    }
+    if (!FLAGS_cdc.empty()) {
+      reinterpret_cast<extendible::Finger_EH<T> *>(eh)->EnableChangeStream(
+          FLAGS_cdc.c_str());
+    }
   } else if (index_type == "dash-lh") {
     std::cout << "Initialize Dash-LH" << std::endl;
     std::string index_pool_name = pool_name + "pmem_lh.data";
@@ -131,6 +363,20 @@ Hash<T> *InitializeIndex(int seg_num) {
     } else {
       new (eh) linear::Linear<T>();
     }
+    if (FLAGS_ce) {
+      reinterpret_cast<linear::Linear<T> *>(eh)->EnableCooperativeExpansion(
+          FLAGS_lf);
+    }
+    if (FLAGS_lp > 0) {
+      reinterpret_cast<linear::Linear<T> *>(eh)->SetLoadFactorPolicy(FLAGS_lp,
+                                                                 FLAGS_ls);
+    }
+    if (FLAGS_hc) {
+      reinterpret_cast<linear::Linear<T> *>(eh)->EnableHotCache(FLAGS_hc);
+    }
+    if (FLAGS_sf) {
+      reinterpret_cast<linear::Linear<T> *>(eh)->EnableSegmentFilters();
+    }
   } else if (index_type == "cceh") {
     std::cout << "Initialize CCEH" << std::endl;
     std::string index_pool_name = pool_name + "pmem_cceh.data";
@@ -162,6 +408,7 @@ Hash<T> *InitializeIndex(int seg_num) {
   if (operation == "recovery") {
     gettimeofday(&tv3, NULL);  // test end
     eh->Recovery();
+    EagerRecovery(eh);
     gettimeofday(&tv2, NULL);  // test end
     double duration = (double)(tv2.tv_usec - tv1.tv_usec) / 1000000 +
                       (double)(tv2.tv_sec - tv1.tv_sec);
@@ -171,6 +418,7 @@ Hash<T> *InitializeIndex(int seg_num) {
     std::cout << "Total recovery time (open pool + recovery algorithm) = "
               << duration << std::endl;
   }
+  if (file_exist) WarmUp(eh);
 
   return eh;
 }
@@ -268,6 +516,8 @@ void concurr_insert_without_epoch(struct range *_range, Hash<T> *index) {
   if constexpr (!std::is_pointer_v<T>) {
     T *key_array = reinterpret_cast<T *>(workload);
     for (uint64_t i = begin; i < end; ++i) {
+      pmstat::Scope op_scope(pmstat::kInsert);
+      latency::Sample sample(latency::kInsert);
       index->Insert(key_array[i], DEFAULT);
     }
   } else {
@@ -275,6 +525,8 @@ void concurr_insert_without_epoch(struct range *_range, Hash<T> *index) {
     uint64_t string_key_size = sizeof(string_key) + _range->length;
     for (uint64_t i = begin; i < end; ++i) {
       var_key = reinterpret_cast<T>(workload + string_key_size * i);
+      pmstat::Scope op_scope(pmstat::kInsert);
+      latency::Sample sample(latency::kInsert);
       index->Insert(var_key, DEFAULT);
     }
   }
@@ -288,60 +540,30 @@ void concurr_insert(struct range *_range, Hash<T> *index) {
   int begin = _range->begin;
   int end = _range->end;
   char *workload = reinterpret_cast<char *>(_range->workload);
-  T key;
-  uint64_t repeat_key = 0;
 
+  spin_wait();
+  Session session(EPOCH_DURATION);
   if constexpr (!std::is_pointer_v<T>) {
     T *key_array = reinterpret_cast<T *>(workload);
-    uint64_t round = (end - begin) / EPOCH_DURATION;
-    uint64_t i = 0;
-    spin_wait();
-
-    while (i < round) {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-      for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-        index->Insert(key_array[j], DEFAULT, true);
-      }
-      ++i;
-    }
-
-    {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-        index->Insert(key_array[i], DEFAULT, true);
-      }
+    for (uint64_t i = begin; i < end; ++i) {
+      pmstat::Scope op_scope(pmstat::kInsert);
+      latency::Sample sample(latency::kInsert);
+      index->Insert(key_array[i], DEFAULT, session);
     }
   } else {
     T var_key;
-    uint64_t round = (end - begin) / EPOCH_DURATION;
-    uint64_t i = 0;
     uint64_t string_key_size = sizeof(string_key) + _range->length;
-
-    spin_wait();
-    while (i < round) {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-      for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-        var_key = reinterpret_cast<T>(workload + string_key_size * j);
-        index->Insert(var_key, DEFAULT, true);
-      }
-      ++i;
-    }
-
-    {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-        var_key = reinterpret_cast<T>(workload + string_key_size * i);
-        index->Insert(var_key, DEFAULT, true);
-      }
+    for (uint64_t i = begin; i < end; ++i) {
+      var_key = reinterpret_cast<T>(workload + string_key_size * i);
+      pmstat::Scope op_scope(pmstat::kInsert);
+      latency::Sample sample(latency::kInsert);
+      index->Insert(var_key, DEFAULT, session);
     }
   }
 
   end_notify(_range);
 }
 
-/*In this search version, the thread also needs to do the record its */
 template <class T>
 void concurr_search_sample(struct range *_range, Hash<T> *index) {
   uint64_t curr_index = _range->index;
@@ -350,60 +572,26 @@ void concurr_search_sample(struct range *_range, Hash<T> *index) {
   uint64_t begin = _range->begin;
   uint64_t end = _range->end;
   char *workload = reinterpret_cast<char *>(_range->workload);
-  T key;
-  uint64_t not_found = 0;
 
+  spin_wait();
+  Session session(EPOCH_DURATION);
   if constexpr (!std::is_pointer_v<T>) {
     T *key_array = reinterpret_cast<T *>(workload);
-    uint64_t round = (end - begin) / EPOCH_DURATION;
-    uint64_t i = 0;
-    spin_wait();
-
-    while (i < round) {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-      for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-        index->Get(key_array[j], true);
-        operation_record[curr_index].number++;
-      }
-      ++i;
-    }
-
-    {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-        index->Get(key_array[i], true);
-        operation_record[curr_index].number++;
-      }
+    for (uint64_t i = begin; i < end; ++i) {
+      latency::Sample sample(latency::kGet);
+      index->Get(key_array[i], session);
+      operation_record[curr_index].number++;
     }
   } else {
     T var_key;
-    uint64_t round = (end - begin) / EPOCH_DURATION;
-    uint64_t i = 0;
     uint64_t string_key_size = sizeof(string_key) + _range->length;
-
-    spin_wait();
-    while (i < round) {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-      for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-        var_key = reinterpret_cast<T>(workload + string_key_size * j);
-        index->Get(var_key, true);
-        operation_record[curr_index].number++;
-      }
-      ++i;
-    }
-
-    {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-        var_key = reinterpret_cast<T>(workload + string_key_size * i);
-        index->Get(var_key, true);
-        operation_record[curr_index].number++;
-      }
+    for (uint64_t i = begin; i < end; ++i) {
+      var_key = reinterpret_cast<T>(workload + string_key_size * i);
+      latency::Sample sample(latency::kGet);
+      index->Get(var_key, session);
+      operation_record[curr_index].number++;
     }
   }
-  // std::cout << "not_found = " << not_found << std::endl;
   end_sub();
 }
 
@@ -415,60 +603,28 @@ void concurr_insert_sample(struct range *_range, Hash<T> *index) {
   uint64_t begin = _range->begin;
   uint64_t end = _range->end;
   char *workload = reinterpret_cast<char *>(_range->workload);
-  T key;
-  uint64_t not_found = 0;
 
+  spin_wait();
+  Session session(EPOCH_DURATION);
   if constexpr (!std::is_pointer_v<T>) {
     T *key_array = reinterpret_cast<T *>(workload);
-    uint64_t round = (end - begin) / EPOCH_DURATION;
-    uint64_t i = 0;
-    spin_wait();
-
-    while (i < round) {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-      for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-        index->Insert(key_array[j], DEFAULT, true);
-        operation_record[curr_index].number++;
-      }
-      ++i;
-    }
-
-    {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-        index->Insert(key_array[i], DEFAULT, true);
-        operation_record[curr_index].number++;
-      }
+    for (uint64_t i = begin; i < end; ++i) {
+      pmstat::Scope op_scope(pmstat::kInsert);
+      latency::Sample sample(latency::kInsert);
+      index->Insert(key_array[i], DEFAULT, session);
+      operation_record[curr_index].number++;
     }
   } else {
     T var_key;
-    uint64_t round = (end - begin) / EPOCH_DURATION;
-    uint64_t i = 0;
     uint64_t string_key_size = sizeof(string_key) + _range->length;
-
-    spin_wait();
-    while (i < round) {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-      for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-        var_key = reinterpret_cast<T>(workload + string_key_size * j);
-        index->Insert(var_key, DEFAULT, true);
-        operation_record[curr_index].number++;
-      }
-      ++i;
-    }
-
-    {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-        var_key = reinterpret_cast<T>(workload + string_key_size * i);
-        index->Insert(var_key, DEFAULT, true);
-        operation_record[curr_index].number++;
-      }
+    for (uint64_t i = begin; i < end; ++i) {
+      var_key = reinterpret_cast<T>(workload + string_key_size * i);
+      pmstat::Scope op_scope(pmstat::kInsert);
+      latency::Sample sample(latency::kInsert);
+      index->Insert(var_key, DEFAULT, session);
+      operation_record[curr_index].number++;
     }
   }
-  // std::cout << "not_found = " << not_found << std::endl;
   end_sub();
 }
 
@@ -478,53 +634,23 @@ void concurr_search(struct range *_range, Hash<T> *index) {
   uint64_t begin = _range->begin;
   uint64_t end = _range->end;
   char *workload = reinterpret_cast<char *>(_range->workload);
-  T key;
   uint64_t not_found = 0;
 
+  spin_wait();
+  Session session(EPOCH_DURATION);
   if constexpr (!std::is_pointer_v<T>) {
     T *key_array = reinterpret_cast<T *>(workload);
-    uint64_t round = (end - begin) / EPOCH_DURATION;
-    uint64_t i = 0;
-    spin_wait();
-
-    while (i < round) {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-      for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-        if (index->Get(key_array[j], true) == NONE) not_found++;
-      }
-      ++i;
-    }
-
-    {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-        if (index->Get(key_array[i], true) == NONE) not_found++;
-      }
+    for (uint64_t i = begin; i < end; ++i) {
+      latency::Sample sample(latency::kGet);
+      if (index->Get(key_array[i], session) == NONE) not_found++;
     }
   } else {
     T var_key;
-    uint64_t round = (end - begin) / EPOCH_DURATION;
-    uint64_t i = 0;
     uint64_t string_key_size = sizeof(string_key) + _range->length;
-
-    spin_wait();
-    while (i < round) {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-      for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-        var_key = reinterpret_cast<T>(workload + string_key_size * j);
-        if (index->Get(var_key, true) == NONE) not_found++;
-      }
-      ++i;
-    }
-
-    {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-        var_key = reinterpret_cast<T>(workload + string_key_size * i);
-        if (index->Get(var_key, true) == NONE) not_found++;
-      }
+    for (uint64_t i = begin; i < end; ++i) {
+      var_key = reinterpret_cast<T>(workload + string_key_size * i);
+      latency::Sample sample(latency::kGet);
+      if (index->Get(var_key, session) == NONE) not_found++;
     }
   }
   std::cout << "not_found = " << not_found << std::endl;
@@ -545,6 +671,7 @@ void concurr_search_without_epoch(struct range *_range, Hash<T> *index) {
   if constexpr (!std::is_pointer_v<T>) {
     T *key_array = reinterpret_cast<T *>(workload);
     for (uint64_t i = begin; i < end; ++i) {
+      latency::Sample sample(latency::kGet);
       if (index->Get(key_array[i]) == NONE) {
         not_found++;
       }
@@ -554,6 +681,7 @@ void concurr_search_without_epoch(struct range *_range, Hash<T> *index) {
     uint64_t string_key_size = sizeof(string_key) + _range->length;
     for (uint64_t i = begin; i < end; ++i) {
       var_key = reinterpret_cast<T>(workload + string_key_size * i);
+      latency::Sample sample(latency::kGet);
       if (index->Get(var_key) == NONE) {
         not_found++;
       }
@@ -576,6 +704,8 @@ void concurr_delete_without_epoch(struct range *_range, Hash<T> *index) {
   if constexpr (!std::is_pointer_v<T>) {
     T *key_array = reinterpret_cast<T *>(workload);
     for (uint64_t i = begin; i < end; ++i) {
+      pmstat::Scope op_scope(pmstat::kDelete);
+      latency::Sample sample(latency::kDelete);
       if (index->Delete(key_array[i]) == false) {
         not_found++;
       }
@@ -585,6 +715,8 @@ void concurr_delete_without_epoch(struct range *_range, Hash<T> *index) {
     int string_key_size = sizeof(string_key) + _range->length;
     for (uint64_t i = begin; i < end; ++i) {
       var_key = reinterpret_cast<T>(workload + string_key_size * i);
+      pmstat::Scope op_scope(pmstat::kDelete);
+      latency::Sample sample(latency::kDelete);
       if (index->Delete(var_key) == false) {
         not_found++;
       }
@@ -600,53 +732,25 @@ void concurr_delete(struct range *_range, Hash<T> *index) {
   int begin = _range->begin;
   int end = _range->end;
   char *workload = reinterpret_cast<char *>(_range->workload);
-  T key;
   uint64_t not_found = 0;
 
+  spin_wait();
+  Session session(EPOCH_DURATION);
   if constexpr (!std::is_pointer_v<T>) {
     T *key_array = reinterpret_cast<T *>(workload);
-    uint64_t round = (end - begin) / EPOCH_DURATION;
-    uint64_t i = 0;
-    spin_wait();
-
-    while (i < round) {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-      for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-        if (!index->Delete(key_array[j], true)) not_found++;
-      }
-      ++i;
-    }
-
-    {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-        if (!index->Delete(key_array[i], true)) not_found++;
-      }
+    for (uint64_t i = begin; i < end; ++i) {
+      pmstat::Scope op_scope(pmstat::kDelete);
+      latency::Sample sample(latency::kDelete);
+      if (!index->Delete(key_array[i], session)) not_found++;
     }
   } else {
     T var_key;
-    uint64_t round = (end - begin) / EPOCH_DURATION;
-    uint64_t i = 0;
     uint64_t string_key_size = sizeof(string_key) + _range->length;
-
-    spin_wait();
-    while (i < round) {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-      for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-        var_key = reinterpret_cast<T>(workload + string_key_size * j);
-        if (!index->Delete(var_key, true)) not_found++;
-      }
-      ++i;
-    }
-
-    {
-      auto epoch_guard = Allocator::AquireEpochGuard();
-      for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-        var_key = reinterpret_cast<T>(workload + string_key_size * i);
-        if (!index->Delete(var_key, true)) not_found++;
-      }
+    for (uint64_t i = begin; i < end; ++i) {
+      var_key = reinterpret_cast<T>(workload + string_key_size * i);
+      pmstat::Scope op_scope(pmstat::kDelete);
+      latency::Sample sample(latency::kDelete);
+      if (!index->Delete(var_key, session)) not_found++;
     }
   }
 
@@ -683,12 +787,17 @@ void mixed_without_epoch(struct range *_range, Hash<T> *index) {
 
     random = rng.next_uint32() % 100;
     if (random < insert_sign) { /*insert*/
+      pmstat::Scope op_scope(pmstat::kInsert);
+      latency::Sample sample(latency::kInsert);
       index->Insert(key, DEFAULT);
     } else if (random < read_sign) { /*get*/
+      latency::Sample sample(latency::kGet);
       if (index->Get(key) == NONE) {
         not_found++;
       }
     } else { /*delete*/
+      pmstat::Scope op_scope(pmstat::kDelete);
+      latency::Sample sample(latency::kDelete);
       index->Delete(key);
     }
   }
@@ -715,53 +824,29 @@ void mixed(struct range *_range, Hash<T> *index) {
   uint32_t read_sign = (uint32_t)(read_ratio * 100) + insert_sign;
   uint32_t delete_sign = (uint32_t)(delete_ratio * 100) + read_sign;
 
-  uint64_t round = (end - begin) / EPOCH_DURATION;
-  uint64_t i = 0;
   spin_wait();
-
-  while (i < round) {
-    auto epoch_guard = Allocator::AquireEpochGuard();
-    uint64_t _end = begin + (i + 1) * EPOCH_DURATION;
-    for (uint64_t j = begin + i * EPOCH_DURATION; j < _end; ++j) {
-      if constexpr (std::is_pointer_v<T>) { /* variable length*/
-        key = reinterpret_cast<T>(workload + string_key_size * j);
-      } else {
-        key = key_array[j];
-      }
-
-      random = rng.next_uint32() % 100;
-      if (random < insert_sign) { /*insert*/
-        index->Insert(key, DEFAULT, true);
-      } else if (random < read_sign) { /*get*/
-        if (index->Get(key, true) == NONE) {
-          not_found++;
-        }
-      } else { /*delete*/
-        index->Delete(key, true);
-      }
+  Session session(EPOCH_DURATION);
+  for (uint64_t i = begin; i < end; ++i) {
+    if constexpr (std::is_pointer_v<T>) { /* variable length*/
+      key = reinterpret_cast<T>(workload + string_key_size * i);
+    } else {
+      key = key_array[i];
     }
-    ++i;
-  }
 
-  {
-    auto epoch_guard = Allocator::AquireEpochGuard();
-    for (i = begin + EPOCH_DURATION * round; i < end; ++i) {
-      if constexpr (std::is_pointer_v<T>) { /* variable length*/
-        key = reinterpret_cast<T>(workload + string_key_size * i);
-      } else {
-        key = key_array[i];
-      }
-
-      random = rng.next_uint32() % 100;
-      if (random < insert_sign) { /*insert*/
-        index->Insert(key, DEFAULT, true);
-      } else if (random < read_sign) { /*get*/
-        if (index->Get(key, true) == NONE) {
-          not_found++;
-        }
-      } else { /*delete*/
-        index->Delete(key, true);
+    random = rng.next_uint32() % 100;
+    if (random < insert_sign) { /*insert*/
+      pmstat::Scope op_scope(pmstat::kInsert);
+      latency::Sample sample(latency::kInsert);
+      index->Insert(key, DEFAULT, session);
+    } else if (random < read_sign) { /*get*/
+      latency::Sample sample(latency::kGet);
+      if (index->Get(key, session) == NONE) {
+        not_found++;
       }
+    } else { /*delete*/
+      pmstat::Scope op_scope(pmstat::kDelete);
+      latency::Sample sample(latency::kDelete);
+      index->Delete(key, session);
     }
   }
 
@@ -783,6 +868,9 @@ void GeneralBench(range *rarray, Hash<T> *index, int thread_num,
   bar_c = thread_num;
 
   std::cout << profile_name << " Begin" << std::endl;
+  contention::Reset();
+  pmstat::Reset();
+  latency::Reset();
   //  System::profile(profile_name, [&]() {
   for (uint64_t i = 0; i < thread_num; ++i) {
     thread_array[i] = new std::thread(*test_func, &rarray[i], index);
@@ -823,6 +911,9 @@ void GeneralBench(range *rarray, Hash<T> *index, int thread_num,
       "ops/s, fastest = %f, slowest = %f\n",
       thread_num, duration, operation_num / duration, operation_num / shortest,
       operation_num / longest);
+  contention::Report();
+  pmstat::Report();
+  latency::Report(profile_name, FLAGS_lj);
   //  });
   std::cout << profile_name << " End" << std::endl;
 }
@@ -842,8 +933,10 @@ void RecoveryBench(range *rarray, Hash<T> *index, int thread_num,
   memset(last_record, 0, sizeof(uint64_t) * thread_num);
   memset(curr_record, 0, sizeof(uint64_t) * thread_num);
   double seconds = (double)msec / 1000;
+  std::vector<double> samples;
 
   std::cout << profile_name << " Begin" << std::endl;
+  latency::Reset();
   for (uint64_t i = 0; i < thread_num; ++i) {
     thread_array[i] =
         new std::thread(concurr_search_sample<T>, &rarray[i], index);
@@ -865,6 +958,7 @@ void RecoveryBench(range *rarray, Hash<T> *index, int thread_num,
     }
     double throughput = (double)operation_num / (double)1000000 / seconds;
     std::cout << throughput << std::endl; /*Mops/s*/
+    samples.push_back(throughput);
     memcpy(last_record, curr_record, sizeof(uint64_t) * thread_num);
   }
   gettimeofday(&tv2, NULL);  // test end
@@ -882,6 +976,18 @@ void RecoveryBench(range *rarray, Hash<T> *index, int thread_num,
       (double)(tv2.tv_usec - tv1.tv_usec) / 1000000 +
           (double)(tv2.tv_sec - tv1.tv_sec),
       operation_num / duration);
+  /*the last sample only covers the tail of the run*/
+  if (samples.size() > 1) samples.pop_back();
+  double peak = 0;
+  for (auto throughput : samples) peak = std::max(peak, throughput);
+  for (uint64_t i = 0; i < samples.size(); ++i) {
+    if (samples[i] >= 0.9 * peak) {
+      std::cout << "time to 90% of peak throughput = " << (i + 1) * msec
+                << " ms (peak = " << peak << " Mops/s)" << std::endl;
+      break;
+    }
+  }
+  latency::Report(profile_name, FLAGS_lj);
   //});
   std::cout << profile_name << " End" << std::endl;
 }
@@ -973,6 +1079,7 @@ void Run() {
   /* Initialize Index for Finger_EH*/
   uniform_generator = new uniform_key_generator_t();
   Hash<T> *index = InitializeIndex<T>(initCap);
+  Follower *follower = StartFollower();
   uint64_t generate_num = operation_num * 2 + load_num;
   /* Generate the workload and corresponding range array*/
   std::cout << "Generate workload" << std::endl;
@@ -985,7 +1092,8 @@ void Run() {
   }
 
   void *insert_workload;
-  if (key_type != "fixed") {
+  /*with the key arena the index copies the keys itself*/
+  if (key_type != "fixed" && !FLAGS_ka) {
     PMEMoid ptr;
     Allocator::Allocate(&ptr, kCacheLineSize,
                         (sizeof(string_key) + var_length) * generate_num, NULL,
@@ -999,8 +1107,14 @@ void Run() {
   }
   std::cout << "Finish Generate workload" << std::endl;
 
-  std::cout << "load num = " << load_num << std::endl;
-  Load<T>(load_num, index, var_length, insert_workload);
+  if (FLAGS_cl.empty()) {
+    std::cout << "load num = " << load_num << std::endl;
+    Load<T>(load_num, index, var_length, insert_workload);
+  } else {
+    checkpoint::Load<T>(FLAGS_cl.c_str(), index, thread_num);
+  }
+  std::thread *checkpointer = StartCheckpoint<T>(index);
+  index = FreezeIndex<T>(index);
   void *not_used_workload;
   void *not_used_insert_workload;
 
@@ -1045,9 +1159,11 @@ void Run() {
       GeneralBench<T>(rarray, index, thread_num, operation_num, "Insert",
                       &concurr_insert_without_epoch);
     }
+    index->getNumber();
   } else if (operation == "pos") {
     if (!load_num) {
       std::cout << "Please first specify the # pre_load keys!" << std::endl;
+      WaitCheckpoint(checkpointer);
       return;
     }
     for (int i = 0; i < thread_num; ++i) {
@@ -1063,6 +1179,7 @@ void Run() {
   } else if (operation == "neg") {
     if (!load_num) {
       std::cout << "Please first specify the # pre_load keys!" << std::endl;
+      WaitCheckpoint(checkpointer);
       return;
     }
     if (open_epoch == true) {
@@ -1075,6 +1192,7 @@ void Run() {
   } else if (operation == "delete") {
     if (!load_num) {
       std::cout << "Please first specify the # pre_load keys!" << std::endl;
+      WaitCheckpoint(checkpointer);
       return;
     }
     for (int i = 0; i < thread_num; ++i) {
@@ -1163,6 +1281,8 @@ void Run() {
     }
     index->getNumber();
   }
+  WaitCheckpoint(checkpointer);
+  StopFollower(follower);
 
   /*TODO Free the workload memory*/
 }
@@ -1192,6 +1312,7 @@ int main(int argc, char *argv[]) {
   open_epoch = FLAGS_e;
   EPOCH_DURATION = FLAGS_ed;
   msec = FLAGS_ms;
+  latency::Enable(FLAGS_lt);
   var_length = FLAGS_vl;
   pool_size = FLAGS_ps * 1024ul * 1024ul * 1024ul; /*pool_size*/
   if (open_epoch == true)
@@ -1215,6 +1336,19 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  if (FLAGS_pp != "auto") {
+    persist::Policy policy;
+    if (!persist::Parse(FLAGS_pp, &policy)) {
+      std::cout << "Unknown persistence policy " << FLAGS_pp << std::endl;
+      return 0;
+    }
+#ifdef PERSIST_POLICY
+    std::cout << "The persistence policy is fixed at build time to "
+              << persist::Name(persist::Current()) << std::endl;
+#endif
+    persist::Select(policy);
+  }
+
   if (key_type.compare(fixed) == 0) {
     Run<uint64_t>();
   } else {
@@ -0,0 +1,87 @@
+// Copyright (c) Simon Fraser University & The Chinese University of Hong Kong. All rights reserved.
+// Licensed under the MIT license.
+//
+// Warm-up of an opened pool. Pages of a reopened pool are mapped on their
+// first access, so the first requests after a restart take a page fault per
+// page of the directory and the segments they touch. The warm-up fans worker
+// threads out over the slots of an index, each slot faulting in the pages of
+// its segment, and only reads them so that no line becomes dirty.
+
+#pragma once
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "../util/pair.h"
+
+namespace warmup {
+
+constexpr uint64_t kPageSize = 4096;
+constexpr uint64_t kChunkSlots = 256; /*slots claimed by a worker at once*/
+
+/* Fault in the pages of [addr, addr + size) by reading a byte of each, after
+ * asking the kernel to read them ahead. Returns the number of pages.*/
+inline uint64_t Touch(const void *addr, uint64_t size) {
+  uint64_t begin = reinterpret_cast<uint64_t>(addr) & ~(kPageSize - 1);
+  uint64_t end = reinterpret_cast<uint64_t>(addr) + size;
+  madvise(reinterpret_cast<void *>(begin), end - begin, MADV_WILLNEED);
+  for (uint64_t page = begin; page < end; page += kPageSize) {
+    (void)*reinterpret_cast<volatile const char *>(page);
+  }
+  return (end - begin + kPageSize - 1) / kPageSize;
+}
+
+/*takes the pairs of a segment like a checkpoint sink and reads the
+ * variable-length keys they point to*/
+template <class T>
+struct Sink {
+  void Stage(T key, Value_t) {
+    if constexpr (std::is_pointer<T>::value) {
+      (void)*reinterpret_cast<volatile const int *>(&key->length);
+    }
+  }
+};
+
+/* Run warm(slot) for every slot in [0, num_slots) on num_threads workers;
+ * warm returns the number of pages it touched. Returns that total.*/
+template <class F>
+uint64_t Run(const char *name, uint64_t num_slots, uint32_t num_threads,
+             F warm) {
+  auto start = std::chrono::steady_clock::now();
+  if (num_threads == 0) num_threads = 1;
+  std::atomic<uint64_t> next_slot(0);
+  std::atomic<uint64_t> pages(0);
+  auto worker = [&]() {
+    uint64_t count = 0;
+    while (true) {
+      uint64_t begin = next_slot.fetch_add(kChunkSlots);
+      if (begin >= num_slots) break;
+      uint64_t end = std::min(begin + kChunkSlots, num_slots);
+      for (uint64_t i = begin; i < end; ++i) {
+        count += warm(i);
+      }
+    }
+    pages.fetch_add(count);
+  };
+  std::vector<std::thread> workers;
+  for (uint32_t t = 1; t < num_threads; ++t) workers.emplace_back(worker);
+  worker();
+  for (auto &thread : workers) thread.join();
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  std::cout << name << " warm-up: slots = " << num_slots
+            << ", pages = " << pages.load() << ", threads = " << num_threads
+            << ", time = " << elapsed / 1000.0 << " ms" << std::endl;
+  return pages.load();
+}
+
+}  // namespace warmup